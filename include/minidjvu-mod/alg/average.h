@@ -5,7 +5,9 @@
 
 /* Compute an "average" bitmap and return it.
  * The result is to be destroyed with mdjvu_bitmap_destroy().
- * 
+ * If n is 1, the result shares its pixels with the only bitmap
+ * (see mdjvu_bitmap_share()).
+ *
  * Additionally, centers must be given.
  */
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_average(mdjvu_bitmap_t *bitmaps,
@@ -3,3 +3,8 @@
  */
 
 MDJVU_FUNCTION void mdjvu_clean(mdjvu_image_t);
+
+/* Remove small flyspecks from a page kept as runs, before splitting.
+ * It uses the same size threshold as mdjvu_clean() does for this `dpi'.
+ */
+MDJVU_FUNCTION void mdjvu_clean_runs(mdjvu_runs_t, int32 dpi);
@@ -3,3 +3,34 @@
  */
 
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_render(mdjvu_image_t);
+
+/* Same as mdjvu_render(), but the result is kept as runs */
+MDJVU_FUNCTION mdjvu_runs_t mdjvu_render_runs(mdjvu_image_t);
+
+/* OR the shape into the page with its left top corner at (x, y),
+ * clipping what falls outside. The page must be made by
+ * mdjvu_bitmap_create_aligned(). Used to render while decoding.
+ */
+MDJVU_FUNCTION void mdjvu_render_shape
+    (mdjvu_bitmap_t page, mdjvu_bitmap_t shape, int32 x, int32 y);
+
+/* Render only the region of `w' x `h' pixels with the left top corner
+ * at (x, y) on the page; the result is the same as that part of
+ * mdjvu_render(), with white where the region is off the page.
+ * Only the blits in the region are visited, see mdjvu_image_get_blits_in_rect().
+ */
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_render_region
+    (mdjvu_image_t, int32 x, int32 y, int32 w, int32 h);
+
+/* Render the page `factor' times smaller as a graymap, 0 for black
+ * and 255 for white, of (width + factor - 1) / factor pixels by
+ * (height + factor - 1) / factor; its size is written to *width and *height.
+ * Each pixel gets the share of black in its `factor' x `factor' square
+ * of the page (or in the part of it that is on the page), so thin strokes
+ * fade instead of vanishing. The full-size page is never made, which
+ * makes this good for thumbnails and previews.
+ * Returns NULL if `factor' is not positive; release the result
+ * by mdjvu_destroy_2d_array().
+ */
+MDJVU_FUNCTION unsigned char **mdjvu_render_gray
+    (mdjvu_image_t, int32 factor, int32 *width, int32 *height);
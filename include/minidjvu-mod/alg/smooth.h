@@ -11,3 +11,6 @@
  */
 
 MDJVU_FUNCTION void mdjvu_smooth(mdjvu_bitmap_t b);
+
+/* Same as mdjvu_smooth(), for a page kept as runs */
+MDJVU_FUNCTION void mdjvu_smooth_runs(mdjvu_runs_t);
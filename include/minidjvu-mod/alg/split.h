@@ -10,8 +10,41 @@ MDJVU_FUNCTION mdjvu_split_options_t mdjvu_split_options_create(void);
  * This is only a recomendation, nothing is guaranteed.
  */
 MDJVU_FUNCTION void mdjvu_split_options_set_maximum_shape_size(mdjvu_split_options_t, int32 s);
+/*
+ * Crowded regions, such as halftones, are merged into not-a-letter blits,
+ * which mdjvu_clean() keeps whole. With this set, the flyspecks in them
+ * that mdjvu_clean() would remove are erased during the split (off by default).
+ */
+MDJVU_FUNCTION void mdjvu_split_options_set_clean(mdjvu_split_options_t, int clean);
 MDJVU_FUNCTION void mdjvu_split_options_destroy(mdjvu_split_options_t);
 
 
 MDJVU_FUNCTION mdjvu_image_t
     mdjvu_split(mdjvu_bitmap_t, int32 dpi, mdjvu_split_options_t);
+
+/* Same as mdjvu_split(), for a page kept as runs */
+MDJVU_FUNCTION mdjvu_image_t
+    mdjvu_split_runs(mdjvu_runs_t, int32 dpi, mdjvu_split_options_t);
+
+
+/*
+ * Streaming split: the page is fed row by row and is never held as a bitmap,
+ * only its runs of black pixels are. Rows may come in any order
+ * (top to bottom is cheapest), each exactly once; rows never added are white.
+ * The result is the same as of mdjvu_split() on the whole bitmap.
+ */
+typedef struct MinidjvuSplitter *mdjvu_splitter_t;
+
+MDJVU_FUNCTION mdjvu_splitter_t
+    mdjvu_splitter_create(int32 width, int32 height, mdjvu_split_options_t);
+
+/* `packed_row' is in the format of mdjvu_bitmap_access_packed_row() */
+MDJVU_FUNCTION void
+    mdjvu_splitter_add_row(mdjvu_splitter_t, int32 y, const unsigned char *packed_row);
+
+/* Splits the page and destroys the splitter */
+MDJVU_FUNCTION mdjvu_image_t
+    mdjvu_splitter_finish(mdjvu_splitter_t, int32 dpi);
+
+/* Destroys the splitter without splitting (e.g. on a read error) */
+MDJVU_FUNCTION void mdjvu_splitter_destroy(mdjvu_splitter_t);
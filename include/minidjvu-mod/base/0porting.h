@@ -31,6 +31,8 @@
  */
 
 
+#include <stddef.h>
+
 #ifndef MDJVU_USE_TIFFIO /* kluge not to typedef twice when using tiffio.h */
     #ifdef HAVE_STDINT_H
         #include <stdint.h>
@@ -108,6 +110,38 @@
 #define MDJVU_FREEV(P) free(P)
 
 
+/* Memory accounting.
+ * The library counts the memory it takes for the main kinds of data,
+ * so that one can see how much each stage of a job needs.
+ * The counts are for the whole process, all threads together.
+ * Nothing is counted unless accounting is on.
+ */
+typedef enum
+{
+    mdjvu_memory_bitmaps,       /* bitmaps, their slabs and shared pixels */
+    mdjvu_memory_patterns,      /* matcher patterns */
+    mdjvu_memory_classifier,    /* classifier's own structures */
+    mdjvu_memory_coder,         /* JB2 coder contexts */
+    mdjvu_memory_runs,          /* runs of pages, also while splitting */
+    mdjvu_memory_kinds_count
+} MinidjvuMemoryKind;
+
+/* Turn accounting on or off; do it before the library allocates anything,
+ * since memory taken while it is off would be taken off the counts when freed.
+ */
+MDJVU_FUNCTION void mdjvu_memory_set_accounting(int enabled);
+
+/* Bytes in use now, and the most in use since the last reset. */
+MDJVU_FUNCTION size_t mdjvu_memory_get_current(MinidjvuMemoryKind);
+MDJVU_FUNCTION size_t mdjvu_memory_get_peak(MinidjvuMemoryKind);
+
+/* Start new peaks from the current values, e.g. when a stage begins. */
+MDJVU_FUNCTION void mdjvu_memory_reset_peaks(void);
+
+/* A short name like "bitmaps", for reports. */
+MDJVU_FUNCTION const char *mdjvu_memory_get_name(MinidjvuMemoryKind);
+
+
 /* Check that the portability typedefs work as expected.
  * If not, returns an error message.
  * Returns NULL if OK.
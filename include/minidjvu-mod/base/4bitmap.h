@@ -15,9 +15,39 @@ extern int32 alive_bitmap_counter;
  */
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_bitmap_create(int32 width, int32 height);
 
+/* Same as mdjvu_bitmap_create(), but rows are padded with zeros to whole
+ * 64-bit words and start at 8-byte boundaries, so that word-level code
+ * may read and write them a word at a time. This is meant for pages;
+ * for small letters the padding would cost too much memory.
+ * The library keeps the padding zero.
+ */
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_bitmap_create_aligned(int32 width, int32 height);
+
 /* Destroy a bitmap. Each created bitmap must be destroyed sometime. */
 MDJVU_FUNCTION void mdjvu_bitmap_destroy(mdjvu_bitmap_t);
 
+/* A slab allocates many bitmaps from a few big blocks of memory.
+ * Bitmaps from a slab are used and destroyed as usual, even after
+ * the slab is released; its memory is freed when the slab is released
+ * and all its bitmaps are destroyed.
+ */
+typedef struct MinidjvuBitmapSlab *mdjvu_bitmap_slab_t;
+
+MDJVU_FUNCTION mdjvu_bitmap_slab_t mdjvu_bitmap_slab_create(void);
+MDJVU_FUNCTION void mdjvu_bitmap_slab_release(mdjvu_bitmap_slab_t);
+
+/* Same as mdjvu_bitmap_create(), but takes memory from the slab. */
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_bitmap_slab_create_bitmap
+    (mdjvu_bitmap_slab_t, int32 width, int32 height);
+
+/* Make mdjvu_bitmap_create() take small bitmaps from the slab
+ * in the calling thread (or from malloc() again, if NULL is given).
+ * The thread keeps the slab alive while it is current, so a slab
+ * can be released right after it is set. Threads have separate slabs,
+ * but a slab must not be current in two threads at once.
+ */
+MDJVU_FUNCTION void mdjvu_bitmap_slab_set_current(mdjvu_bitmap_slab_t);
+
 /* Return size of a bitmap in memory in bytes. */
 MDJVU_FUNCTION int mdjvu_bitmap_mem_size(mdjvu_bitmap_t bmp);
 
@@ -37,6 +67,13 @@ MDJVU_FUNCTION void mdjvu_bitmap_set_index(mdjvu_bitmap_t, int32 new_value);
  */
 MDJVU_FUNCTION int32 mdjvu_bitmap_get_packed_row_size(mdjvu_bitmap_t);
 
+/* Returns the distance between rows in bytes.
+ * Rows follow each other in memory, so this is the packed row size,
+ * unless the bitmap was created by mdjvu_bitmap_create_aligned()
+ * or trimmed by mdjvu_bitmap_trim_margins().
+ */
+MDJVU_FUNCTION int32 mdjvu_bitmap_get_row_stride(mdjvu_bitmap_t);
+
 
 /* Get a pointer to the bitmap's packed row. Use with caution.
  * Packing is PBM-ish:
@@ -82,6 +119,15 @@ MDJVU_FUNCTION void mdjvu_bitmap_clear(mdjvu_bitmap_t);
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_bitmap_crop
     (mdjvu_bitmap_t b, int32 left, int32 top, int32 w, int32 h);
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_bitmap_clone(mdjvu_bitmap_t b);
+
+/* Return a new bitmap with the same pixels, without copying them.
+ * The pixels are reference counted: each of the two bitmaps is destroyed
+ * as usual, and the memory is freed when both are.
+ * The bitmaps have separate indices, so they may be in different images.
+ * Don't change the pixels in place while they are shared;
+ * assign and exchange are fine, they don't write to the shared pixels.
+ */
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_bitmap_share(mdjvu_bitmap_t b);
 MDJVU_FUNCTION int mdjvu_bitmap_match(mdjvu_bitmap_t img1, mdjvu_bitmap_t img2);
 
 MDJVU_FUNCTION void mdjvu_bitmap_get_bounding_box
@@ -95,6 +141,16 @@ MDJVU_FUNCTION void mdjvu_bitmap_get_bounding_box
 MDJVU_FUNCTION void mdjvu_bitmap_remove_margins
     (mdjvu_bitmap_t, int32 *x, int32 *y);
 
+/* Same as mdjvu_bitmap_remove_margins(), but in place: the bitmap keeps
+ * its memory and just takes a part of it, so pixels are not copied,
+ * and only a left margin makes pixels move.
+ * The bitmap may take more memory than a tight one; use this for bitmaps
+ * that don't live long or rarely have margins, like decoded shapes.
+ * Don't use it on pixels shared by mdjvu_bitmap_share().
+ */
+MDJVU_FUNCTION void mdjvu_bitmap_trim_margins
+    (mdjvu_bitmap_t, int32 *x, int32 *y);
+
 /* Count the number of black pixels in the bitmap.
  * The results are not cached, so it uses O(width * height) time each call.
  */
@@ -57,6 +57,19 @@ MDJVU_FUNCTION void mdjvu_image_exchange_blits
  */
 MDJVU_FUNCTION void mdjvu_image_remove_NULL_blits(mdjvu_image_t);
 
+/* Find the blits whose parts on the page intersect the rectangle
+ * of `w' x `h' pixels with the left top corner at (x, y).
+ * Their indices are written to `result', which must have room for all blits,
+ * and their number is returned.
+ * The first call builds an index of blits, so that later ones take time
+ * by the size of the rectangle rather than by the number of blits.
+ * The index is dropped when blits are changed by the functions above;
+ * don't resize the bitmaps of blits otherwise while it may be in use.
+ * Several threads may look for blits in the same image at once.
+ */
+MDJVU_FUNCTION int32 mdjvu_image_get_blits_in_rect
+    (mdjvu_image_t, int32 x, int32 y, int32 w, int32 h, int32 *result);
+
 /* _________________________   bitmaps in an image   _______________________ */
 
 /* Get the number of bitmaps in a split image. */
@@ -0,0 +1,48 @@
+/*
+ * 7runs.h - run-length encoded bitonal pages
+ */
+
+/* A page kept as runs of black pixels, row by row.
+ * Text pages are mostly white, so this is many times smaller than a bitmap.
+ * Each row is a sequence of runs, left to right; a run is a pair
+ * of int32: its first pixel and the pixel right after its last one.
+ */
+typedef struct MinidjvuRuns *mdjvu_runs_t;
+
+/* Create an empty (white) page. */
+MDJVU_FUNCTION mdjvu_runs_t mdjvu_runs_create(int32 width, int32 height);
+MDJVU_FUNCTION void mdjvu_runs_destroy(mdjvu_runs_t);
+
+/* Exchange the contents of two pages; used to replace one by another. */
+MDJVU_FUNCTION void mdjvu_runs_exchange(mdjvu_runs_t, mdjvu_runs_t);
+
+MDJVU_FUNCTION int32 mdjvu_runs_get_width(mdjvu_runs_t);
+MDJVU_FUNCTION int32 mdjvu_runs_get_height(mdjvu_runs_t);
+
+/* Return size of the runs in memory in bytes. */
+MDJVU_FUNCTION int mdjvu_runs_mem_size(mdjvu_runs_t);
+
+/* Set row `y' from a row packed as in mdjvu_bitmap_access_packed_row().
+ * Rows may be set in any order; setting a row again replaces it.
+ */
+MDJVU_FUNCTION void mdjvu_runs_set_packed_row
+    (mdjvu_runs_t, int32 y, const unsigned char *packed_row);
+
+/* Set row `y' from `count' runs in the format described above. */
+MDJVU_FUNCTION void mdjvu_runs_set_row
+    (mdjvu_runs_t, int32 y, const int32 *runs, int32 count);
+
+/* Get the runs of row `y'; their number is written to *count. */
+MDJVU_FUNCTION const int32 *mdjvu_runs_get_row
+    (mdjvu_runs_t, int32 y, int32 *count);
+
+/* Write row `y' packed; `packed_row' needs (width + 7) / 8 bytes. */
+MDJVU_FUNCTION void mdjvu_runs_get_packed_row
+    (mdjvu_runs_t, int32 y, unsigned char *packed_row);
+
+/* Count the number of black pixels. */
+MDJVU_FUNCTION int32 mdjvu_runs_get_mass(mdjvu_runs_t);
+
+/* Conversions to and from bitmaps. */
+MDJVU_FUNCTION mdjvu_runs_t mdjvu_runs_create_from_bitmap(mdjvu_bitmap_t);
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_runs_to_bitmap(mdjvu_runs_t);
@@ -9,4 +9,5 @@
 #include <minidjvu-mod/base/4bitmap.h>
 #include <minidjvu-mod/base/5image.h>
 #include <minidjvu-mod/base/6string.h>
+#include <minidjvu-mod/base/7runs.h>
 #include "version.h"
@@ -16,6 +16,13 @@ MDJVU_FUNCTION int mdjvu_locate_jb2_chunk(mdjvu_file_t file, int32 *plength, mdj
 MDJVU_FUNCTION mdjvu_image_t mdjvu_file_load_djvu_page(mdjvu_file_t file, mdjvu_error_t *);
 MDJVU_FUNCTION mdjvu_image_t mdjvu_load_djvu_page(const char *path, mdjvu_error_t *);
 
+/*
+ * Same, but the page is rendered while it is decoded,
+ * see mdjvu_file_load_jb2_bitmap().
+ */
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_file_load_djvu_page_bitmap(mdjvu_file_t file, mdjvu_error_t *);
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_load_djvu_page_bitmap(const char *path, mdjvu_error_t *);
+
 /*
  * 1 - success, 0 - failure
  * After mdjvu_file_save_djvu_page() the file cursor is before the JB2 chunk.
@@ -13,3 +13,11 @@ MDJVU_FUNCTION int mdjvu_file_save_bmp(mdjvu_bitmap_t, mdjvu_file_t, int32 resol
  */
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_load_bmp(const char *path, mdjvu_error_t *);
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_file_load_bmp(mdjvu_file_t, mdjvu_error_t *);
+
+/*
+ * Streaming variants: rows go into a splitter instead of a bitmap
+ * (see mdjvu_splitter_create()); finish it with mdjvu_splitter_finish().
+ * Return NULL if failed.
+ */
+MDJVU_FUNCTION mdjvu_splitter_t mdjvu_load_bmp_split(const char *path, mdjvu_split_options_t, mdjvu_error_t *);
+MDJVU_FUNCTION mdjvu_splitter_t mdjvu_file_load_bmp_split(mdjvu_file_t, mdjvu_split_options_t, mdjvu_error_t *);
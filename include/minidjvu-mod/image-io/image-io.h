@@ -6,6 +6,7 @@
 #define MDJVU_IMAGE_IO_H
 
 #include "pbm.h"
+#include "pgm.h"
 #include "bmp.h"
 #include "tiff.h"
 
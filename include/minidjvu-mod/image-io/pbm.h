@@ -13,3 +13,11 @@ MDJVU_FUNCTION int mdjvu_file_save_pbm(mdjvu_bitmap_t, mdjvu_file_t, mdjvu_error
  */
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_load_pbm(const char *path, mdjvu_error_t *);
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_file_load_pbm(mdjvu_file_t, mdjvu_error_t *);
+
+/*
+ * Streaming variants: rows go into a splitter instead of a bitmap
+ * (see mdjvu_splitter_create()); finish it with mdjvu_splitter_finish().
+ * Return NULL if failed.
+ */
+MDJVU_FUNCTION mdjvu_splitter_t mdjvu_load_pbm_split(const char *path, mdjvu_split_options_t, mdjvu_error_t *);
+MDJVU_FUNCTION mdjvu_splitter_t mdjvu_file_load_pbm_split(mdjvu_file_t, mdjvu_split_options_t, mdjvu_error_t *);
@@ -0,0 +1,13 @@
+/*
+ * pgm.h - saving graymaps in PGM ("portable graymap") format
+ */
+
+/*
+ * Graymaps are written as is, so 0 is black and 255 is white,
+ * as made by mdjvu_render_gray().
+ * 1 - success, 0 - failure
+ */
+MDJVU_FUNCTION int mdjvu_save_pgm(unsigned char **, int32 width, int32 height,
+                                  const char *path, mdjvu_error_t *);
+MDJVU_FUNCTION int mdjvu_file_save_pgm(unsigned char **, int32 width, int32 height,
+                                       mdjvu_file_t, mdjvu_error_t *);
@@ -14,6 +14,11 @@ MDJVU_FUNCTION int mdjvu_save_tiff(mdjvu_bitmap_t, const char *path, mdjvu_error
  */
 MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_load_tiff(const char *path, int32 *resolution, mdjvu_error_t *, uint32 idx);
 
+/* Streaming variant: rows go into a splitter instead of a bitmap
+ * (see mdjvu_splitter_create()); finish it with mdjvu_splitter_finish().
+ */
+MDJVU_FUNCTION mdjvu_splitter_t mdjvu_load_tiff_split(const char *path, int32 *resolution, mdjvu_split_options_t, mdjvu_error_t *, uint32 idx);
+
 MDJVU_FUNCTION int mdjvu_have_tiff_support(void);
 
 MDJVU_FUNCTION void mdjvu_disable_tiff_warnings(void);
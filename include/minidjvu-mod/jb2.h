@@ -9,6 +9,14 @@
  */
 MDJVU_FUNCTION mdjvu_image_t mdjvu_file_load_jb2(mdjvu_file_t, int32 length, mdjvu_error_t *);
 
+/*
+ * Same as mdjvu_render() of what mdjvu_file_load_jb2() gives, but each shape
+ * goes into the page as soon as it is decoded, and no image is made.
+ * Only shapes of the JB2 library are kept while decoding.
+ * Returns NULL if failed to read JB2.
+ */
+MDJVU_FUNCTION mdjvu_bitmap_t mdjvu_file_load_jb2_bitmap(mdjvu_file_t, int32 length, mdjvu_error_t *);
+
 /*
  * 1 - success, 0 - error
  * Cannot save images that use shared dictionary.
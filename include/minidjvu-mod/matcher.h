@@ -84,4 +84,13 @@ MDJVU_FUNCTION void mdjvu_get_black_and_white_signature(
     unsigned char **data, int32 w, int32 h,
     unsigned char *result, int32 size);
 
+/* Mass center (as in mdjvu_pattern_get_center()) and both signatures above,
+ * computed together from row and column running sums of the pixels.
+ */
+MDJVU_FUNCTION void mdjvu_get_pattern_features(
+    unsigned char **data, int32 w, int32 h,
+    int32 *mass_center_x, int32 *mass_center_y,
+    unsigned char *gray_signature,
+    unsigned char *black_and_white_signature, int32 size);
+
 #endif /* MDJVU_PATTERNS_H */
@@ -23,7 +23,7 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_average(mdjvu_bitmap_t *bitmaps,
 
     if (n == 1)
     {
-        return mdjvu_bitmap_clone(bitmaps[0]);
+        return mdjvu_bitmap_share(bitmaps[0]);
     }
 
     for (i = 0; i < n; i++)
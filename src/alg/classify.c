@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 
 /* Stuff for not using malloc in C++
@@ -26,6 +27,10 @@
 # define FREEV(p)        do{if(p)free(p);}while(0)
 #endif
 
+/* Memory of the classifier's own structures, see mdjvu_memory_get_current() */
+#define COUNT(BYTES) \
+    mdjvu_memory_count(mdjvu_memory_classifier, (ptrdiff_t) (BYTES))
+
 
 /* Classes are single-linked lists with an additional pointer to the last node.
  * This is an class item.
@@ -72,6 +77,7 @@ typedef struct PatternList
 static Class *new_class(Classification *cl)
 {
     Class *c = MALLOC(Class);
+    COUNT(sizeof(Class));
     c->first = c->last = NULL;
     c->prev_class = NULL;
     c->count = 0;
@@ -93,6 +99,7 @@ static void delete_class(Classification *cl, Class *c)
 
     if (next)
         next->prev_class = prev;
+    COUNT(-(ptrdiff_t) sizeof(Class));
     FREE(c);
 }
 
@@ -100,6 +107,7 @@ static void delete_class(Classification *cl, Class *c)
 static ClassNode *new_node(Classification *cl, Class *c, PatternList * pl)
 {
     ClassNode *n = MALLOC(ClassNode);
+    COUNT(sizeof(ClassNode));
     n->ptr = pl->p;
     n->id  = pl->id;
     n->pos = pl->pos;
@@ -165,6 +173,7 @@ static void delete_all_classes(Classification *cl)
     {
         Class *t = c;
         c = c->next_class;
+        COUNT(-(ptrdiff_t) sizeof(Class));
         FREE(t);
     }
 }
@@ -304,6 +313,7 @@ static int32 get_tags_from_classification(int32 *r, int32 n, Classification *cl)
         r[node->pos] = node->tag;
         t = node;
         node = node->global_next;
+        COUNT(-(ptrdiff_t) sizeof(ClassNode));
         FREE(t);
     }
 
@@ -327,6 +337,7 @@ MDJVU_IMPLEMENT int32 mdjvu_classify_patterns
     init_classification(&cl);
 
     PatternList* pl = MALLOCV(PatternList, n);
+    COUNT(n * sizeof(PatternList));
     memset(pl, 0, sizeof(PatternList)*n);
     PatternList* head = pl;
     head->p = NULL;
@@ -355,12 +366,105 @@ MDJVU_IMPLEMENT int32 mdjvu_classify_patterns
     }
 
     classify(&cl, pl, options);
+    COUNT(-(ptrdiff_t) (n * sizeof(PatternList)));
     MDJVU_FREEV(pl);
 
     return get_tags_from_classification(r, n, &cl);
 }
 
 
+/* ___________________________   tiny glyphs   ______________________________ */
+
+/* Dots, commas and the like, up to 8x8 pixels, are many, and many of them
+ * are exactly alike. Such a glyph is packed into a 64-bit key (a byte a row)
+ * and looked up in a hash table; only the first one of identical glyphs
+ * gets a pattern and goes to classification, the others share its class.
+ */
+
+#define TINY_SIZE 8
+
+typedef struct
+{
+    uint64_t key;
+    int32 width, height, dpi;
+    int32 index; /* -1 for an empty slot */
+    unsigned char not_a_letter;
+} TinyEntry;
+
+static int get_tiny_key(mdjvu_bitmap_t bitmap, uint64_t *key)
+{
+    int32 w = mdjvu_bitmap_get_width(bitmap);
+    int32 h = mdjvu_bitmap_get_height(bitmap);
+    unsigned char mask = (unsigned char) (0xFF << (8 - w));
+    int32 y;
+
+    if (w > TINY_SIZE || h > TINY_SIZE) return 0;
+    *key = 0;
+    for (y = 0; y < h; y++)
+        *key = (*key << 8) | (*mdjvu_bitmap_access_packed_row(bitmap, y) & mask);
+    return 1;
+}
+
+/* Fill `original' with the index of the first identical tiny glyph
+ * (or the own index) for every bitmap of all pages, numbered through.
+ */
+static void find_tiny_duplicates(int32 npages, mdjvu_image_t *pages,
+                                 int32 total, int32 *original)
+{
+    int32 size = 16, mask, page, k = 0, i;
+    TinyEntry *table;
+
+    while (size < 2 * total) size <<= 1;
+    mask = size - 1;
+    table = MALLOCV(TinyEntry, size);
+    COUNT(size * sizeof(TinyEntry));
+    for (i = 0; i < size; i++)
+        table[i].index = -1;
+
+    for (page = 0; page < npages; page++)
+    {
+        mdjvu_image_t image = pages[page];
+        int32 n = mdjvu_image_get_bitmap_count(image);
+        int32 dpi = mdjvu_image_get_resolution(image);
+        for (i = 0; i < n; i++, k++)
+        {
+            mdjvu_bitmap_t bitmap = mdjvu_image_get_bitmap(image, i);
+            unsigned char not_a_letter =
+                mdjvu_image_get_not_a_letter_flag(image, bitmap);
+            int32 w = mdjvu_bitmap_get_width(bitmap);
+            int32 h = mdjvu_bitmap_get_height(bitmap);
+            uint64_t key, hash;
+            TinyEntry *e;
+
+            original[k] = k;
+            if (!get_tiny_key(bitmap, &key)) continue;
+
+            hash = (key ^ ((uint64_t) (w * TINY_SIZE + h) << 56))
+                 * 0x9E3779B97F4A7C15u;
+            for (e = &table[(hash >> 32) & mask]; e->index >= 0;
+                 e = &table[(e - table + 1) & mask])
+            {
+                if (e->key == key && e->width == w && e->height == h
+                    && e->dpi == dpi && e->not_a_letter == not_a_letter)
+                    break;
+            }
+            if (e->index >= 0)
+            {
+                original[k] = e->index;
+                continue;
+            }
+            e->key = key;
+            e->width = w;
+            e->height = h;
+            e->dpi = dpi;
+            e->not_a_letter = not_a_letter;
+            e->index = k;
+        }
+    }
+    COUNT(-(ptrdiff_t) (size * sizeof(TinyEntry)));
+    FREEV(table);
+}
+
 static void get_cheap_center(mdjvu_bitmap_t bitmap, int32 *cx, int32 *cy)
 {
     *cx = mdjvu_bitmap_get_width(bitmap) / 2;
@@ -377,19 +481,26 @@ MDJVU_IMPLEMENT int32 mdjvu_classify_bitmaps
     int32 i, n = mdjvu_image_get_bitmap_count(image);
     int32 dpi = mdjvu_image_get_resolution(image);
     mdjvu_pattern_t *patterns = MALLOCV(mdjvu_pattern_t, n);
+    int32 *original = MALLOCV(int32, n);
     int32 max_tag;
 
     if (verbose) {
         fprintf(stdout,"Size of JB2 image in memory: %0.2f MiB\n", (double) mdjvu_image_get_bitmap_count(image) / 1024 / 1024);
     }
 
+    find_tiny_duplicates(1, &image, n, original);
     for (i = 0; i < n; i++)
     {
         mdjvu_bitmap_t bitmap = mdjvu_image_get_bitmap(image, i);
-        patterns[i] = mdjvu_pattern_create(options, bitmap, mdjvu_image_get_not_a_letter_flag(image, bitmap));
+        if (original[i] != i)
+            patterns[i] = NULL;
+        else
+            patterns[i] = mdjvu_pattern_create(options, bitmap, mdjvu_image_get_not_a_letter_flag(image, bitmap));
     }
 
     max_tag = mdjvu_classify_patterns(patterns, result, n, dpi, options, verbose);
+    for (i = 0; i < n; i++)
+        result[i] = result[original[i]];
 
     if (centers_needed)
     {
@@ -398,8 +509,8 @@ MDJVU_IMPLEMENT int32 mdjvu_classify_bitmaps
         {
             int32 cx, cy;
             mdjvu_bitmap_t bitmap = mdjvu_image_get_bitmap(image, i);
-            if (patterns[i])
-                mdjvu_pattern_get_center(patterns[i], &cx, &cy);
+            if (patterns[original[i]])
+                mdjvu_pattern_get_center(patterns[original[i]], &cx, &cy);
             else
                 get_cheap_center(bitmap, &cx, &cy);
             mdjvu_image_set_center(image, bitmap, cx, cy); 
@@ -409,6 +520,7 @@ MDJVU_IMPLEMENT int32 mdjvu_classify_bitmaps
     for (i = 0; i < n; i++)
         if (patterns[i]) mdjvu_pattern_destroy(patterns[i]);
     FREEV(patterns);
+    FREEV(original);
 
     return max_tag;
 }
@@ -434,6 +546,7 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_patterns
 
     mdjvu_pattern_t* all_patterns = MALLOCV(mdjvu_pattern_t, total_patterns_count);
     PatternList* pl = MALLOCV(PatternList, total_patterns_count);
+    COUNT(total_patterns_count * sizeof(PatternList));
     PatternList* head = pl;
     head->p = NULL;
     PatternList* tail = NULL;
@@ -473,6 +586,7 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_patterns
     if (tail) {
         tail->next = NULL;
     } else {
+        COUNT(-(ptrdiff_t) (total_patterns_count * sizeof(PatternList)));
         MDJVU_FREEV(pl);
         MDJVU_FREEV(all_patterns);
         memset(result, 0, sizeof(int32) * total_patterns_count);
@@ -481,6 +595,7 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_patterns
 
     classify(&cl, pl, options);
 
+    COUNT(-(ptrdiff_t) (total_patterns_count * sizeof(PatternList)));
     MDJVU_FREEV(pl);
 
 
@@ -504,9 +619,11 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_bitmaps
         malloc(total_patterns_count * sizeof(mdjvu_pattern_t));
     mdjvu_pattern_t **pointers = (mdjvu_pattern_t **)
         malloc(npages * sizeof(mdjvu_pattern_t *));
+    int32 *original = (int32 *) malloc(total_patterns_count * sizeof(int32));
 
     double images_size_in_mem = 0;
     int32 patterns_created = 0;
+    find_tiny_duplicates(npages, pages, total_patterns_count, original);
     for (page = 0; page < npages; page++)
     {
         mdjvu_image_t current_image = pages[page];
@@ -519,8 +636,11 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_bitmaps
         for (i = 0; i < c; i++)
         {
             mdjvu_bitmap_t bmp = mdjvu_image_get_bitmap(current_image, i);
-            patterns[patterns_created++] = mdjvu_pattern_create(options, bmp,
-                                                                mdjvu_image_get_not_a_letter_flag(current_image, bmp));
+            if (original[patterns_created] != patterns_created)
+                patterns[patterns_created++] = NULL;
+            else
+                patterns[patterns_created++] = mdjvu_pattern_create(options, bmp,
+                                                                    mdjvu_image_get_not_a_letter_flag(current_image, bmp));
         }
     }
 
@@ -531,6 +651,8 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_bitmaps
     max_tag = mdjvu_multipage_classify_patterns
         (npages, total_patterns_count, npatterns,
          pointers, result, dpi, options, report, verbose);
+    for (k = 0; k < total_patterns_count; k++)
+        result[k] = result[original[k]];
 
     if (centers_needed)
     {
@@ -546,8 +668,9 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_bitmaps
             {
                 int32 cx, cy;
                 mdjvu_bitmap_t bitmap = mdjvu_image_get_bitmap(current_image, i);
-                if (patterns[patterns_processed])
-                    mdjvu_pattern_get_center(patterns[patterns_processed], &cx, &cy);
+                mdjvu_pattern_t p = patterns[original[patterns_processed]];
+                if (p)
+                    mdjvu_pattern_get_center(p, &cx, &cy);
                 else
                     get_cheap_center(bitmap, &cx, &cy);
                 patterns_processed++;
@@ -563,6 +686,7 @@ MDJVU_IMPLEMENT int32 mdjvu_multipage_classify_bitmaps
     }
     free(patterns);
     free(pointers);
+    free(original);
     free(npatterns);
     free(dpi);
 
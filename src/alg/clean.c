@@ -33,3 +33,106 @@ MDJVU_IMPLEMENT void mdjvu_clean(mdjvu_image_t image)
     mdjvu_image_remove_NULL_blits(image);
     mdjvu_image_remove_unused_bitmaps(image);
 }
+
+/* ___________________________   cleaning runs   ___________________________ */
+
+/* Components are found by joining runs that touch runs in the row above
+ * (diagonally too, as in split), with a union-find over run numbers.
+ */
+
+static int32 find_root(int32 *parent, int32 i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+static void join(int32 *parent, int32 a, int32 b)
+{
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b)
+        parent[b] = a;
+    else
+        parent[a] = b;
+}
+
+MDJVU_IMPLEMENT void mdjvu_clean_runs(mdjvu_runs_t runs, int32 dpi)
+{
+    int32 w = mdjvu_runs_get_width(runs);
+    int32 h = mdjvu_runs_get_height(runs);
+    int32 tinysize = dpi*dpi/20000 - 1;
+    int32 *first, *parent, *mass, *kept;
+    int32 total = 0, y, i, j;
+    mdjvu_runs_t result;
+
+    if (tinysize <= 0) return;
+
+    /* number the runs */
+    first = (int32 *) malloc((h + 1) * sizeof(int32));
+    for (y = 0; y < h; y++)
+    {
+        int32 count;
+        mdjvu_runs_get_row(runs, y, &count);
+        first[y] = total;
+        total += count;
+    }
+    first[h] = total;
+
+    parent = (int32 *) malloc(total * sizeof(int32));
+    mass = (int32 *) calloc(total, sizeof(int32));
+    for (i = 0; i < total; i++)
+        parent[i] = i;
+
+    /* join overlapping runs of adjacent rows */
+    for (y = 1; y < h; y++)
+    {
+        int32 n_up, n;
+        const int32 *up = mdjvu_runs_get_row(runs, y - 1, &n_up);
+        const int32 *p = mdjvu_runs_get_row(runs, y, &n);
+        i = j = 0;
+        while (i < n_up && j < n)
+        {
+            /* runs [a, b) and [c, d) touch if a <= d and c <= b */
+            if (up[2*i] <= p[2*j+1] && p[2*j] <= up[2*i+1])
+                join(parent, first[y - 1] + i, first[y] + j);
+            if (up[2*i+1] < p[2*j+1])
+                i++;
+            else
+                j++;
+        }
+    }
+
+    for (y = 0; y < h; y++)
+    {
+        int32 n;
+        const int32 *p = mdjvu_runs_get_row(runs, y, &n);
+        for (i = 0; i < n; i++)
+            mass[find_root(parent, first[y] + i)] += p[2*i+1] - p[2*i];
+    }
+
+    /* copy rows without tiny components */
+    kept = (int32 *) malloc((w + 1) * sizeof(int32));
+    result = mdjvu_runs_create(w, h);
+    for (y = 0; y < h; y++)
+    {
+        int32 n, k = 0;
+        const int32 *p = mdjvu_runs_get_row(runs, y, &n);
+        for (i = 0; i < n; i++)
+        {
+            if (mass[find_root(parent, first[y] + i)] <= tinysize)
+                continue;
+            kept[k++] = p[2*i];
+            kept[k++] = p[2*i+1];
+        }
+        if (k)
+            mdjvu_runs_set_row(result, y, kept, k / 2);
+    }
+    mdjvu_runs_exchange(runs, result);
+    mdjvu_runs_destroy(result);
+
+    free(kept);
+    free(mass);
+    free(parent);
+    free(first);
+}
@@ -220,7 +220,11 @@ MDJVU_IMPLEMENT void mdjvu_compress_image(mdjvu_image_t image, mdjvu_compression
  * Returns:
  *      the newly created dictionary (a 0 x 0 image to be destroyed later)
  *
- * FIXME: cloning bitmaps is a waste of memory - better to detach them instead.
+ * Dictionary letters share pixels with the page bitmaps they come from.
+ * The pages drop theirs in mdjvu_image_remove_unused_bitmaps(),
+ * as all their blits are substituted by then. Pixels that live in a slab
+ * keep the whole slab, so until the dictionary is destroyed it may hold
+ * more memory than clones of its letters would.
  */
 
 static mdjvu_image_t get_dictionary(int32 max_tag,
@@ -232,9 +236,8 @@ static mdjvu_image_t get_dictionary(int32 max_tag,
     {
         mdjvu_bitmap_t rep;
         if ((rep = representatives[tag]) == NULL) continue;
-        mdjvu_bitmap_t clone = mdjvu_bitmap_clone(rep);
-        representatives[tag] = clone;
-        mdjvu_image_add_bitmap(dictionary, clone);
+        representatives[tag] = mdjvu_bitmap_share(rep);
+        mdjvu_image_add_bitmap(dictionary, representatives[tag]);
     }
     return dictionary;
 }
@@ -4,59 +4,416 @@
 
 #include "../base/mdjvucfg.h"
 #include <minidjvu-mod/minidjvu-mod.h>
+#include "../base/bitops.h"
 #include <stdlib.h>
 #include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_render(mdjvu_image_t img)
+/* The page is rendered a row at a time, right in the packed format.
+ * Blits are sorted by their first visible row; those crossing the current
+ * row are kept in the `active' list and ORed into the row a word at a time.
+ * The page is cut into horizontal bands rendered by separate threads;
+ * each band starts with the blits that come from the bands above.
+ *
+ * A region of the page is rendered the same way, with the blits found
+ * by mdjvu_image_get_blits_in_rect() and coordinates taken from its corner.
+ */
+
+/* Bands are rendered in parallel only if they have at least that many rows */
+#define MIN_ROWS_PER_BAND 256
+
+typedef struct
+{
+    mdjvu_image_t image;
+    int32 x0, y0;        /* the result's left top corner on the page */
+    int32 width, height; /* the size of the result */
+    int32 left, right;   /* columns of the result that are on the page */
+    int32 top, bottom;   /* rows of the result that are on the page */
+    int32 *order;    /* visible blits sorted by their first visible row */
+    int32 *start;    /* for each row, where its blits begin in `order' */
+} Renderer;
+
+typedef struct
+{
+    int32 *active;   /* blits crossing the current row */
+    int32 active_count;
+} Band;
+
+#define BLIT_X(R, I) (mdjvu_image_get_blit_x((R)->image, I) - (R)->x0)
+#define BLIT_Y(R, I) (mdjvu_image_get_blit_y((R)->image, I) - (R)->y0)
+
+/* Set up rendering of the given blits (or all, if `blits' is NULL)
+ * into the `w' x `h' region with the left top corner at (x, y)
+ */
+static void renderer_init(Renderer *r, mdjvu_image_t img,
+                          int32 x, int32 y, int32 w, int32 h,
+                          const int32 *blits, int32 blit_count)
 {
-    int32 width  = mdjvu_image_get_width (img);
-    int32 height = mdjvu_image_get_height(img);
-    unsigned char **b = mdjvu_create_2d_array(width, height);
-    unsigned char *row_buffer = (unsigned char *) malloc(width);
-    int32 blit_count = mdjvu_image_get_blit_count(img);
+    int32 page_width  = mdjvu_image_get_width (img);
+    int32 page_height = mdjvu_image_get_height(img);
     int32 i;
-    mdjvu_bitmap_t result = mdjvu_bitmap_create(width, height);
 
-    /* Fill the canvas with white */
-    for (i = 0; i < height; i++)
-        memset(b[i], 0, width);
+    if (!blits)
+        blit_count = mdjvu_image_get_blit_count(img);
+    r->image = img;
+    r->x0 = x;
+    r->y0 = y;
+    r->width  = w;
+    r->height = h;
+    r->left   = x < 0 ? -x : 0;
+    r->top    = y < 0 ? -y : 0;
+    r->right  = page_width  - x < w ? page_width  - x : w;
+    r->bottom = page_height - y < h ? page_height - y : h;
+    if (r->top > h)
+        r->top = h;
+    if (r->bottom < r->top)
+        r->bottom = r->top; /* the region is off the page */
+    r->order = (int32 *) malloc(blit_count * sizeof(int32));
+    r->start = (int32 *) calloc(r->height + 1, sizeof(int32));
 
-    /* Render the split image blit by blit */
+    /* counting sort by the first visible row */
     for (i = 0; i < blit_count; i++)
     {
-        int32 x = mdjvu_image_get_blit_x(img, i);
-        int32 y = mdjvu_image_get_blit_y(img, i);
-        mdjvu_bitmap_t current_bitmap = mdjvu_image_get_blit_bitmap(img, i);
-        int32 w = mdjvu_bitmap_get_width(current_bitmap);
-        int32 h = mdjvu_bitmap_get_height(current_bitmap);
+        int32 blit = blits ? blits[i] : i;
+        int32 bx = BLIT_X(r, blit);
+        int32 by = BLIT_Y(r, blit);
+        mdjvu_bitmap_t bitmap = mdjvu_image_get_blit_bitmap(img, blit);
+        int32 bw = mdjvu_bitmap_get_width(bitmap);
+        int32 bh = mdjvu_bitmap_get_height(bitmap);
+        if (bx >= r->right || bx + bw <= r->left
+         || by >= r->bottom || by + bh <= r->top)
+            continue;
+        r->start[(by > r->top ? by : r->top) + 1]++;
+    }
+    for (i = 0; i < r->height; i++)
+        r->start[i + 1] += r->start[i];
+    for (i = 0; i < blit_count; i++)
+    {
+        int32 blit = blits ? blits[i] : i;
+        int32 bx = BLIT_X(r, blit);
+        int32 by = BLIT_Y(r, blit);
+        mdjvu_bitmap_t bitmap = mdjvu_image_get_blit_bitmap(img, blit);
+        int32 bw = mdjvu_bitmap_get_width(bitmap);
+        int32 bh = mdjvu_bitmap_get_height(bitmap);
+        if (bx >= r->right || bx + bw <= r->left
+         || by >= r->bottom || by + bh <= r->top)
+            continue;
+        r->order[r->start[by > r->top ? by : r->top]++] = blit;
+    }
+    /* the loop has moved every start to the next one */
+    for (i = r->height; i > 0; i--)
+        r->start[i] = r->start[i - 1];
+    r->start[0] = 0;
+}
+
+static void renderer_free(Renderer *r)
+{
+    free(r->order);
+    free(r->start);
+}
+
+/* Start a band at row `y0' with the blits from above that reach into it */
+static void band_init(Band *band, Renderer *r, int32 y0)
+{
+    int32 i;
+
+    band->active = (int32 *) malloc(r->start[r->height] * sizeof(int32));
+    band->active_count = 0;
+    for (i = 0; i < r->start[y0]; i++)
+    {
+        int32 blit = r->order[i];
+        mdjvu_bitmap_t bitmap = mdjvu_image_get_blit_bitmap(r->image, blit);
+        if (BLIT_Y(r, blit) + mdjvu_bitmap_get_height(bitmap) > y0)
+            band->active[band->active_count++] = blit;
+    }
+}
+
+static void band_free(Band *band)
+{
+    free(band->active);
+}
+
+/* OR `w' pixels of `src' into the padded row `dst' from position `x',
+ * clipping what falls outside columns left..right-1.
+ * Source words are masked to the visible pixels, so the padding stays zero.
+ */
+static void or_shifted(unsigned char *dst, int32 left, int32 right,
+                       const unsigned char *src, int32 w, int32 x)
+{
+    int32 src_size = (w + 7) >> 3;
+    int32 c0 = x < left ? left - x : 0;          /* first visible pixel */
+    int32 c1 = x + w > right ? right - x : w;    /* after the last one */
+    int32 pos;
+
+    for (pos = c0 & ~63; pos < c1; pos += 64)
+    {
+        int32 j = pos >> 3;
+        uint64_t word = mdjvu_load_be64(src + j,
+                                        src_size - j < 8 ? src_size - j : 8);
+        int32 d = x + pos; /* where the word goes */
+        int32 s;
+
+        if (c0 > pos)
+            word &= ~(uint64_t) 0 >> (c0 - pos);
+        if (c1 - pos < 64)
+            word &= ~(~(uint64_t) 0 >> (c1 - pos));
+        if (!word) continue;
+
+        if (d < 0)
+        {
+            /* only pixels from -d on are left */
+            mdjvu_store_word(dst, 0, mdjvu_load_word(dst, 0) | word << -d);
+            continue;
+        }
+        s = d & 63;
+        mdjvu_store_word(dst, d >> 6, mdjvu_load_word(dst, d >> 6) | word >> s);
+        if (s && word << (64 - s))
+        {
+            mdjvu_store_word(dst, (d >> 6) + 1,
+                mdjvu_load_word(dst, (d >> 6) + 1) | word << (64 - s));
+        }
+    }
+}
+
+/* Render row `y' into the padded `row', which is cleared first */
+static void render_row(Renderer *r, Band *band, int32 y, unsigned char *row)
+{
+    int32 i;
+
+    memset(row, 0, MDJVU_PADDED_ROW_SIZE(r->width));
+    for (i = r->start[y]; i < r->start[y + 1]; i++)
+        band->active[band->active_count++] = r->order[i];
+
+    i = 0;
+    while (i < band->active_count)
+    {
+        int32 blit = band->active[i];
+        int32 by = BLIT_Y(r, blit);
+        mdjvu_bitmap_t bitmap = mdjvu_image_get_blit_bitmap(r->image, blit);
+        if (y - by >= mdjvu_bitmap_get_height(bitmap))
+        {
+            /* done with this blit */
+            band->active[i] = band->active[--band->active_count];
+            continue;
+        }
+        or_shifted(row, r->left, r->right,
+                   mdjvu_bitmap_access_packed_row(bitmap, y - by),
+                   mdjvu_bitmap_get_width(bitmap), BLIT_X(r, blit));
+        i++;
+    }
+}
+
+MDJVU_IMPLEMENT void mdjvu_render_shape
+    (mdjvu_bitmap_t page, mdjvu_bitmap_t shape, int32 x, int32 y)
+{
+    int32 page_width  = mdjvu_bitmap_get_width (page);
+    int32 page_height = mdjvu_bitmap_get_height(page);
+    int32 w = mdjvu_bitmap_get_width (shape);
+    int32 h = mdjvu_bitmap_get_height(shape);
+    int32 i   = y < 0 ? -y : 0;
+    int32 end = page_height - y < h ? page_height - y : h;
+
+    for (; i < end; i++)
+    {
+        or_shifted(mdjvu_bitmap_access_packed_row(page, y + i), 0, page_width,
+                   mdjvu_bitmap_access_packed_row(shape, i), w, x);
+    }
+}
+
+/* How many bands to cut `rows' rows into */
+static int32 count_bands(int32 rows)
+{
+    int32 nbands = 1;
+
+#ifdef _OPENMP
+    if (!omp_in_parallel())
+    {
+        nbands = rows / MIN_ROWS_PER_BAND;
+        if (nbands > omp_get_max_threads())
+            nbands = omp_get_max_threads();
+        if (nbands < 1)
+            nbands = 1;
+    }
+#endif
+
+    return nbands;
+}
+
+/* Render the rows that are on the page into `result', in bands */
+static void render_bands(Renderer *r, mdjvu_bitmap_t result)
+{
+    int32 rows = r->bottom - r->top;
+    int32 nbands = count_bands(rows), b;
+
+#pragma omp parallel for schedule(static, 1) if (nbands > 1)
+    for (b = 0; b < nbands; b++)
+    {
+        int32 y0 = r->top + (int32) ((double) rows * b / nbands);
+        int32 y1 = r->top + (int32) ((double) rows * (b + 1) / nbands);
+        int32 y;
+        Band band;
+
+        band_init(&band, r, y0);
+        for (y = y0; y < y1; y++)
+            render_row(r, &band, y, mdjvu_bitmap_access_packed_row(result, y));
+        band_free(&band);
+    }
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_render(mdjvu_image_t img)
+{
+    Renderer r;
+    mdjvu_bitmap_t result;
+
+    renderer_init(&r, img, 0, 0, mdjvu_image_get_width(img),
+                  mdjvu_image_get_height(img), NULL, 0);
+    result = mdjvu_bitmap_create_aligned(r.width, r.height);
+    render_bands(&r, result);
+    renderer_free(&r);
+    return result;
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_render_region
+    (mdjvu_image_t img, int32 x, int32 y, int32 w, int32 h)
+{
+    Renderer r;
+    mdjvu_bitmap_t result;
+    int32 *blits = (int32 *) malloc(mdjvu_image_get_blit_count(img) * sizeof(int32));
+    int32 count = mdjvu_image_get_blits_in_rect(img, x, y, w, h, blits);
+
+    renderer_init(&r, img, x, y, w, h, blits, count);
+    free(blits);
+    result = mdjvu_bitmap_create_aligned(w, h);
+    render_bands(&r, result);
+    renderer_free(&r);
+    return result;
+}
+
+/* Add the black pixels of the padded `row' to `counts', one per `factor'
+ * columns. A word is cut at cell boundaries only where it has black pixels,
+ * so white parts of the row cost nothing but the load.
+ */
+static void count_row(const unsigned char *row, int32 width,
+                      int32 factor, int32 *counts)
+{
+    int32 words = (width + 63) >> 6, i;
+
+    for (i = 0; i < words; i++)
+    {
+        uint64_t word = mdjvu_load_word(row, i);
+        int32 x = i << 6;
 
-        /* Now w and h are dimensions of the current shape,
-         * and width and height are dimensions of the whole image.
-         */
+        while (word)
+        {
+            int32 cell = (x + mdjvu_clz64(word)) / factor;
+            int32 end = (cell + 1) * factor - x; /* the cell's end in the word */
+            uint64_t part = end >= 64 ? word : word & ~(~(uint64_t) 0 >> end);
+            counts[cell] += mdjvu_popcount64(part);
+            word ^= part;
+        }
+    }
+}
 
-        int32 min_col = x >= 0 ? 0 : - x;
-        int32 max_col_plus_one = x + w <= width ? w : width - x;
+/* Turn the black pixel counts of `rows' page rows into a graymap row;
+ * the cells at the right edge are averaged over the pixels they really have.
+ */
+static void counts_to_gray(const int32 *counts, unsigned char *gray,
+                           int32 width, int32 factor, int32 rows)
+{
+    int32 n = (width + factor - 1) / factor, i;
 
-        int32 min_row = y >= 0 ? 0 : - y;
-        int32 max_row_plus_one = y + h <= height ? h : height - y;
+    for (i = 0; i < n; i++)
+    {
+        int32 cols = i < n - 1 ? factor : width - i * factor;
+        double area = (double) cols * rows;
+        gray[i] = (unsigned char) (255 - (int32) (255 * (double) counts[i] / area + .5));
+    }
+}
+
+/* The page is rendered row by row as usual, but each row is counted
+ * straight into the graymap and never kept. Bands are cut at multiples
+ * of `factor' rows, so that each graymap row is made by one band.
+ */
+MDJVU_IMPLEMENT unsigned char **mdjvu_render_gray
+    (mdjvu_image_t img, int32 factor, int32 *pw, int32 *ph)
+{
+    Renderer r;
+    unsigned char **result;
+    int32 w, h, nbands, b;
 
-        int32 row;
+    if (factor < 1) return NULL;
+    renderer_init(&r, img, 0, 0, mdjvu_image_get_width(img),
+                  mdjvu_image_get_height(img), NULL, 0);
+    w = (r.width  + factor - 1) / factor;
+    h = (r.height + factor - 1) / factor;
+    result = mdjvu_create_2d_array(w, h);
+    nbands = count_bands(r.height);
+    if (nbands > h)
+        nbands = h;
 
-        /* Render the current blit row by row */
-        for (row = min_row; row < max_row_plus_one; row++)
+#pragma omp parallel for schedule(static, 1) if (nbands > 1)
+    for (b = 0; b < nbands; b++)
+    {
+        int32 g0 = (int32) ((double) h * b / nbands);
+        int32 g1 = (int32) ((double) h * (b + 1) / nbands);
+        unsigned char *row = (unsigned char *) malloc(MDJVU_PADDED_ROW_SIZE(r.width));
+        int32 *counts = (int32 *) malloc(w * sizeof(int32));
+        int32 g;
+        Band band;
+
+        band_init(&band, &r, g0 * factor);
+        for (g = g0; g < g1; g++)
         {
-            int32 col;
-            unsigned char *target = b[y + row] + x;
-            mdjvu_bitmap_unpack_row(current_bitmap, row_buffer, row);
-            for (col = min_col; col < max_col_plus_one; col++)
-                target[col] |= row_buffer[col];
+            int32 y0 = g * factor;
+            int32 y1 = y0 + factor < r.height ? y0 + factor : r.height;
+            int32 y;
+
+            memset(counts, 0, w * sizeof(int32));
+            for (y = y0; y < y1; y++)
+            {
+                if (!band.active_count && r.start[y] == r.start[y + 1])
+                    continue; /* a white row */
+                render_row(&r, &band, y, row);
+                count_row(row, r.width, factor, counts);
+            }
+            counts_to_gray(counts, result[g], r.width, factor, y1 - y0);
         }
+        band_free(&band);
+        free(counts);
+        free(row);
     }
 
-    free(row_buffer);
+    renderer_free(&r);
+    *pw = w;
+    *ph = h;
+    return result;
+}
+
+/* Rows go to the runs in turn, so this one has a single band */
+MDJVU_IMPLEMENT mdjvu_runs_t mdjvu_render_runs(mdjvu_image_t img)
+{
+    Renderer r;
+    Band band;
+    mdjvu_runs_t result;
+    unsigned char *row;
+    int32 y;
 
-    /* Convert 2D array to a Bitmap and return it */
-    mdjvu_bitmap_pack_all(result, b);
-    mdjvu_destroy_2d_array(b);
+    renderer_init(&r, img, 0, 0, mdjvu_image_get_width(img),
+                  mdjvu_image_get_height(img), NULL, 0);
+    band_init(&band, &r, 0);
+    result = mdjvu_runs_create(r.width, r.height);
+    row = (unsigned char *) malloc(MDJVU_PADDED_ROW_SIZE(r.width));
+    for (y = 0; y < r.height; y++)
+    {
+        if (!band.active_count && r.start[y] == r.start[y + 1])
+            continue; /* nothing here, the row stays white */
+        render_row(&r, &band, y, row);
+        mdjvu_runs_set_packed_row(result, y, row);
+    }
+    free(row);
+    band_free(&band);
+    renderer_free(&r);
     return result;
 }
@@ -6,9 +6,7 @@
 #include <minidjvu-mod/minidjvu-mod.h>
 #include <stdlib.h>
 #include <string.h>
-#ifndef _MSC_VER
-#include <endian.h>
-#endif
+#include "../base/bitops.h"
 
 /* all input rows must be 0-or-1 unpacked */
 //static void smooth_row(unsigned char *r, /* result    */
@@ -49,97 +47,72 @@
 //    }
 //}
 
-__inline size_t get_smooth(size_t u, size_t t, size_t d)
+__inline uint64_t get_smooth(uint64_t u, uint64_t t, uint64_t d)
 {
-    size_t ul = u >> 1, l = t >> 1, dl = d >> 1;
-    size_t ur = u << 1, r = t << 1, dr = d << 1;
+    uint64_t ul = u >> 1, l = t >> 1, dl = d >> 1;
+    uint64_t ur = u << 1, r = t << 1, dr = d << 1;
 
-    size_t res0 = l & r & u & d; // score 4 regardles t
-    size_t res1 = /*t &*/ ( (l & u)  |  (u & r) |  (r & d) | (l & d) | (l & r) | (u & d) ); // score >= 2
+    uint64_t res0 = l & r & u & d; // score 4 regardles t
+    uint64_t res1 = /*t &*/ ( (l & u)  |  (u & r) |  (r & d) | (l & d) | (l & r) | (u & d) ); // score >= 2
 
     // score 1
-    size_t res2 = /*t &*/ (u | d) & ( (ul & dl) | (ur & dr) );
+    uint64_t res2 = /*t &*/ (u | d) & ( (ul & dl) | (ur & dr) );
     res2 |= /*t &*/ (l | r) & ( (ul & ur) | (dl & dr) );
 
     return res0 | (t & (res1 | res2));
 }
 
-#if __BYTE_ORDER == __BIG_ENDIAN
-__inline size_t swap_t(size_t* val, unsigned int size) {
-    if (size >= sizeof (size_t))
-        return *val;
-
-    size_t res = 0;
-    memcpy(&res, val, size);
-    return res;
-}
-#elif __BYTE_ORDER == __LITTLE_ENDIAN
-__inline size_t swap_t(size_t* val, unsigned int size) {
-    size_t res = 0;
-    unsigned char * a = (unsigned char *) &res;
-    memcpy(&res, val, size);
-    unsigned char t;
-	for (unsigned int i = 0; i < (sizeof (size_t)/2); i++) {
-        t = a[i];
-        a[i] = a[sizeof (size_t) - i - 1];
-        a[sizeof (size_t) - i - 1] = t;
-    }
-    return res;
-}
-#endif
 
+/* Rows are padded with zeros to whole words (see MDJVU_PADDED_ROW_SIZE),
+ * so they are read and written a word at a time, with no partial words.
+ * The padding of the result is left clear.
+ */
 static void smooth_row(unsigned char *r, /* result    */
                        unsigned char *u, /* upper row */
-                       unsigned char *t, /* this row - must have margin 1 */
+                       unsigned char *t, /* this row  */
                        unsigned char *l, /* lower row */
                        int32 n)
 {
     if ( !n ) return;
-    const size_t int_len_in_bits = sizeof (size_t)*8;
-    const size_t len = (n + (int_len_in_bits -1) ) / int_len_in_bits;
-    const size_t tail_len = (n % int_len_in_bits) ? ((n % int_len_in_bits) + 7) >> 3 : sizeof (size_t);
-
-    size_t *r_p = (size_t *) r; /* result    */
-    size_t *u_p = (size_t *) u;
-    size_t *t_p = (size_t *) t;
-    size_t *l_p = (size_t *) l;
+    const int32 int_len_in_bits = 64;
+    const int32 len = (n + (int_len_in_bits -1) ) / int_len_in_bits;
+    const uint64_t last_mask = (~(uint64_t)0) << (len * int_len_in_bits - n);
 
-    size_t u_buf = 0, t_buf = 0, l_buf = 0;
-    size_t u_val = 0, t_val = 0, l_val = 0;
-    size_t u_cur = 0, t_cur = 0, l_cur = 0;
+    uint64_t u_buf = 0, t_buf = 0, l_buf = 0;
+    uint64_t u_val = 0, t_val = 0, l_val = 0;
+    uint64_t u_cur = 0, t_cur = 0, l_cur = 0;
 
-    const size_t mask1 = (~(size_t)0x0) << 1; //0b11111..110
-    const size_t mask2 = (size_t)0x01 << (int_len_in_bits-1); //0b100000.00
-    const size_t mask3 = mask2 >> 1; //0b01000..00
-    const size_t mask4 = mask3 >> 1; //0b00100..00
-    const size_t mask5 = mask1 & ~mask2; //0b01111..10
+    const uint64_t mask1 = (~(uint64_t)0x0) << 1; //0b11111..110
+    const uint64_t mask2 = (uint64_t)0x01 << (int_len_in_bits-1); //0b100000.00
+    const uint64_t mask3 = mask2 >> 1; //0b01000..00
+    const uint64_t mask4 = mask3 >> 1; //0b00100..00
+    const uint64_t mask5 = mask1 & ~mask2; //0b01111..10
 
 
-	for (unsigned int i = 0; i < len; i++) {
-        if (u_p) {
-            u_cur = swap_t(u_p++, i==len-1?tail_len:sizeof (size_t));
+    for (int32 i = 0; i < len; i++) {
+        if (u) {
+            u_cur = mdjvu_load_word(u, i);
             u_val = u_buf | (u_cur >> 2);
             u_buf = u_cur << (int_len_in_bits - 2);
         }
-        if (l_p) {
-            l_cur = swap_t(l_p++, i==len-1?tail_len:sizeof (size_t));
+        if (l) {
+            l_cur = mdjvu_load_word(l, i);
             l_val = l_buf | (l_cur >> 2);
             l_buf = l_cur << (int_len_in_bits - 2);
         }
 
-        t_cur = swap_t(t_p++, i==len-1?tail_len:sizeof (size_t));
+        t_cur = mdjvu_load_word(t, i);
         t_val = t_buf | (t_cur >> 2);
         t_buf = t_cur << (int_len_in_bits - 2);
 
-        size_t res = get_smooth(u_val, t_val, l_val);
+        uint64_t res = get_smooth(u_val, t_val, l_val);
 
-        size_t tail = res & mask3;
-        size_t head = res & mask4;
+        uint64_t tail = res & mask3;
+        uint64_t head = res & mask4;
 
         if (tail) {
             // for i == 0 tail is always false and this is not called
-            // we access last byte instead of size_t* to not mess with int endiannes
-			*(((unsigned char *)r_p)-1) |= 1;; // last bit is always 0 bcs of mask5
+            r[8*i - 1] |= 1; // last bit is always 0 bcs of mask5
         }
 
 
@@ -148,48 +121,137 @@ static void smooth_row(unsigned char *r, /* result    */
         if (head) {
             res |= mask2;
         }
+        if (i == len - 1) {
+            res &= last_mask;
+        }
 
-        res = swap_t(&res, /*i==len-1?tail_len:*/sizeof (size_t));
-        memcpy(r_p++, &res, (i==len-1)?tail_len:sizeof (size_t));
+        mdjvu_store_word(r, i, res);
     }
+}
 
+static void smooth_narrow(mdjvu_bitmap_t b, int32 w, int32 h, int32 row_size)
+{
+    uint64_t *rows = (uint64_t *) malloc(h * sizeof(uint64_t));
+    int32 i;
 
-    if (n % 8) {
-        r += ((n+7)>>3)-1;
-        *r &= 0xFF << (8- n % 8);
+    for (i = 0; i < h; i++)
+        rows[i] = mdjvu_load_be64(mdjvu_bitmap_access_packed_row(b, i), row_size);
+
+    /* all rows are loaded, so results go right into the bitmap */
+    for (i = 0; i < h; i++)
+    {
+        unsigned char *r = mdjvu_bitmap_access_packed_row(b, i);
+        uint64_t res = get_smooth(i > 0 ? rows[i - 1] : 0,
+                                  rows[i],
+                                  i + 1 < h ? rows[i + 1] : 0);
+        mdjvu_store_be64(r, res, row_size);
+        if (w % 8)
+            r[row_size - 1] &= 0xFF << (8 - w % 8);
     }
+
+    free(rows);
 }
 
+/* A row is written back one row later, when it is not needed as the upper
+ * row anymore. Rows of bitmaps padded to whole words (that is, aligned ones)
+ * are read in place; other rows are copied into three padded buffers.
+ */
 MDJVU_IMPLEMENT void mdjvu_smooth(mdjvu_bitmap_t b)
 {
     int32 w = mdjvu_bitmap_get_width(b);
     int32 h = mdjvu_bitmap_get_height(b);
-    int32 i;
+    int32 row_size, padded_size, i;
+    int in_place;
     unsigned char *u = NULL, /* upper row */
                   *t = NULL, /* this row */
                   *l = NULL; /* lower row */
+    unsigned char *buf, *r, *done, *tmp;
 
     if (h < 3) return;
 
-    const int32 row_size = mdjvu_bitmap_get_packed_row_size(b);
+    row_size = mdjvu_bitmap_get_packed_row_size(b);
+
+    if (w < MDJVU_NARROW_WIDTH)
+    {
+        smooth_narrow(b, w, h, row_size);
+        return;
+    }
 
-    unsigned char *r = (unsigned char *) malloc(row_size*h); /* result */
+    padded_size = MDJVU_PADDED_ROW_SIZE(w);
+    in_place = mdjvu_bitmap_get_row_stride(b) == padded_size;
+    buf = (unsigned char *) calloc(5, padded_size); /* 3 copies, 2 results */
+    r = buf + 3 * padded_size;
+    done = r + padded_size;
 
     l = mdjvu_bitmap_access_packed_row(b, 0);
+    if (!in_place)
+        l = (unsigned char *) memcpy(buf, l, row_size);
+
     for (i = 0; i < h; i++) {
         u = t;
         t = l;
 
         if (i + 1 < h)
+        {
             l = mdjvu_bitmap_access_packed_row(b, i+1);
+            if (!in_place)
+                l = (unsigned char *) memcpy(buf + (i + 1) % 3 * padded_size, l, row_size);
+        }
         else
             l = NULL;
 
-        smooth_row(r+row_size*i, u, t, l, w);
+        smooth_row(r, u, t, l, w);
+
+        if (i > 0)
+            memcpy(mdjvu_bitmap_access_packed_row(b, i-1), done, row_size);
+        tmp = done; done = r; r = tmp;
     }
+    memcpy(mdjvu_bitmap_access_packed_row(b, h-1), done, row_size);
+
+    free(buf);
+}
+
+/* Runs are smoothed a row at a time: three rows are packed around the one
+ * being smoothed, and rows with no black pixels near them are skipped.
+ */
+MDJVU_IMPLEMENT void mdjvu_smooth_runs(mdjvu_runs_t runs)
+{
+    int32 w = mdjvu_runs_get_width(runs);
+    int32 h = mdjvu_runs_get_height(runs);
+    int32 padded_size;
+    int32 i, n_up = 0, n_this = 0, n_down;
+    unsigned char *buf, *u, *t, *l, *r;
+    mdjvu_runs_t result;
 
+    if (h < 3) return;
 
-    memcpy(mdjvu_bitmap_access_packed_row(b, 0), r, row_size*h);
+    /* rows are padded for smooth_row() */
+    padded_size = MDJVU_PADDED_ROW_SIZE(w);
+    buf = (unsigned char *) calloc(4, padded_size);
+    u = buf; t = u + padded_size; l = t + padded_size; r = l + padded_size;
+    result = mdjvu_runs_create(w, h);
+
+    mdjvu_runs_get_row(runs, 0, &n_down);
+    mdjvu_runs_get_packed_row(runs, 0, l);
+    for (i = 0; i < h; i++)
+    {
+        unsigned char *tmp = u;
+        u = t; t = l; l = tmp;
+        n_up = n_this; n_this = n_down; n_down = 0;
+        if (i + 1 < h)
+        {
+            mdjvu_runs_get_row(runs, i + 1, &n_down);
+            mdjvu_runs_get_packed_row(runs, i + 1, l);
+        }
+
+        if (!n_this && !(n_up && n_down))
+            continue; /* a white pixel needs black above and below */
+
+        smooth_row(r, i > 0 ? u : NULL, t, i + 1 < h ? l : NULL, w);
+        mdjvu_runs_set_packed_row(result, i, r);
+    }
 
-    free(r);
+    mdjvu_runs_exchange(runs, result);
+    mdjvu_runs_destroy(result);
+    free(buf);
 }
@@ -0,0 +1,876 @@
+/*
+ * split_runs.h - the part of split.c that works on runs
+ */
+
+/* This file is included by split.c once for every layout of runs,
+ * with RUN_X defined as the type of horizontal coordinates
+ * and RUN(name) giving the name of everything defined here in that layout.
+ */
+
+#define Run                            RUN(Run)
+#define CCImage                        RUN(CCImage)
+#define ccimage_count                  RUN(ccimage_count)
+#define ccimage_add_single_run         RUN(ccimage_add_single_run)
+#define ccimage_add_row_runs           RUN(ccimage_add_row_runs)
+#define ccimage_add_bitmap_runs        RUN(ccimage_add_bitmap_runs)
+#define ccimage_add_page_runs          RUN(ccimage_add_page_runs)
+#define ccimage_sort_runs              RUN(ccimage_sort_runs)
+#define label_runs                     RUN(label_runs)
+#define ccimage_make_ccids_by_analysis RUN(ccimage_make_ccids_by_analysis)
+#define ccimage_make_ccs_from_ccids    RUN(ccimage_make_ccs_from_ccids)
+#define ccimage_erase_tiny_ccs         RUN(ccimage_erase_tiny_ccs)
+#define ccimage_find_noisy_cells       RUN(ccimage_find_noisy_cells)
+#define ccimage_merge_and_split_ccs    RUN(ccimage_merge_and_split_ccs)
+#define ccimage_sort_in_reading_order  RUN(ccimage_sort_in_reading_order)
+#define ccimage_get_bitmap_for_cc      RUN(ccimage_get_bitmap_for_cc)
+#define ccimage_get_jb2image           RUN(ccimage_get_jb2image)
+#define ccimage_set_dpi                RUN(ccimage_set_dpi)
+#define ccimage_create                 RUN(ccimage_create)
+#define ccimage_free                   RUN(ccimage_free)
+#define ccimage_split_and_free         RUN(ccimage_split_and_free)
+
+
+// -- A run of black pixels
+struct Run
+{
+    int y;         // vertical coordinate
+    RUN_X x1;      // first horizontal coordinate
+    RUN_X x2;      // last horizontal coordinate
+    int ccid;      // component id
+};
+
+// -- An image composed of runs
+struct CCImage
+{
+    int height;            // Height of the image in pixels
+    int width;             // Width of the image in pixels
+    int dpi;
+
+    struct Run* runs;             // array of runs
+    int  runs_count, runs_allocated;
+
+    struct CC*  ccs;              // Array of component descriptors
+    int  ccs_count, ccs_allocated;
+
+    int nregularccs;       // Number of regular ccs (set by merge_and_split_ccs)
+    int largesize;         // CCs larger than that are special
+    int smallsize;         // CCs smaller than that are special
+    int tinysize;          // CCs smaller than that may be removed
+    int clean;             // flyspecks of noisy cells are erased, not merged
+
+    size_t counted;        // bytes counted as mdjvu_memory_runs
+};
+
+// -- Brings the count of mdjvu_memory_runs up to the current sizes of arrays
+static void
+ccimage_count(struct CCImage* image)
+{
+    size_t size = sizeof(struct CCImage)
+                + image->runs_allocated * sizeof(struct Run)
+                + image->ccs_allocated * sizeof(struct CC);
+    mdjvu_memory_count(mdjvu_memory_runs,
+                       (ptrdiff_t) size - (ptrdiff_t) image->counted);
+    image->counted = size;
+}
+
+// -- Adds a run to the CCImage
+void
+ccimage_add_single_run(struct CCImage* image, int y, int x1, int x2, int ccid)
+{
+    if (image->runs_count >= image->runs_allocated) {
+        image->runs_allocated <<= 1;
+        image->runs = (struct Run *) realloc(image->runs,
+                                             image->runs_allocated * sizeof(struct Run));
+        ccimage_count(image);
+    }
+
+    struct Run* run = &image->runs[image->runs_count++];
+    run->y = y;
+    run->x1 = x1;
+    run->x2 = x2;
+    run->ccid = ccid;
+}
+
+// -- Adds runs extracted from a packed row
+//    The row is scanned a word at a time: leading zeros (or ones)
+//    give the next run boundary, and words with no boundary are skipped.
+static void
+ccimage_add_row_runs(struct CCImage* image, const unsigned char *row, int w, int y, int offx, int ccid)
+{
+    int row_size = (w + 7) >> 3;
+    int x1 = -1; // start of the current run, -1 outside of runs
+
+    // Iterate over words
+    for (int pos=0; pos<row_size; pos+=8)
+    {
+        uint64_t word = mdjvu_load_be64(row + pos, row_size - pos < 8 ? row_size - pos : 8);
+        int x0 = pos * 8;
+        int bit = 0;
+
+        if (w - x0 < 64) // margin bits are not guaranteed to be 0s
+            word &= ~(uint64_t) 0 << (64 - (w - x0));
+
+        if (x1 < 0 ? !word : !~word)
+            continue;
+
+        while (1)
+        {
+            uint64_t rest = (x1 < 0 ? word : ~word) << bit;
+            if (!rest) break;
+            bit += mdjvu_clz64(rest);
+            if (x1 < 0)
+            {
+                x1 = x0 + bit;
+            }
+            else
+            {
+                ccimage_add_single_run(image, y, offx+x1, offx+x0+bit-1, ccid);
+                x1 = -1;
+            }
+        }
+    }
+    if (x1 >= 0)
+        ccimage_add_single_run(image, y, offx+x1, offx+w-1, ccid);
+}
+
+// -- Adds runs extracted from a bitmap
+void
+ccimage_add_bitmap_runs(struct CCImage* image, const mdjvu_bitmap_t bm, int offx, int offy, int ccid)
+{
+    int w = mdjvu_bitmap_get_width(bm);
+    int h = mdjvu_bitmap_get_height(bm);
+
+    // Iterate over rows
+    for (int y=0; y<h; y++)
+        ccimage_add_row_runs(image, mdjvu_bitmap_access_packed_row(bm, y), w, offy+y, offx, ccid);
+}
+
+// -- Adds runs of a run-length page; they come sorted
+static void
+ccimage_add_page_runs(struct CCImage* image, mdjvu_runs_t runs)
+{
+    int h = mdjvu_runs_get_height(runs);
+
+    for (int y=0; y<h; y++)
+    {
+        int32 count;
+        const int32 *p = mdjvu_runs_get_row(runs, y, &count);
+        for (int i=0; i<count; i++, p+=2)
+            ccimage_add_single_run(image, y, p[0], p[1]-1, 0);
+    }
+}
+
+
+
+// -- Sorts runs by (y, x1) in linear time
+//    Two stable counting passes: by x1, then by y.
+static void
+ccimage_sort_runs(struct CCImage* image)
+{
+    int n = image->runs_count;
+    int size = MAX(image->width, image->height) + 1;
+    int* counts = MDJVU_MALLOCV(int, size);
+    struct Run* tmp = MDJVU_MALLOCV(struct Run, n);
+    int i;
+
+    // by x1 into tmp
+    memset(counts, 0, size * sizeof(int));
+    for (i=0; i<n; i++)
+        counts[image->runs[i].x1 + 1]++;
+    for (i=1; i<size; i++)
+        counts[i] += counts[i-1];
+    for (i=0; i<n; i++)
+        tmp[counts[image->runs[i].x1]++] = image->runs[i];
+
+    // by y back into runs
+    memset(counts, 0, size * sizeof(int));
+    for (i=0; i<n; i++)
+        counts[tmp[i].y + 1]++;
+    for (i=1; i<size; i++)
+        counts[i] += counts[i-1];
+    for (i=0; i<n; i++)
+        image->runs[counts[tmp[i].y]++] = tmp[i];
+
+    MDJVU_FREEV(tmp);
+    MDJVU_FREEV(counts);
+}
+
+
+// -- Labels a range of runs with the single pass algorithm
+//    Each run gets the smallest id of its component within the range,
+//    plus `id_base'; ids go in the order of first runs of components.
+static void
+label_runs(struct Run* runs, int count, int id_base)
+{
+    int n;
+    int p=0;
+
+    int umap_count = 0;
+    int umap_allocated = 16;
+    int* umap = MDJVU_MALLOCV(int, 16);
+
+
+    for (n=0; n<count; n++)
+    {
+        int y = runs[n].y;
+        int x1 = runs[n].x1 - 1;
+        int x2 = runs[n].x2 + 1;
+        int id = umap_count;
+        // iterate over previous line runs
+        for(;runs[p].y < y-1;p++);
+        for(;(runs[p].y < y) && (runs[p].x1 <= x2);p++ )
+        {
+            if ( runs[p].x2 >= x1 )
+            {
+                // previous run touches current run
+                int oid = runs[p].ccid;
+                while (umap[oid] < oid)
+                    oid = umap[oid];
+                if (id+1 > umap_count) {
+                    id = oid;
+                } else if (id < oid) {
+                    umap[oid] = id;
+                } else {
+                    umap[id] = oid;
+                    id = oid;
+                }
+                // freshen previous run id
+                runs[p].ccid = id;
+                // stop if previous run goes past current run
+                if (runs[p].x2 >= x2)
+                    break;
+            }
+        }
+        // create new entry in umap
+        runs[n].ccid = id;
+        if (id+1 >= umap_count) // if (id > umap.hbound())
+        {
+            if (id+1 >= umap_allocated) { // umap.touch(id);
+                while (id+1 >= umap_allocated) umap_allocated <<= 1;
+                umap = (int*) realloc(umap, umap_allocated * sizeof(int));
+            }
+            umap[id] = id;
+            umap_count++;
+        }
+
+    }
+    // Update umap and ccid
+    for (n=0; n<count; n++)
+    {
+        struct Run *run = &runs[n];
+        int ccid = run->ccid;
+        while (umap[ccid] < ccid)
+        {
+            ccid = umap[ccid];
+        }
+        umap[run->ccid] = ccid;
+        run->ccid = ccid + id_base;
+    }
+    MDJVU_FREEV(umap);
+}
+
+// -- Performs connected component analysis
+//    Runs must be sorted by (y, x1), as ccimage_add_bitmap_runs() emits them.
+//
+//    With several threads, the page is cut into horizontal bands
+//    that are labelled independently, each band's ids starting from the
+//    index of its first run. Components crossing band seams are then joined
+//    keeping the smallest id, that of the band where the component starts.
+//    So ids are ordered by first runs of components just like in a single
+//    pass, and ccimage_make_ccs_from_ccids() numbers ccs the same way.
+void
+ccimage_make_ccids_by_analysis(struct CCImage* image)
+{
+    struct Run* runs = image->runs;
+    int nruns = image->runs_count;
+    int nbands = 1;
+    int *starts, *umap;
+    int b, n;
+
+#ifdef _OPENMP
+    if (!omp_in_parallel())
+        nbands = MIN(omp_get_max_threads(), nruns / MIN_RUNS_PER_BAND);
+#endif
+
+    if (nbands <= 1)
+    {
+        label_runs(runs, nruns, 0);
+        return;
+    }
+
+    // Cut bands at row boundaries near equal numbers of runs
+    starts = MDJVU_MALLOCV(int, nbands + 1);
+    starts[0] = 0;
+    for (b=1; b<nbands; b++)
+    {
+        int start = MAX(starts[b-1], (int) ((double) nruns * b / nbands));
+        while (start > 0 && start < nruns && runs[start].y == runs[start-1].y)
+            start++;
+        starts[b] = start;
+    }
+    starts[nbands] = nruns;
+
+    // A row with many runs may take several cuts; drop the empty bands,
+    // so that each seam lies between two bands that have runs
+    n = 1;
+    for (b=1; b<=nbands; b++)
+        if (starts[b] > starts[n-1])
+            starts[n++] = starts[b];
+    nbands = n - 1;
+
+#pragma omp parallel for schedule(static, 1)
+    for (b=0; b<nbands; b++)
+        label_runs(runs + starts[b], starts[b+1] - starts[b], starts[b]);
+
+    // Join components across seams, the smaller id becoming the root
+    umap = MDJVU_MALLOCV(int, nruns);
+    for (n=0; n<nruns; n++)
+        umap[n] = n;
+    for (b=1; b<nbands; b++)
+    {
+        int p = starts[b-1], end = starts[b];
+        for (n=end; n<starts[b+1] && runs[n].y == runs[end].y; n++)
+        {
+            int x1 = runs[n].x1 - 1;
+            int x2 = runs[n].x2 + 1;
+            for(;p < end && runs[p].y < runs[n].y-1;p++);
+            for(;p < end && runs[p].x1 <= x2;p++)
+            {
+                if (runs[p].x2 >= x1)
+                {
+                    int id = runs[n].ccid, oid = runs[p].ccid;
+                    while (umap[id] < id) id = umap[id];
+                    while (umap[oid] < oid) oid = umap[oid];
+                    if (id < oid)
+                        umap[oid] = id;
+                    else
+                        umap[id] = oid;
+                    if (runs[p].x2 >= x2)
+                        break;
+                }
+            }
+        }
+    }
+    // Resolve roots in order, then relabel
+    for (n=0; n<nruns; n++)
+        umap[n] = umap[umap[n]];
+#pragma omp parallel for schedule(static)
+    for (n=0; n<nruns; n++)
+        runs[n].ccid = umap[runs[n].ccid];
+
+#ifndef NDEBUG
+    // Debug builds check that the bands give the same components
+    // as a single pass: the ids may differ, but must map one to one
+    {
+        struct Run* copy = MDJVU_MALLOCV(struct Run, nruns);
+        int *to_band = MDJVU_MALLOCV(int, nruns);
+        int *to_single = MDJVU_MALLOCV(int, nruns);
+        memcpy(copy, runs, nruns * sizeof(struct Run));
+        label_runs(copy, nruns, 0);
+        for (n=0; n<nruns; n++)
+            to_band[n] = to_single[n] = -1;
+        for (n=0; n<nruns; n++)
+        {
+            int single = copy[n].ccid, band = runs[n].ccid;
+            assert(to_band[single] == -1 || to_band[single] == band);
+            assert(to_single[band] == -1 || to_single[band] == single);
+            to_band[single] = band;
+            to_single[band] = single;
+        }
+        MDJVU_FREEV(to_single);
+        MDJVU_FREEV(to_band);
+        MDJVU_FREEV(copy);
+    }
+#endif
+
+    MDJVU_FREEV(umap);
+    MDJVU_FREEV(starts);
+}
+
+// -- Constructs the ``ccs'' array from run's ccids.
+//    Runs are moved to their ccs in order, so if they were sorted
+//    by (y, x1), runs of each cc end up sorted too.
+void
+ccimage_make_ccs_from_ccids(struct CCImage* image)
+{
+    if (!image->runs_count) return; // empty page
+    int n;
+    struct Run *pruns = image->runs;
+    // Find maximal ccid
+    int maxccid = image->nregularccs-1;
+    for (n=0; n<image->runs_count; n++)
+        if (pruns[n].ccid > maxccid)
+            maxccid = image->runs[n].ccid;
+
+    // Renumber ccs
+    int* armap = MDJVU_MALLOCV(int, maxccid+1);
+    int *rmap = armap;
+    for (n=0; n<=maxccid; n++)
+        armap[n] = -1;
+    for (n=0; n<image->runs_count; n++)
+        if (pruns[n].ccid >= 0)
+            rmap[ pruns[n].ccid ] = 1;
+    int nid = 0;
+    for (n=0; n<=maxccid; n++)
+        if (rmap[n] > 0)
+            rmap[n] = nid++;
+
+    // Adjust nregularccs (since ccs are renumbered)
+    while (image->nregularccs>0 && rmap[image->nregularccs-1]<0)
+        image->nregularccs -= 1;
+    if (image->nregularccs>0)
+        image->nregularccs = 1 + rmap[image->nregularccs-1];
+
+    // Prepare cc descriptors
+    if (image->ccs_allocated < nid) {
+        image->ccs_allocated = nid; // image->ccs->resize(0,nid-1);
+        image->ccs = (struct CC*) realloc(image->ccs, image->ccs_allocated * sizeof(struct CC));
+        ccimage_count(image);
+    }
+    image->ccs_count = nid;
+
+    for (n=0; n<nid; n++)
+        image->ccs[n].nrun = 0;
+
+    // Relabel runs
+    for (n=0; n<image->runs_count; n++)
+    {
+        struct Run *run = &pruns[n];
+        if (run->ccid < 0) continue;  // runs with negative ccids are destroyed
+        int oldccid = run->ccid;
+        int newccid = rmap[oldccid];
+        struct CC *cc = &image->ccs[newccid];
+        run->ccid = newccid;
+        cc->nrun += 1;
+    }
+
+    // Compute positions for runs of cc
+    int frun = 0;
+    for (n=0; n<nid; n++)
+    {
+        image->ccs[n].frun = rmap[n] = frun;
+        frun += image->ccs[n].nrun;
+    }
+
+    // Copy runs
+    struct Run* rtmp =  MDJVU_MALLOCV(struct Run, image->runs_count); //rtmp.steal(image->runs);
+    const int rtmp_hbound = image->runs_count-1;
+    memcpy(rtmp, image->runs, sizeof(struct Run)*image->runs_count);
+    struct Run *ptmp = rtmp;
+
+    image->runs_allocated = frun; // image->runs.resize(0,frun-1);
+    image->runs_count = frun;
+    image->runs = (struct Run *) realloc(image->runs, image->runs_allocated * sizeof(struct Run));
+    ccimage_count(image);
+    pruns = image->runs;
+
+    for (n=0; n<=rtmp_hbound; n++)
+    {
+        int id = ptmp[n].ccid;
+        if (id < 0) continue;
+        int pos = rmap[id]++;
+        pruns[pos] = ptmp[n];
+    }
+
+    MDJVU_FREEV(rtmp);
+    MDJVU_FREEV(armap);
+
+    // Finalize ccs
+    for (n=0; n<nid; n++)
+    {
+        struct CC *cc = &image->ccs[n];
+        int npix = 0;
+        struct Run *run = &image->runs[cc->frun];
+        int xmin = run->x1;
+        int xmax = run->x2;
+        int ymin = run->y;
+        int ymax = run->y;
+        for (int i=0; i<cc->nrun; i++, run++)
+        {
+            if (run->x1 < xmin)  xmin = run->x1;
+            if (run->x2 > xmax)  xmax = run->x2;
+            if (run->y  < ymin)  ymin = run->y;
+            if (run->y  > ymax)  ymax = run->y;
+            npix += run->x2 - run->x1 + 1;
+        }
+        cc->npix = npix;
+        cc->bb.xmin = xmin;
+        cc->bb.ymin = ymin;
+        cc->bb.xmax = xmax + 1;
+        cc->bb.ymax = ymax + 1;
+    }
+}
+
+// Removes ccs which are too small.
+void
+ccimage_erase_tiny_ccs(struct CCImage* image)
+{
+    for (int i=0; i<image->ccs_count; i++)
+    {
+        struct CC* cc = &image->ccs[i];
+        if (cc->npix <= image->tinysize)
+        {
+            // Mark cc to be erased
+            struct Run *r = &image->runs[cc->frun];
+            int nr = cc->nrun;
+            cc->nrun = 0;
+            cc->npix = 0;
+            while (--nr >= 0)
+                (r++)->ccid = -1;
+        }
+    }
+}
+
+
+// -- Finds grid cells crowded with ccs, as halftones and dithering are
+//    Such a cell has a cc (not counting large ones) centered in it
+//    for every NOISE_PIXELS_PER_CC pixels of its area.
+//    Returns a flag for each cell; ccs there get merged like small ones.
+static unsigned char*
+ccimage_find_noisy_cells(struct CCImage* image, int gridwidth, int gridheight)
+{
+    int splitsize = image->largesize;
+    int* counts = MDJVU_CALLOCV(int, gridwidth*gridheight);
+    unsigned char* noisy = MDJVU_MALLOCV(unsigned char, gridwidth*gridheight);
+
+    for (int ccid=0; ccid<image->ccs_count; ccid++)
+    {
+        struct CC* cc = &image->ccs[ccid];
+        if (cc->nrun <= 0) continue;
+        if (cc->bb.ymax-cc->bb.ymin >= image->largesize
+            || cc->bb.xmax-cc->bb.xmin >= image->largesize)
+            continue;
+        int gridi = (cc->bb.ymin+cc->bb.ymax)/splitsize/2;
+        int gridj = (cc->bb.xmin+cc->bb.xmax)/splitsize/2;
+        counts[gridi*gridwidth + gridj]++;
+    }
+    for (int gridi=0; gridi<gridheight; gridi++)
+    {
+        int h = MIN(splitsize, image->height - gridi*splitsize);
+        for (int gridj=0; gridj<gridwidth; gridj++)
+        {
+            int w = MIN(splitsize, image->width - gridj*splitsize);
+            int count = counts[gridi*gridwidth + gridj];
+            noisy[gridi*gridwidth + gridj] = count >= MIN_NOISY_CCS
+                && (double) count * NOISE_PIXELS_PER_CC >= (double) w * h;
+        }
+    }
+    MDJVU_FREEV(counts);
+    return noisy;
+}
+
+
+// -- Merges small ccs and split large ccs
+void
+ccimage_merge_and_split_ccs(struct CCImage* image)
+{
+    int ncc = image->ccs_count;
+    int nruns = image->runs_count;
+    int splitsize = image->largesize;
+    if (ncc <= 0) return;
+    // Grid of special components
+    int gridwidth = (image->width+splitsize-1)/splitsize;
+    int gridheight = (image->height+splitsize-1)/splitsize;
+    int gridsize = gridwidth*gridheight;
+    int split_count = 0;
+    int next_base = ncc + gridsize; // first id of the next split cc
+    unsigned char* noisy = ccimage_find_noisy_cells(image, gridwidth, gridheight);
+    // the bound of mdjvu_clean(), which keeps the merged cells whole
+    int cleansize = image->clean ? image->dpi*image->dpi/20000 - 1 : 0;
+    image->nregularccs = ncc;
+    // Set the correct ccids for the runs
+    for (int ccid=0; ccid<ncc; ccid++)
+    {
+        struct CC* cc = &image->ccs[ccid];
+        if (cc->nrun <= 0) continue;
+        int ccheight = cc->bb.ymax - cc->bb.ymin;
+        int ccwidth = cc->bb.xmax - cc->bb.xmin;
+        int cell_i = (cc->bb.ymin+cc->bb.ymax)/splitsize/2;
+        int cell_j = (cc->bb.xmin+cc->bb.xmax)/splitsize/2;
+        int large = ccheight>=image->largesize || ccwidth>=image->largesize;
+        int in_noise = !large && noisy[cell_i*gridwidth + cell_j];
+        if (in_noise && cc->npix <= cleansize)
+        {
+            // mdjvu_clean() would not see it inside the merged cell
+            for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
+                image->runs[runid].ccid = -1;
+        }
+        else if ((ccheight<=image->smallsize && ccwidth<=image->smallsize)
+            || in_noise)
+        {
+            int newccid = ncc + cell_i*gridwidth + cell_j;
+            for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
+                image->runs[runid].ccid = newccid;
+        }
+        else if (large)
+        {
+            // Pieces are numbered over grid cells of the bounding box,
+            // except for the first split cc, which shares the whole grid
+            // with merged small ccs (as in cjb2). This keeps ids in the
+            // same order as numbering whole grids, but bounded by the page.
+            int base = ncc, gi0 = 0, gj0 = 0, bw = gridwidth;
+            if (split_count)
+            {
+                gi0 = cc->bb.ymin/splitsize;
+                gj0 = cc->bb.xmin/splitsize;
+                bw = (cc->bb.xmax-1)/splitsize - gj0 + 1;
+                base = next_base;
+                next_base += ((cc->bb.ymax-1)/splitsize - gi0 + 1) * bw;
+            }
+            for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
+            {
+                struct Run* r = &image->runs[runid];
+                int y = r->y;
+                int x_start = r->x1;
+                int x_end = r->x2;
+                int gridi = y/splitsize;
+                int gridj_start = x_start/splitsize;
+                int gridj_end = x_end/splitsize;
+                int gridj_span = gridj_end-gridj_start;
+                int newccid = base + (gridi-gi0)*bw + gridj_start-gj0;
+                if (! gridj_span)
+                {
+                    r->ccid = newccid;
+                }
+                else // gridj_span>0
+                {
+                    // truncate the current run
+                    r->ccid = newccid++;
+                    int x = (gridj_start+1)*splitsize;
+                    r->x2 = x-1;
+
+                    //runs.touch(nruns+gridj_span-1);
+                    if (nruns+gridj_span > image->runs_allocated) {
+                        while (nruns+gridj_span > image->runs_allocated) image->runs_allocated <<= 1;
+                        image->runs = (struct Run *) realloc(image->runs,
+                                                             image->runs_allocated * sizeof(struct Run));
+                        ccimage_count(image);
+                    }
+                    // append additional runs to the runs array
+                    image->runs_count = nruns+gridj_span;
+                    for(int gridj=gridj_start+1; gridj<gridj_end; gridj++)
+                    {
+                        struct Run* newrun = &image->runs[nruns++];
+                        newrun->y = y;
+                        newrun->x1 = x;
+                        x += splitsize;
+                        newrun->x2 = x-1;
+                        newrun->ccid = newccid++;
+                    }
+                    // append last run to the run array
+                    struct Run* newrun = &image->runs[nruns++];
+                    newrun->y = y;
+                    newrun->x1 = x;
+                    newrun->x2 = x_end;
+                    newrun->ccid = newccid++;
+                }
+            }
+            split_count++;
+        }
+    }
+    MDJVU_FREEV(noisy);
+    // Recompute cc descriptors
+    // (runs are grouped by former ccs and followed by the split ones)
+    ccimage_sort_runs(image);
+    ccimage_make_ccs_from_ccids(image);
+}
+
+
+// -- Sort ccs in approximate reading order
+void
+ccimage_sort_in_reading_order(struct CCImage* image)
+{
+    if (image->nregularccs<2) return;
+    struct CC *ccarray = MDJVU_MALLOCV(struct CC, image->nregularccs);
+    // Copy existing ccarray (but segregate special ccs)
+    int ccid;
+    for(ccid=0; ccid<image->nregularccs; ccid++)
+        ccarray[ccid] = image->ccs[ccid];
+    // Sort the ccarray list into top-to-bottom order.
+    qsort (ccarray, image->nregularccs, sizeof(struct CC), top_edges_descending);
+    // Subdivide the ccarray list roughly into text lines [LYB]
+    // - Determine maximal top deviation
+    int maxtopchange = image->width / 40;
+    if (maxtopchange < 32)
+        maxtopchange = 32;
+    // - Loop until processing all ccs
+    int ccno = 0;
+    int *bottoms = MDJVU_MALLOCV(int, image->nregularccs);
+    while (ccno < image->nregularccs)
+    {
+        // - Gather first line approximation
+        int nccno;
+        int sublist_top = ccarray[ccno].bb.ymax-1;
+        int sublist_bottom = ccarray[ccno].bb.ymin;
+        for (nccno=ccno; nccno < image->nregularccs; nccno++)
+        {
+            if (ccarray[nccno].bb.ymax-1 < sublist_bottom) break;
+            if (ccarray[nccno].bb.ymax-1 < sublist_top - maxtopchange) break;
+            int bottom = ccarray[nccno].bb.ymin;
+            bottoms[nccno-ccno] = bottom;
+            if (bottom < sublist_bottom)
+                sublist_bottom = bottom;
+        }
+        // - If more than one candidate cc for the line
+        if (nccno > ccno + 1)
+        {
+            // - Compute median bottom
+            qsort(bottoms, nccno-ccno, sizeof(int), integer_ascending);
+            int bottom = bottoms[ (nccno-ccno-1)/2 ];
+            // - Compose final line
+            for (nccno=ccno; nccno < image->nregularccs; nccno++)
+                if (ccarray[nccno].bb.ymax-1 < bottom)
+                    break;
+            // - Sort final line
+            qsort (ccarray+ccno, nccno-ccno, sizeof(struct CC), left_edges_ascending);
+        }
+        // - Next line
+        ccno = nccno;
+    }
+    // Copy ccarray back and renumber the runs
+    for(ccid=0; ccid<image->nregularccs; ccid++)
+    {
+        const struct CC* cc = &ccarray[ccid];
+        image->ccs[ccid] = *cc;
+        for(int r=cc->frun; r<cc->frun+cc->nrun; r++)
+            image->runs[r].ccid = ccid;
+    }
+    // Free memory
+    MDJVU_FREEV(bottoms);
+    MDJVU_FREEV(ccarray);
+}
+
+// -- Creates a bitmap for a particular component
+mdjvu_bitmap_t
+ccimage_get_bitmap_for_cc(struct CCImage* image, const int ccid,
+                          mdjvu_bitmap_slab_t slab)
+{
+    const struct CC *cc = &image->ccs[ccid];
+    const struct GRect *bb = &cc->bb;
+
+    mdjvu_bitmap_t bitmap = mdjvu_bitmap_slab_create_bitmap(slab,
+                                bb->xmax - bb->xmin, bb->ymax - bb->ymin);
+    unsigned char **data = mdjvu_bitmap_access_packed_data(bitmap);
+    const struct Run *prun = & image->runs[(int)cc->frun];
+    for (int i=0; i<cc->nrun; i++,prun++)
+    {
+        assert(prun->y>=bb->ymin && prun->y<bb->ymax);
+        assert(prun->x1>=bb->xmin && prun->x2<bb->xmax);
+        mdjvu_fill_bits(data[prun->y - bb->ymin],
+                        prun->x1 - bb->xmin, prun->x2 - bb->xmin);
+    }
+    return bitmap;
+}
+
+
+// -- Creates a JB2Image with the remaining components
+mdjvu_image_t
+ccimage_get_jb2image(struct CCImage* image)
+{
+    mdjvu_image_t result = mdjvu_image_create(image->width, image->height);
+    mdjvu_image_enable_suspiciously_big_flags(result);
+    mdjvu_image_enable_not_a_letter_flags(result);
+    mdjvu_image_set_resolution(result, image->dpi);
+
+    if (image->runs_count <= 0)
+        return result;
+
+    // Iterate over CCs; the slab goes away with the last of the bitmaps
+    mdjvu_bitmap_slab_t slab = mdjvu_bitmap_slab_create();
+    for (int ccid=0; ccid<image->ccs_count; ccid++)
+    {
+        mdjvu_bitmap_t bitmap = ccimage_get_bitmap_for_cc(image, ccid, slab);
+        mdjvu_image_add_bitmap(result, bitmap);
+        mdjvu_image_add_blit(result, image->ccs[ccid].bb.xmin,
+                             image->ccs[ccid].bb.ymin, bitmap);
+        mdjvu_image_set_suspiciously_big_flag(result, bitmap, ccid >= image->nregularccs);
+        mdjvu_image_set_not_a_letter_flag(result, bitmap, ccid >= image->nregularccs);
+    }
+    mdjvu_bitmap_slab_release(slab);
+    // Return
+    return result;
+}
+
+
+
+static void
+ccimage_set_dpi(struct CCImage* image, int dpi)
+{
+    image->dpi = dpi;
+    dpi = MAX(200, MIN(900, dpi));
+    image->largesize = MIN( 500, MAX(64, dpi));
+    image->smallsize = MAX(2, dpi/150);
+    image->tinysize = MAX(0, dpi*dpi/20000 - 1);
+}
+
+struct CCImage *
+        ccimage_create(int width, int height, int dpi)
+{
+    struct CCImage * ccimage = MDJVU_MALLOC(struct CCImage);
+    ccimage->height = height;
+    ccimage->width = width;
+    ccimage->nregularccs = 0;
+    ccimage->clean = 0;
+
+    ccimage->runs_allocated = 16;
+    ccimage->runs = MDJVU_MALLOCV(struct Run, 16);
+    ccimage->ccs_allocated = 16;
+    ccimage->ccs = MDJVU_MALLOCV(struct CC, 16);
+    ccimage->runs_count = ccimage->ccs_count = 0;
+    ccimage->counted = 0;
+    ccimage_count(ccimage);
+
+    ccimage_set_dpi(ccimage, dpi);
+    return ccimage;
+}
+
+void
+ccimage_free(struct CCImage* image)
+{
+    mdjvu_memory_count(mdjvu_memory_runs, -(ptrdiff_t) image->counted);
+    MDJVU_FREEV(image->runs);
+    MDJVU_FREEV(image->ccs);
+    MDJVU_FREE(image);
+}
+
+// -- Turns runs into the split image and frees the CCImage
+static mdjvu_image_t
+ccimage_split_and_free(struct CCImage* ccimage)
+{
+    // Component analysis
+    ccimage_make_ccids_by_analysis(ccimage); // obtain ccids
+    ccimage_make_ccs_from_ccids(ccimage);    // compute cc descriptors
+
+    /* we don't use cjb2's cleaning algorithm */
+    //    if (opts.losslevel > 0)
+    //    rimg.erase_tiny_ccs();       // clean
+    ccimage_merge_and_split_ccs(ccimage);    // reorganize weird ccs
+    ccimage_sort_in_reading_order(ccimage);  // sort cc descriptors
+
+    mdjvu_image_t result = ccimage_get_jb2image(ccimage); // get ``raw'' mdjvu_image_t
+    ccimage_free(ccimage);
+    return result;
+}
+
+
+#undef Run
+#undef CCImage
+#undef ccimage_count
+#undef ccimage_add_single_run
+#undef ccimage_add_row_runs
+#undef ccimage_add_bitmap_runs
+#undef ccimage_add_page_runs
+#undef ccimage_sort_runs
+#undef label_runs
+#undef ccimage_make_ccids_by_analysis
+#undef ccimage_make_ccs_from_ccids
+#undef ccimage_erase_tiny_ccs
+#undef ccimage_find_noisy_cells
+#undef ccimage_merge_and_split_ccs
+#undef ccimage_sort_in_reading_order
+#undef ccimage_get_bitmap_for_cc
+#undef ccimage_get_jb2image
+#undef ccimage_set_dpi
+#undef ccimage_create
+#undef ccimage_free
+#undef ccimage_split_and_free
@@ -1,9 +1,10 @@
 /*
- * 0porting.c - checking sanity of typedefs
+ * 0porting.c - checking sanity of typedefs, memory accounting
  */
 
 #include "../base/mdjvucfg.h"
 #include <minidjvu-mod/minidjvu-mod.h>
+#include "bitops.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -31,12 +32,9 @@ MDJVU_IMPLEMENT const char *mdjvu_check_sanity(void)
 
 static int initialized = 0;
 
-void mdjvu_init(void)
+static void init_once(void)
 {
     const char *sanity_error_message;
-    
-    if (initialized)
-        return;
 
     #ifdef HAVE_GETTEXT
         bindtextdomain("minidjvu-mod", LOCALEDIR);
@@ -50,5 +48,107 @@ void mdjvu_init(void)
         exit(1);
     }
 
-    initialized = 1;
+    mdjvu_bitops_init(MDJVU_BITOPS_BEST);
+}
+
+void mdjvu_init(void)
+{
+    int done;
+
+    #pragma omp atomic read seq_cst
+    done = initialized;
+    if (done)
+        return;
+
+    /* The first calls may come from several threads at once;
+     * only one of them fills the tables, the others wait for it.
+     */
+    #pragma omp critical(mdjvu_init)
+    {
+        if (!initialized)
+        {
+            init_once();
+            #pragma omp atomic write seq_cst
+            initialized = 1;
+        }
+    }
+}
+
+
+/* ___________________________   memory accounting   ________________________ */
+
+/* set before any memory is counted, so read without locks */
+static int memory_accounting = 0;
+static size_t memory_current[mdjvu_memory_kinds_count];
+static size_t memory_peak[mdjvu_memory_kinds_count];
+
+static const char *memory_names[mdjvu_memory_kinds_count] =
+{
+    "bitmaps", "patterns", "classifier", "coder", "runs"
+};
+
+MDJVU_IMPLEMENT void mdjvu_memory_set_accounting(int enabled)
+{
+    memory_accounting = enabled;
+}
+
+void mdjvu_memory_count(int kind, ptrdiff_t bytes)
+{
+    size_t now, peak;
+
+    if (!memory_accounting)
+        return;
+
+    /* a negative count wraps around, which unsigned arithmetic allows */
+    #pragma omp atomic capture
+    now = memory_current[kind] += (size_t) bytes;
+
+    if (bytes <= 0)
+        return;
+
+    #pragma omp atomic read
+    peak = memory_peak[kind];
+    if (now <= peak)
+        return;
+
+    #pragma omp critical(mdjvu_memory_peak)
+    {
+        if (now > memory_peak[kind])
+        {
+            #pragma omp atomic write
+            memory_peak[kind] = now;
+        }
+    }
+}
+
+MDJVU_IMPLEMENT size_t mdjvu_memory_get_current(MinidjvuMemoryKind kind)
+{
+    size_t result;
+    #pragma omp atomic read
+    result = memory_current[kind];
+    return result;
+}
+
+MDJVU_IMPLEMENT size_t mdjvu_memory_get_peak(MinidjvuMemoryKind kind)
+{
+    size_t result;
+    #pragma omp atomic read
+    result = memory_peak[kind];
+    return result;
+}
+
+MDJVU_IMPLEMENT void mdjvu_memory_reset_peaks(void)
+{
+    int i;
+    #pragma omp critical(mdjvu_memory_peak)
+    for (i = 0; i < mdjvu_memory_kinds_count; i++)
+    {
+        #pragma omp atomic write
+        memory_peak[i] = mdjvu_memory_get_current((MinidjvuMemoryKind) i);
+    }
+}
+
+MDJVU_IMPLEMENT const char *mdjvu_memory_get_name(MinidjvuMemoryKind kind)
+{
+    return memory_names[kind];
 }
@@ -4,16 +4,24 @@
 
 #include "../base/mdjvucfg.h"
 #include <minidjvu-mod/minidjvu-mod.h>
+#include "bitops.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
 
+typedef struct MinidjvuBitmapSlab Slab;
+
 typedef struct
 {
     unsigned char **data;
     int32 width, height;
+    int32 stride;    /* bytes from a row to the next one */
     int32 index;
+    Slab *slab;      /* where this structure lives, or NULL if malloc'ed */
+    Slab *data_slab; /* where `data' lives, or NULL if by 2d_array() */
+                     /* and not shared by mdjvu_bitmap_share()        */
+    size_t data_size; /* bytes taken by `data' if `data_slab' is NULL */
 } Bitmap;
 
 
@@ -23,26 +31,225 @@ int32 alive_bitmap_counter = 0;
 
 #define BYTES_PER_ROW(WIDTH) (((WIDTH) + 7) >> 3)
 
+/* All memory here is counted as mdjvu_memory_bitmaps */
+#define COUNT(BYTES) mdjvu_memory_count(mdjvu_memory_bitmaps, (ptrdiff_t) (BYTES))
+
+/* ______________________________   slabs   _______________________________ */
+
+/* A slab hands out bitmaps from large zeroed chunks, so that a page split
+ * into many small components costs a few allocations instead of two per
+ * component. The bitmap structure and its data count as two references
+ * to the slab (they may part in mdjvu_bitmap_exchange()); the creator
+ * holds one more. The chunks are freed when the last reference is dropped.
+ */
+
+#define SLAB_CHUNK_SIZE 65536
+#define SLAB_ALIGN(N) (((N) + 15) & ~(size_t) 15)
+
+typedef struct SlabChunk
+{
+    struct SlabChunk *next;
+    size_t used, size;
+} SlabChunk;
+
+struct MinidjvuBitmapSlab
+{
+    SlabChunk *chunks; /* the first one is being filled */
+    unsigned char **array; /* a 2d array adopted by mdjvu_bitmap_share() */
+    size_t array_size;
+    int32 refs;
+};
+
+static void slab_release(Slab *slab)
+{
+    int32 refs;
+    #pragma omp atomic capture
+    refs = --slab->refs;
+    if (!refs)
+    {
+        SlabChunk *c = slab->chunks;
+        while (c)
+        {
+            SlabChunk *next = c->next;
+            COUNT(-(ptrdiff_t) (SLAB_ALIGN(sizeof(SlabChunk)) + c->size));
+            free(c);
+            c = next;
+        }
+        if (slab->array)
+            mdjvu_destroy_2d_array(slab->array);
+        COUNT(-(ptrdiff_t) (sizeof(Slab) + slab->array_size));
+        free(slab);
+    }
+}
+
+static void *slab_alloc(Slab *slab, size_t size)
+{
+    SlabChunk *c = slab->chunks;
+    size_t header = SLAB_ALIGN(sizeof(SlabChunk));
+    size = SLAB_ALIGN(size);
+    if (!c || c->size - c->used < size)
+    {
+        if (size > SLAB_CHUNK_SIZE / 4)
+        {
+            /* a big one gets a chunk of its own behind the current one */
+            SlabChunk *own = (SlabChunk *) calloc(1, header + size);
+            COUNT(header + size);
+            own->used = own->size = size;
+            if (c)
+            {
+                own->next = c->next;
+                c->next = own;
+            }
+            else
+            {
+                own->next = NULL;
+                slab->chunks = own;
+            }
+            return (char *) own + header;
+        }
+        c = (SlabChunk *) calloc(1, header + SLAB_CHUNK_SIZE);
+        COUNT(header + SLAB_CHUNK_SIZE);
+        c->next = slab->chunks;
+        c->used = 0;
+        c->size = SLAB_CHUNK_SIZE;
+        slab->chunks = c;
+    }
+    c->used += size;
+    return (char *) c + header + c->used - size;
+}
+
+/* The slab of the current thread, see mdjvu_bitmap_slab_set_current() */
+static Slab *current_slab = NULL;
+#pragma omp threadprivate(current_slab)
+
+MDJVU_IMPLEMENT mdjvu_bitmap_slab_t mdjvu_bitmap_slab_create(void)
+{
+    Slab *slab = MDJVU_MALLOC(Slab);
+    COUNT(sizeof(Slab));
+    slab->chunks = NULL;
+    slab->array = NULL;
+    slab->array_size = 0;
+    slab->refs = 1;
+    return (mdjvu_bitmap_slab_t) slab;
+}
+
+MDJVU_IMPLEMENT void mdjvu_bitmap_slab_release(mdjvu_bitmap_slab_t slab)
+{
+    slab_release((Slab *) slab);
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_bitmap_slab_create_bitmap
+    (mdjvu_bitmap_slab_t s, int32 width, int32 height)
+{
+    Slab *slab = (Slab *) s;
+    size_t row_size = BYTES_PER_ROW(width);
+    size_t table = SLAB_ALIGN(sizeof(Bitmap)) + height * sizeof(unsigned char *);
+    char *p = (char *) slab_alloc(slab, table + row_size * height);
+    Bitmap *b = (Bitmap *) p;
+    unsigned char *data = (unsigned char *) p + table;
+    int32 i;
+
+    #ifndef NDEBUG
+        alive_bitmap_counter++;
+    #endif
+    b->width = width;
+    b->height = height;
+    b->stride = (int32) row_size;
+    b->index = -1;
+    b->slab = b->data_slab = slab;
+    b->data_size = 0;
+    #pragma omp atomic
+    slab->refs += 2;
+    b->data = (unsigned char **) (p + SLAB_ALIGN(sizeof(Bitmap)));
+    for (i = 0; i < height; i++)
+        b->data[i] = data + row_size * i;
+    return (mdjvu_bitmap_t) b;
+}
+
+MDJVU_IMPLEMENT void mdjvu_bitmap_slab_set_current(mdjvu_bitmap_slab_t s)
+{
+    Slab *slab = (Slab *) s;
+    if (slab)
+    {
+        #pragma omp atomic
+        slab->refs++;
+    }
+    if (current_slab)
+        slab_release(current_slab);
+    current_slab = slab;
+}
+
 /* __________________________   create/destroy   ___________________________ */
 
 MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_bitmap_create(int32 width, int32 height)
 {
-    Bitmap *b = (Bitmap *) malloc(sizeof(Bitmap));
+    Bitmap *b;
     mdjvu_init();
+    /* big bitmaps come and go one by one, they are left to malloc() */
+    if (current_slab
+        && (size_t) BYTES_PER_ROW(width) * height <= SLAB_CHUNK_SIZE / 4)
+    {
+        return mdjvu_bitmap_slab_create_bitmap(
+            (mdjvu_bitmap_slab_t) current_slab, width, height);
+    }
+    b = (Bitmap *) malloc(sizeof(Bitmap));
     #ifndef NDEBUG
         alive_bitmap_counter++;
     #endif
     b->width = width;
     b->height = height;
+    b->stride = BYTES_PER_ROW(width);
     b->index = -1;
+    b->slab = b->data_slab = NULL;
     b->data = mdjvu_create_2d_array(BYTES_PER_ROW(width), height);
+    b->data_size = (sizeof(unsigned char *) + BYTES_PER_ROW(width)) * height;
+    COUNT(sizeof(Bitmap) + b->data_size);
+    return (mdjvu_bitmap_t) b;
+}
+
+/* Like mdjvu_create_2d_array(), but the table of row pointers is rounded up
+ * to a whole word, so that the rows, `stride' bytes each, start at words.
+ * The result is released by mdjvu_destroy_2d_array() as well.
+ */
+#define ALIGNED_ROWS_SIZE(STRIDE, HEIGHT) \
+    ((((HEIGHT) * sizeof(unsigned char *) + 7) & ~(size_t) 7) \
+     + (size_t) (STRIDE) * (HEIGHT))
+
+static unsigned char **create_aligned_rows(int32 stride, int32 height)
+{
+    size_t table = (height * sizeof(unsigned char *) + 7) & ~(size_t) 7;
+    unsigned char **rows = (unsigned char **)
+        calloc(1, ALIGNED_ROWS_SIZE(stride, height));
+    unsigned char *data = (unsigned char *) rows + table;
+    int32 i;
+
+    for (i = 0; i < height; i++)
+        rows[i] = data + (size_t) stride * i;
+    return rows;
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_bitmap_create_aligned(int32 width, int32 height)
+{
+    Bitmap *b = (Bitmap *) malloc(sizeof(Bitmap));
+    mdjvu_init();
+    #ifndef NDEBUG
+        alive_bitmap_counter++;
+    #endif
+    b->width = width;
+    b->height = height;
+    b->stride = MDJVU_PADDED_ROW_SIZE(width);
+    b->index = -1;
+    b->slab = b->data_slab = NULL;
+    b->data = create_aligned_rows(b->stride, height);
+    b->data_size = ALIGNED_ROWS_SIZE(b->stride, height);
+    COUNT(sizeof(Bitmap) + b->data_size);
     return (mdjvu_bitmap_t) b;
 }
 
 MDJVU_IMPLEMENT int mdjvu_bitmap_mem_size(mdjvu_bitmap_t bmp)
 {
     Bitmap *b = (Bitmap *) bmp;
-    return BYTES_PER_ROW(b->width)*b->height  + sizeof(Bitmap);
+    return b->stride*b->height  + sizeof(Bitmap);
 }
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_destroy(mdjvu_bitmap_t bmp)
@@ -51,8 +258,20 @@ MDJVU_IMPLEMENT void mdjvu_bitmap_destroy(mdjvu_bitmap_t bmp)
     #ifndef NDEBUG
         alive_bitmap_counter--;
     #endif
-    mdjvu_destroy_2d_array(b->data);
-    free(b);
+    if (b->data_slab)
+        slab_release(b->data_slab);
+    else
+    {
+        COUNT(-(ptrdiff_t) b->data_size);
+        mdjvu_destroy_2d_array(b->data);
+    }
+    if (b->slab)
+        slab_release(b->slab);
+    else
+    {
+        COUNT(-(ptrdiff_t) sizeof(Bitmap));
+        free(b);
+    }
 }
 
 /* __________________________   clone & assign   ___________________________ */
@@ -60,44 +279,123 @@ MDJVU_IMPLEMENT void mdjvu_bitmap_destroy(mdjvu_bitmap_t bmp)
 #define BMP ((Bitmap *) b)
 #define ROW_SIZE BYTES_PER_ROW(BMP->width)
 
+/* Whether rows are padded to words, as in aligned bitmaps */
+#define IS_ALIGNED(B) ((B)->stride == MDJVU_PADDED_ROW_SIZE((B)->width))
+
+/* The clone keeps the layout; a bitmap trimmed by mdjvu_bitmap_trim_margins()
+ * gets tight rows
+ */
 MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_bitmap_clone(mdjvu_bitmap_t b)
 {
-    mdjvu_bitmap_t result = mdjvu_bitmap_create(BMP->width, BMP->height);
+    mdjvu_bitmap_t result = IS_ALIGNED(BMP)
+        ? mdjvu_bitmap_create_aligned(BMP->width, BMP->height)
+        : mdjvu_bitmap_create(BMP->width, BMP->height);
+    int32 y;
 
     /* Using the fact that the 2d arrays by 2d_array() are really 1d ones */
-    memcpy(((Bitmap *) result)->data[0], BMP->data[0], ROW_SIZE * BMP->height);
+    if (((Bitmap *) result)->stride == BMP->stride)
+    {
+        memcpy(((Bitmap *) result)->data[0], BMP->data[0], BMP->stride * BMP->height);
+        return result;
+    }
+    for (y = 0; y < BMP->height; y++)
+        memcpy(((Bitmap *) result)->data[y], BMP->data[y], ROW_SIZE);
     return result;
 }
 
+/* The data of a bitmap that is shared for the first time is handed over
+ * to a slab with no chunks, so that sharing bitmaps and slab bitmaps are
+ * counted and released in the same way.
+ * This is also done before `data' is moved by mdjvu_bitmap_trim_margins().
+ */
+static void adopt_data(Bitmap *b)
+{
+    if (!b->data_slab)
+    {
+        Slab *owner = (Slab *) mdjvu_bitmap_slab_create();
+        owner->array = b->data;
+        owner->array_size = b->data_size;
+        b->data_size = 0;
+        b->data_slab = owner; /* the creator's reference goes to `b' */
+    }
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_bitmap_share(mdjvu_bitmap_t b)
+{
+    Bitmap *result = (Bitmap *) malloc(sizeof(Bitmap));
+
+    COUNT(sizeof(Bitmap));
+    adopt_data(BMP);
+    #pragma omp atomic
+    BMP->data_slab->refs++;
+
+    #ifndef NDEBUG
+        alive_bitmap_counter++;
+    #endif
+    *result = *BMP;
+    result->index = -1;
+    result->slab = NULL;
+    return (mdjvu_bitmap_t) result;
+}
+
 MDJVU_IMPLEMENT int mdjvu_bitmap_match(mdjvu_bitmap_t img1, mdjvu_bitmap_t img2)
 {
     Bitmap* b1 = (Bitmap*) img1;
     Bitmap* b2 = (Bitmap*) img2;
-    if (b1->width == b2->width && b1->height == b2->height) {
-        return memcmp(b1->data[0], b2->data[0], BYTES_PER_ROW(b1->width) * b1->height) == 0;
+    int32 y;
+    if (b1->width != b2->width || b1->height != b2->height)
+        return 0;
+    if (b1->stride == b2->stride)
+        return memcmp(b1->data[0], b2->data[0], b1->stride * b1->height) == 0;
+    for (y = 0; y < b1->height; y++)
+    {
+        if (memcmp(b1->data[y], b2->data[y], BYTES_PER_ROW(b1->width)))
+            return 0;
     }
-    return 0;
+    return 1;
 }
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_assign(mdjvu_bitmap_t dst, mdjvu_bitmap_t b)
 {
-    mdjvu_destroy_2d_array(((Bitmap *)dst)->data);
-    ((Bitmap *)dst)->data =
-        mdjvu_create_2d_array(BYTES_PER_ROW(BMP->width), BMP->height);
+    if (((Bitmap *)dst)->data_slab)
+        slab_release(((Bitmap *)dst)->data_slab);
+    else
+    {
+        COUNT(-(ptrdiff_t) ((Bitmap *)dst)->data_size);
+        mdjvu_destroy_2d_array(((Bitmap *)dst)->data);
+    }
+    ((Bitmap *)dst)->data_slab = NULL;
+    if (IS_ALIGNED(BMP))
+    {
+        ((Bitmap *)dst)->data = create_aligned_rows(BMP->stride, BMP->height);
+        ((Bitmap *)dst)->data_size = ALIGNED_ROWS_SIZE(BMP->stride, BMP->height);
+    }
+    else
+    {
+        ((Bitmap *)dst)->data = mdjvu_create_2d_array(BMP->stride, BMP->height);
+        ((Bitmap *)dst)->data_size =
+            (sizeof(unsigned char *) + BMP->stride) * BMP->height;
+    }
+    COUNT(((Bitmap *)dst)->data_size);
     ((Bitmap *)dst)->width = BMP->width;
     ((Bitmap *)dst)->height = BMP->height;
-    memcpy(((Bitmap *) dst)->data[0], BMP->data[0], ROW_SIZE * BMP->height);
+    ((Bitmap *)dst)->stride = BMP->stride;
+    memcpy(((Bitmap *) dst)->data[0], BMP->data[0], BMP->stride * BMP->height);
 }
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_exchange(mdjvu_bitmap_t d, mdjvu_bitmap_t src)
 {
     int32 d_index_backup = ((Bitmap *) d)->index;
     int32 s_index_backup = ((Bitmap *) src)->index;
+    Slab *d_slab_backup = ((Bitmap *) d)->slab;
+    Slab *s_slab_backup = ((Bitmap *) src)->slab;
     Bitmap tmp = * (Bitmap *) d;
     * (Bitmap *) d = * (Bitmap *) src;
     * (Bitmap *) src = tmp;
     ((Bitmap *) d)->index = d_index_backup;
     ((Bitmap *) src)->index = s_index_backup;
+    ((Bitmap *) d)->slab = d_slab_backup;
+    ((Bitmap *) src)->slab = s_slab_backup;
 }
 
 
@@ -132,6 +430,11 @@ MDJVU_IMPLEMENT int32 mdjvu_bitmap_get_packed_row_size(mdjvu_bitmap_t b)
     return ROW_SIZE;
 }
 
+MDJVU_IMPLEMENT int32 mdjvu_bitmap_get_row_stride(mdjvu_bitmap_t b)
+{
+    return BMP->stride;
+}
+
 MDJVU_IMPLEMENT unsigned char *
     mdjvu_bitmap_access_packed_row(mdjvu_bitmap_t b, int32 i)
 {
@@ -146,165 +449,29 @@ MDJVU_IMPLEMENT unsigned char **
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_clear(mdjvu_bitmap_t b)
 {
-    memset(BMP->data[0], 0, BMP->height * ROW_SIZE);
+    memset(BMP->data[0], 0, BMP->height * BMP->stride);
 }
 
 /* __________________________   packing/unpacking   ________________________ */
 
-/* All the functions in this part are, well, suboptimized. */
+/* Rows are converted by the kernels in bitops.c, a word or more at a time. */
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_pack_row
     (mdjvu_bitmap_t b, unsigned char *bytes, int32 y)
 {
-    unsigned char *bits = BMP->data[y];
-    int coef = 0x80;
-    int a = 0; /* accumulates bits */
-    int32 i = BMP->width;
-    while (i--)
-    {
-        if (*bytes++) a |= coef;
-
-        coef >>= 1;
-        if (!coef)
-        {
-            coef = 0x80;
-            *bits++ = a;
-            a = 0;
-        }
-    }
-
-    if (BMP->width & 7) *bits = a;
-}
-
-unsigned char lookup_table_unpack_row[256*8] = {
-    0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,    0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0xFF,    0x00,0x00,0x00,0x00, 0x00,0x00,0xFF,0x00,    0x00,0x00,0x00,0x00, 0x00,0x00,0xFF,0xFF,    0x00,0x00,0x00,0x00, 0x00,0xFF,0x00,0x00,    0x00,0x00,0x00,0x00, 0x00,0xFF,0x00,0xFF,
-    0x00,0x00,0x00,0x00, 0x00,0xFF,0xFF,0x00,    0x00,0x00,0x00,0x00, 0x00,0xFF,0xFF,0xFF,    0x00,0x00,0x00,0x00, 0xFF,0x00,0x00,0x00,    0x00,0x00,0x00,0x00, 0xFF,0x00,0x00,0xFF,    0x00,0x00,0x00,0x00, 0xFF,0x00,0xFF,0x00,    0x00,0x00,0x00,0x00, 0xFF,0x00,0xFF,0xFF,
-    0x00,0x00,0x00,0x00, 0xFF,0xFF,0x00,0x00,    0x00,0x00,0x00,0x00, 0xFF,0xFF,0x00,0xFF,    0x00,0x00,0x00,0x00, 0xFF,0xFF,0xFF,0x00,    0x00,0x00,0x00,0x00, 0xFF,0xFF,0xFF,0xFF,    0x00,0x00,0x00,0xFF, 0x00,0x00,0x00,0x00,    0x00,0x00,0x00,0xFF, 0x00,0x00,0x00,0xFF,    0x00,0x00,0x00,0xFF, 0x00,0x00,0xFF,0x00,    0x00,0x00,0x00,0xFF, 0x00,0x00,0xFF,0xFF,    0x00,0x00,0x00,0xFF, 0x00,0xFF,0x00,0x00,    0x00,0x00,0x00,0xFF, 0x00,0xFF,0x00,0xFF,    0x00,0x00,0x00,0xFF, 0x00,0xFF,0xFF,0x00,    0x00,0x00,0x00,0xFF, 0x00,0xFF,0xFF,0xFF,
-    0x00,0x00,0x00,0xFF, 0xFF,0x00,0x00,0x00,    0x00,0x00,0x00,0xFF, 0xFF,0x00,0x00,0xFF,    0x00,0x00,0x00,0xFF, 0xFF,0x00,0xFF,0x00,    0x00,0x00,0x00,0xFF, 0xFF,0x00,0xFF,0xFF,    0x00,0x00,0x00,0xFF, 0xFF,0xFF,0x00,0x00,    0x00,0x00,0x00,0xFF, 0xFF,0xFF,0x00,0xFF,
-    0x00,0x00,0x00,0xFF, 0xFF,0xFF,0xFF,0x00,    0x00,0x00,0x00,0xFF, 0xFF,0xFF,0xFF,0xFF,    0x00,0x00,0xFF,0x00, 0x00,0x00,0x00,0x00,    0x00,0x00,0xFF,0x00, 0x00,0x00,0x00,0xFF,    0x00,0x00,0xFF,0x00, 0x00,0x00,0xFF,0x00,    0x00,0x00,0xFF,0x00, 0x00,0x00,0xFF,0xFF,
-    0x00,0x00,0xFF,0x00, 0x00,0xFF,0x00,0x00,    0x00,0x00,0xFF,0x00, 0x00,0xFF,0x00,0xFF,    0x00,0x00,0xFF,0x00, 0x00,0xFF,0xFF,0x00,    0x00,0x00,0xFF,0x00, 0x00,0xFF,0xFF,0xFF,    0x00,0x00,0xFF,0x00, 0xFF,0x00,0x00,0x00,    0x00,0x00,0xFF,0x00, 0xFF,0x00,0x00,0xFF,
-    0x00,0x00,0xFF,0x00, 0xFF,0x00,0xFF,0x00,    0x00,0x00,0xFF,0x00, 0xFF,0x00,0xFF,0xFF,    0x00,0x00,0xFF,0x00, 0xFF,0xFF,0x00,0x00,    0x00,0x00,0xFF,0x00, 0xFF,0xFF,0x00,0xFF,    0x00,0x00,0xFF,0x00, 0xFF,0xFF,0xFF,0x00,    0x00,0x00,0xFF,0x00, 0xFF,0xFF,0xFF,0xFF,
-    0x00,0x00,0xFF,0xFF, 0x00,0x00,0x00,0x00,    0x00,0x00,0xFF,0xFF, 0x00,0x00,0x00,0xFF,    0x00,0x00,0xFF,0xFF, 0x00,0x00,0xFF,0x00,    0x00,0x00,0xFF,0xFF, 0x00,0x00,0xFF,0xFF,    0x00,0x00,0xFF,0xFF, 0x00,0xFF,0x00,0x00,    0x00,0x00,0xFF,0xFF, 0x00,0xFF,0x00,0xFF,
-    0x00,0x00,0xFF,0xFF, 0x00,0xFF,0xFF,0x00,    0x00,0x00,0xFF,0xFF, 0x00,0xFF,0xFF,0xFF,    0x00,0x00,0xFF,0xFF, 0xFF,0x00,0x00,0x00,    0x00,0x00,0xFF,0xFF, 0xFF,0x00,0x00,0xFF,    0x00,0x00,0xFF,0xFF, 0xFF,0x00,0xFF,0x00,    0x00,0x00,0xFF,0xFF, 0xFF,0x00,0xFF,0xFF,
-    0x00,0x00,0xFF,0xFF, 0xFF,0xFF,0x00,0x00,    0x00,0x00,0xFF,0xFF, 0xFF,0xFF,0x00,0xFF,    0x00,0x00,0xFF,0xFF, 0xFF,0xFF,0xFF,0x00,    0x00,0x00,0xFF,0xFF, 0xFF,0xFF,0xFF,0xFF,    0x00,0xFF,0x00,0x00, 0x00,0x00,0x00,0x00,    0x00,0xFF,0x00,0x00, 0x00,0x00,0x00,0xFF,
-    0x00,0xFF,0x00,0x00, 0x00,0x00,0xFF,0x00,    0x00,0xFF,0x00,0x00, 0x00,0x00,0xFF,0xFF,    0x00,0xFF,0x00,0x00, 0x00,0xFF,0x00,0x00,    0x00,0xFF,0x00,0x00, 0x00,0xFF,0x00,0xFF,    0x00,0xFF,0x00,0x00, 0x00,0xFF,0xFF,0x00,    0x00,0xFF,0x00,0x00, 0x00,0xFF,0xFF,0xFF,
-    0x00,0xFF,0x00,0x00, 0xFF,0x00,0x00,0x00,    0x00,0xFF,0x00,0x00, 0xFF,0x00,0x00,0xFF,    0x00,0xFF,0x00,0x00, 0xFF,0x00,0xFF,0x00,    0x00,0xFF,0x00,0x00, 0xFF,0x00,0xFF,0xFF,    0x00,0xFF,0x00,0x00, 0xFF,0xFF,0x00,0x00,    0x00,0xFF,0x00,0x00, 0xFF,0xFF,0x00,0xFF,
-    0x00,0xFF,0x00,0x00, 0xFF,0xFF,0xFF,0x00,    0x00,0xFF,0x00,0x00, 0xFF,0xFF,0xFF,0xFF,    0x00,0xFF,0x00,0xFF, 0x00,0x00,0x00,0x00,    0x00,0xFF,0x00,0xFF, 0x00,0x00,0x00,0xFF,    0x00,0xFF,0x00,0xFF, 0x00,0x00,0xFF,0x00,    0x00,0xFF,0x00,0xFF, 0x00,0x00,0xFF,0xFF,
-    0x00,0xFF,0x00,0xFF, 0x00,0xFF,0x00,0x00,    0x00,0xFF,0x00,0xFF, 0x00,0xFF,0x00,0xFF,    0x00,0xFF,0x00,0xFF, 0x00,0xFF,0xFF,0x00,    0x00,0xFF,0x00,0xFF, 0x00,0xFF,0xFF,0xFF,    0x00,0xFF,0x00,0xFF, 0xFF,0x00,0x00,0x00,    0x00,0xFF,0x00,0xFF, 0xFF,0x00,0x00,0xFF,
-    0x00,0xFF,0x00,0xFF, 0xFF,0x00,0xFF,0x00,    0x00,0xFF,0x00,0xFF, 0xFF,0x00,0xFF,0xFF,    0x00,0xFF,0x00,0xFF, 0xFF,0xFF,0x00,0x00,    0x00,0xFF,0x00,0xFF, 0xFF,0xFF,0x00,0xFF,    0x00,0xFF,0x00,0xFF, 0xFF,0xFF,0xFF,0x00,    0x00,0xFF,0x00,0xFF, 0xFF,0xFF,0xFF,0xFF,
-    0x00,0xFF,0xFF,0x00, 0x00,0x00,0x00,0x00,    0x00,0xFF,0xFF,0x00, 0x00,0x00,0x00,0xFF,    0x00,0xFF,0xFF,0x00, 0x00,0x00,0xFF,0x00,    0x00,0xFF,0xFF,0x00, 0x00,0x00,0xFF,0xFF,    0x00,0xFF,0xFF,0x00, 0x00,0xFF,0x00,0x00,    0x00,0xFF,0xFF,0x00, 0x00,0xFF,0x00,0xFF,
-    0x00,0xFF,0xFF,0x00, 0x00,0xFF,0xFF,0x00,    0x00,0xFF,0xFF,0x00, 0x00,0xFF,0xFF,0xFF,    0x00,0xFF,0xFF,0x00, 0xFF,0x00,0x00,0x00,    0x00,0xFF,0xFF,0x00, 0xFF,0x00,0x00,0xFF,    0x00,0xFF,0xFF,0x00, 0xFF,0x00,0xFF,0x00,    0x00,0xFF,0xFF,0x00, 0xFF,0x00,0xFF,0xFF,
-    0x00,0xFF,0xFF,0x00, 0xFF,0xFF,0x00,0x00,    0x00,0xFF,0xFF,0x00, 0xFF,0xFF,0x00,0xFF,    0x00,0xFF,0xFF,0x00, 0xFF,0xFF,0xFF,0x00,    0x00,0xFF,0xFF,0x00, 0xFF,0xFF,0xFF,0xFF,    0x00,0xFF,0xFF,0xFF, 0x00,0x00,0x00,0x00,    0x00,0xFF,0xFF,0xFF, 0x00,0x00,0x00,0xFF,
-    0x00,0xFF,0xFF,0xFF, 0x00,0x00,0xFF,0x00,    0x00,0xFF,0xFF,0xFF, 0x00,0x00,0xFF,0xFF,    0x00,0xFF,0xFF,0xFF, 0x00,0xFF,0x00,0x00,    0x00,0xFF,0xFF,0xFF, 0x00,0xFF,0x00,0xFF,    0x00,0xFF,0xFF,0xFF, 0x00,0xFF,0xFF,0x00,    0x00,0xFF,0xFF,0xFF, 0x00,0xFF,0xFF,0xFF,
-    0x00,0xFF,0xFF,0xFF, 0xFF,0x00,0x00,0x00,    0x00,0xFF,0xFF,0xFF, 0xFF,0x00,0x00,0xFF,    0x00,0xFF,0xFF,0xFF, 0xFF,0x00,0xFF,0x00,    0x00,0xFF,0xFF,0xFF, 0xFF,0x00,0xFF,0xFF,    0x00,0xFF,0xFF,0xFF, 0xFF,0xFF,0x00,0x00,    0x00,0xFF,0xFF,0xFF, 0xFF,0xFF,0x00,0xFF,
-    0x00,0xFF,0xFF,0xFF, 0xFF,0xFF,0xFF,0x00,    0x00,0xFF,0xFF,0xFF, 0xFF,0xFF,0xFF,0xFF,    0xFF,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,    0xFF,0x00,0x00,0x00, 0x00,0x00,0x00,0xFF,    0xFF,0x00,0x00,0x00, 0x00,0x00,0xFF,0x00,    0xFF,0x00,0x00,0x00, 0x00,0x00,0xFF,0xFF,
-    0xFF,0x00,0x00,0x00, 0x00,0xFF,0x00,0x00,    0xFF,0x00,0x00,0x00, 0x00,0xFF,0x00,0xFF,    0xFF,0x00,0x00,0x00, 0x00,0xFF,0xFF,0x00,    0xFF,0x00,0x00,0x00, 0x00,0xFF,0xFF,0xFF,    0xFF,0x00,0x00,0x00, 0xFF,0x00,0x00,0x00,    0xFF,0x00,0x00,0x00, 0xFF,0x00,0x00,0xFF,
-    0xFF,0x00,0x00,0x00, 0xFF,0x00,0xFF,0x00,    0xFF,0x00,0x00,0x00, 0xFF,0x00,0xFF,0xFF,    0xFF,0x00,0x00,0x00, 0xFF,0xFF,0x00,0x00,    0xFF,0x00,0x00,0x00, 0xFF,0xFF,0x00,0xFF,    0xFF,0x00,0x00,0x00, 0xFF,0xFF,0xFF,0x00,    0xFF,0x00,0x00,0x00, 0xFF,0xFF,0xFF,0xFF,
-    0xFF,0x00,0x00,0xFF, 0x00,0x00,0x00,0x00,    0xFF,0x00,0x00,0xFF, 0x00,0x00,0x00,0xFF,    0xFF,0x00,0x00,0xFF, 0x00,0x00,0xFF,0x00,    0xFF,0x00,0x00,0xFF, 0x00,0x00,0xFF,0xFF,    0xFF,0x00,0x00,0xFF, 0x00,0xFF,0x00,0x00,    0xFF,0x00,0x00,0xFF, 0x00,0xFF,0x00,0xFF,
-    0xFF,0x00,0x00,0xFF, 0x00,0xFF,0xFF,0x00,    0xFF,0x00,0x00,0xFF, 0x00,0xFF,0xFF,0xFF,    0xFF,0x00,0x00,0xFF, 0xFF,0x00,0x00,0x00,    0xFF,0x00,0x00,0xFF, 0xFF,0x00,0x00,0xFF,    0xFF,0x00,0x00,0xFF, 0xFF,0x00,0xFF,0x00,    0xFF,0x00,0x00,0xFF, 0xFF,0x00,0xFF,0xFF,
-    0xFF,0x00,0x00,0xFF, 0xFF,0xFF,0x00,0x00,    0xFF,0x00,0x00,0xFF, 0xFF,0xFF,0x00,0xFF,    0xFF,0x00,0x00,0xFF, 0xFF,0xFF,0xFF,0x00,    0xFF,0x00,0x00,0xFF, 0xFF,0xFF,0xFF,0xFF,    0xFF,0x00,0xFF,0x00, 0x00,0x00,0x00,0x00,    0xFF,0x00,0xFF,0x00, 0x00,0x00,0x00,0xFF,
-    0xFF,0x00,0xFF,0x00, 0x00,0x00,0xFF,0x00,    0xFF,0x00,0xFF,0x00, 0x00,0x00,0xFF,0xFF,    0xFF,0x00,0xFF,0x00, 0x00,0xFF,0x00,0x00,    0xFF,0x00,0xFF,0x00, 0x00,0xFF,0x00,0xFF,    0xFF,0x00,0xFF,0x00, 0x00,0xFF,0xFF,0x00,    0xFF,0x00,0xFF,0x00, 0x00,0xFF,0xFF,0xFF,
-    0xFF,0x00,0xFF,0x00, 0xFF,0x00,0x00,0x00,    0xFF,0x00,0xFF,0x00, 0xFF,0x00,0x00,0xFF,    0xFF,0x00,0xFF,0x00, 0xFF,0x00,0xFF,0x00,    0xFF,0x00,0xFF,0x00, 0xFF,0x00,0xFF,0xFF,    0xFF,0x00,0xFF,0x00, 0xFF,0xFF,0x00,0x00,    0xFF,0x00,0xFF,0x00, 0xFF,0xFF,0x00,0xFF,
-    0xFF,0x00,0xFF,0x00, 0xFF,0xFF,0xFF,0x00,    0xFF,0x00,0xFF,0x00, 0xFF,0xFF,0xFF,0xFF,    0xFF,0x00,0xFF,0xFF, 0x00,0x00,0x00,0x00,    0xFF,0x00,0xFF,0xFF, 0x00,0x00,0x00,0xFF,    0xFF,0x00,0xFF,0xFF, 0x00,0x00,0xFF,0x00,    0xFF,0x00,0xFF,0xFF, 0x00,0x00,0xFF,0xFF,
-    0xFF,0x00,0xFF,0xFF, 0x00,0xFF,0x00,0x00,    0xFF,0x00,0xFF,0xFF, 0x00,0xFF,0x00,0xFF,    0xFF,0x00,0xFF,0xFF, 0x00,0xFF,0xFF,0x00,    0xFF,0x00,0xFF,0xFF, 0x00,0xFF,0xFF,0xFF,    0xFF,0x00,0xFF,0xFF, 0xFF,0x00,0x00,0x00,    0xFF,0x00,0xFF,0xFF, 0xFF,0x00,0x00,0xFF,
-    0xFF,0x00,0xFF,0xFF, 0xFF,0x00,0xFF,0x00,    0xFF,0x00,0xFF,0xFF, 0xFF,0x00,0xFF,0xFF,    0xFF,0x00,0xFF,0xFF, 0xFF,0xFF,0x00,0x00,    0xFF,0x00,0xFF,0xFF, 0xFF,0xFF,0x00,0xFF,    0xFF,0x00,0xFF,0xFF, 0xFF,0xFF,0xFF,0x00,    0xFF,0x00,0xFF,0xFF, 0xFF,0xFF,0xFF,0xFF,
-    0xFF,0xFF,0x00,0x00, 0x00,0x00,0x00,0x00,    0xFF,0xFF,0x00,0x00, 0x00,0x00,0x00,0xFF,    0xFF,0xFF,0x00,0x00, 0x00,0x00,0xFF,0x00,    0xFF,0xFF,0x00,0x00, 0x00,0x00,0xFF,0xFF,    0xFF,0xFF,0x00,0x00, 0x00,0xFF,0x00,0x00,    0xFF,0xFF,0x00,0x00, 0x00,0xFF,0x00,0xFF,
-    0xFF,0xFF,0x00,0x00, 0x00,0xFF,0xFF,0x00,    0xFF,0xFF,0x00,0x00, 0x00,0xFF,0xFF,0xFF,    0xFF,0xFF,0x00,0x00, 0xFF,0x00,0x00,0x00,    0xFF,0xFF,0x00,0x00, 0xFF,0x00,0x00,0xFF,    0xFF,0xFF,0x00,0x00, 0xFF,0x00,0xFF,0x00,    0xFF,0xFF,0x00,0x00, 0xFF,0x00,0xFF,0xFF,
-    0xFF,0xFF,0x00,0x00, 0xFF,0xFF,0x00,0x00,    0xFF,0xFF,0x00,0x00, 0xFF,0xFF,0x00,0xFF,    0xFF,0xFF,0x00,0x00, 0xFF,0xFF,0xFF,0x00,    0xFF,0xFF,0x00,0x00, 0xFF,0xFF,0xFF,0xFF,    0xFF,0xFF,0x00,0xFF, 0x00,0x00,0x00,0x00,    0xFF,0xFF,0x00,0xFF, 0x00,0x00,0x00,0xFF,
-    0xFF,0xFF,0x00,0xFF, 0x00,0x00,0xFF,0x00,    0xFF,0xFF,0x00,0xFF, 0x00,0x00,0xFF,0xFF,    0xFF,0xFF,0x00,0xFF, 0x00,0xFF,0x00,0x00,    0xFF,0xFF,0x00,0xFF, 0x00,0xFF,0x00,0xFF,    0xFF,0xFF,0x00,0xFF, 0x00,0xFF,0xFF,0x00,    0xFF,0xFF,0x00,0xFF, 0x00,0xFF,0xFF,0xFF,
-    0xFF,0xFF,0x00,0xFF, 0xFF,0x00,0x00,0x00,    0xFF,0xFF,0x00,0xFF, 0xFF,0x00,0x00,0xFF,    0xFF,0xFF,0x00,0xFF, 0xFF,0x00,0xFF,0x00,    0xFF,0xFF,0x00,0xFF, 0xFF,0x00,0xFF,0xFF,    0xFF,0xFF,0x00,0xFF, 0xFF,0xFF,0x00,0x00,    0xFF,0xFF,0x00,0xFF, 0xFF,0xFF,0x00,0xFF,
-    0xFF,0xFF,0x00,0xFF, 0xFF,0xFF,0xFF,0x00,    0xFF,0xFF,0x00,0xFF, 0xFF,0xFF,0xFF,0xFF,    0xFF,0xFF,0xFF,0x00, 0x00,0x00,0x00,0x00,    0xFF,0xFF,0xFF,0x00, 0x00,0x00,0x00,0xFF,    0xFF,0xFF,0xFF,0x00, 0x00,0x00,0xFF,0x00,    0xFF,0xFF,0xFF,0x00, 0x00,0x00,0xFF,0xFF,
-    0xFF,0xFF,0xFF,0x00, 0x00,0xFF,0x00,0x00,    0xFF,0xFF,0xFF,0x00, 0x00,0xFF,0x00,0xFF,    0xFF,0xFF,0xFF,0x00, 0x00,0xFF,0xFF,0x00,    0xFF,0xFF,0xFF,0x00, 0x00,0xFF,0xFF,0xFF,    0xFF,0xFF,0xFF,0x00, 0xFF,0x00,0x00,0x00,    0xFF,0xFF,0xFF,0x00, 0xFF,0x00,0x00,0xFF,
-    0xFF,0xFF,0xFF,0x00, 0xFF,0x00,0xFF,0x00,    0xFF,0xFF,0xFF,0x00, 0xFF,0x00,0xFF,0xFF,    0xFF,0xFF,0xFF,0x00, 0xFF,0xFF,0x00,0x00,    0xFF,0xFF,0xFF,0x00, 0xFF,0xFF,0x00,0xFF,    0xFF,0xFF,0xFF,0x00, 0xFF,0xFF,0xFF,0x00,    0xFF,0xFF,0xFF,0x00, 0xFF,0xFF,0xFF,0xFF,
-    0xFF,0xFF,0xFF,0xFF, 0x00,0x00,0x00,0x00,    0xFF,0xFF,0xFF,0xFF, 0x00,0x00,0x00,0xFF,    0xFF,0xFF,0xFF,0xFF, 0x00,0x00,0xFF,0x00,    0xFF,0xFF,0xFF,0xFF, 0x00,0x00,0xFF,0xFF,    0xFF,0xFF,0xFF,0xFF, 0x00,0xFF,0x00,0x00,    0xFF,0xFF,0xFF,0xFF, 0x00,0xFF,0x00,0xFF,
-    0xFF,0xFF,0xFF,0xFF, 0x00,0xFF,0xFF,0x00,    0xFF,0xFF,0xFF,0xFF, 0x00,0xFF,0xFF,0xFF,    0xFF,0xFF,0xFF,0xFF, 0xFF,0x00,0x00,0x00,    0xFF,0xFF,0xFF,0xFF, 0xFF,0x00,0x00,0xFF,    0xFF,0xFF,0xFF,0xFF, 0xFF,0x00,0xFF,0x00,    0xFF,0xFF,0xFF,0xFF, 0xFF,0x00,0xFF,0xFF,
-    0xFF,0xFF,0xFF,0xFF, 0xFF,0xFF,0x00,0x00,    0xFF,0xFF,0xFF,0xFF, 0xFF,0xFF,0x00,0xFF,    0xFF,0xFF,0xFF,0xFF, 0xFF,0xFF,0xFF,0x00,    0xFF,0xFF,0xFF,0xFF, 0xFF,0xFF,0xFF,0xFF
-};
-
-unsigned char lookup_table_unpack_row_0_1[256*8] = {
-    0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,    0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x01,    0x00,0x00,0x00,0x00, 0x00,0x00,0x01,0x00,    0x00,0x00,0x00,0x00, 0x00,0x00,0x01,0x01,    0x00,0x00,0x00,0x00, 0x00,0x01,0x00,0x00,    0x00,0x00,0x00,0x00, 0x00,0x01,0x00,0x01,
-    0x00,0x00,0x00,0x00, 0x00,0x01,0x01,0x00,    0x00,0x00,0x00,0x00, 0x00,0x01,0x01,0x01,    0x00,0x00,0x00,0x00, 0x01,0x00,0x00,0x00,    0x00,0x00,0x00,0x00, 0x01,0x00,0x00,0x01,    0x00,0x00,0x00,0x00, 0x01,0x00,0x01,0x00,    0x00,0x00,0x00,0x00, 0x01,0x00,0x01,0x01,
-    0x00,0x00,0x00,0x00, 0x01,0x01,0x00,0x00,    0x00,0x00,0x00,0x00, 0x01,0x01,0x00,0x01,    0x00,0x00,0x00,0x00, 0x01,0x01,0x01,0x00,    0x00,0x00,0x00,0x00, 0x01,0x01,0x01,0x01,    0x00,0x00,0x00,0x01, 0x00,0x00,0x00,0x00,    0x00,0x00,0x00,0x01, 0x00,0x00,0x00,0x01,    0x00,0x00,0x00,0x01, 0x00,0x00,0x01,0x00,    0x00,0x00,0x00,0x01, 0x00,0x00,0x01,0x01,    0x00,0x00,0x00,0x01, 0x00,0x01,0x00,0x00,    0x00,0x00,0x00,0x01, 0x00,0x01,0x00,0x01,    0x00,0x00,0x00,0x01, 0x00,0x01,0x01,0x00,    0x00,0x00,0x00,0x01, 0x00,0x01,0x01,0x01,
-    0x00,0x00,0x00,0x01, 0x01,0x00,0x00,0x00,    0x00,0x00,0x00,0x01, 0x01,0x00,0x00,0x01,    0x00,0x00,0x00,0x01, 0x01,0x00,0x01,0x00,    0x00,0x00,0x00,0x01, 0x01,0x00,0x01,0x01,    0x00,0x00,0x00,0x01, 0x01,0x01,0x00,0x00,    0x00,0x00,0x00,0x01, 0x01,0x01,0x00,0x01,
-    0x00,0x00,0x00,0x01, 0x01,0x01,0x01,0x00,    0x00,0x00,0x00,0x01, 0x01,0x01,0x01,0x01,    0x00,0x00,0x01,0x00, 0x00,0x00,0x00,0x00,    0x00,0x00,0x01,0x00, 0x00,0x00,0x00,0x01,    0x00,0x00,0x01,0x00, 0x00,0x00,0x01,0x00,    0x00,0x00,0x01,0x00, 0x00,0x00,0x01,0x01,
-    0x00,0x00,0x01,0x00, 0x00,0x01,0x00,0x00,    0x00,0x00,0x01,0x00, 0x00,0x01,0x00,0x01,    0x00,0x00,0x01,0x00, 0x00,0x01,0x01,0x00,    0x00,0x00,0x01,0x00, 0x00,0x01,0x01,0x01,    0x00,0x00,0x01,0x00, 0x01,0x00,0x00,0x00,    0x00,0x00,0x01,0x00, 0x01,0x00,0x00,0x01,
-    0x00,0x00,0x01,0x00, 0x01,0x00,0x01,0x00,    0x00,0x00,0x01,0x00, 0x01,0x00,0x01,0x01,    0x00,0x00,0x01,0x00, 0x01,0x01,0x00,0x00,    0x00,0x00,0x01,0x00, 0x01,0x01,0x00,0x01,    0x00,0x00,0x01,0x00, 0x01,0x01,0x01,0x00,    0x00,0x00,0x01,0x00, 0x01,0x01,0x01,0x01,
-    0x00,0x00,0x01,0x01, 0x00,0x00,0x00,0x00,    0x00,0x00,0x01,0x01, 0x00,0x00,0x00,0x01,    0x00,0x00,0x01,0x01, 0x00,0x00,0x01,0x00,    0x00,0x00,0x01,0x01, 0x00,0x00,0x01,0x01,    0x00,0x00,0x01,0x01, 0x00,0x01,0x00,0x00,    0x00,0x00,0x01,0x01, 0x00,0x01,0x00,0x01,
-    0x00,0x00,0x01,0x01, 0x00,0x01,0x01,0x00,    0x00,0x00,0x01,0x01, 0x00,0x01,0x01,0x01,    0x00,0x00,0x01,0x01, 0x01,0x00,0x00,0x00,    0x00,0x00,0x01,0x01, 0x01,0x00,0x00,0x01,    0x00,0x00,0x01,0x01, 0x01,0x00,0x01,0x00,    0x00,0x00,0x01,0x01, 0x01,0x00,0x01,0x01,
-    0x00,0x00,0x01,0x01, 0x01,0x01,0x00,0x00,    0x00,0x00,0x01,0x01, 0x01,0x01,0x00,0x01,    0x00,0x00,0x01,0x01, 0x01,0x01,0x01,0x00,    0x00,0x00,0x01,0x01, 0x01,0x01,0x01,0x01,    0x00,0x01,0x00,0x00, 0x00,0x00,0x00,0x00,    0x00,0x01,0x00,0x00, 0x00,0x00,0x00,0x01,
-    0x00,0x01,0x00,0x00, 0x00,0x00,0x01,0x00,    0x00,0x01,0x00,0x00, 0x00,0x00,0x01,0x01,    0x00,0x01,0x00,0x00, 0x00,0x01,0x00,0x00,    0x00,0x01,0x00,0x00, 0x00,0x01,0x00,0x01,    0x00,0x01,0x00,0x00, 0x00,0x01,0x01,0x00,    0x00,0x01,0x00,0x00, 0x00,0x01,0x01,0x01,
-    0x00,0x01,0x00,0x00, 0x01,0x00,0x00,0x00,    0x00,0x01,0x00,0x00, 0x01,0x00,0x00,0x01,    0x00,0x01,0x00,0x00, 0x01,0x00,0x01,0x00,    0x00,0x01,0x00,0x00, 0x01,0x00,0x01,0x01,    0x00,0x01,0x00,0x00, 0x01,0x01,0x00,0x00,    0x00,0x01,0x00,0x00, 0x01,0x01,0x00,0x01,
-    0x00,0x01,0x00,0x00, 0x01,0x01,0x01,0x00,    0x00,0x01,0x00,0x00, 0x01,0x01,0x01,0x01,    0x00,0x01,0x00,0x01, 0x00,0x00,0x00,0x00,    0x00,0x01,0x00,0x01, 0x00,0x00,0x00,0x01,    0x00,0x01,0x00,0x01, 0x00,0x00,0x01,0x00,    0x00,0x01,0x00,0x01, 0x00,0x00,0x01,0x01,
-    0x00,0x01,0x00,0x01, 0x00,0x01,0x00,0x00,    0x00,0x01,0x00,0x01, 0x00,0x01,0x00,0x01,    0x00,0x01,0x00,0x01, 0x00,0x01,0x01,0x00,    0x00,0x01,0x00,0x01, 0x00,0x01,0x01,0x01,    0x00,0x01,0x00,0x01, 0x01,0x00,0x00,0x00,    0x00,0x01,0x00,0x01, 0x01,0x00,0x00,0x01,
-    0x00,0x01,0x00,0x01, 0x01,0x00,0x01,0x00,    0x00,0x01,0x00,0x01, 0x01,0x00,0x01,0x01,    0x00,0x01,0x00,0x01, 0x01,0x01,0x00,0x00,    0x00,0x01,0x00,0x01, 0x01,0x01,0x00,0x01,    0x00,0x01,0x00,0x01, 0x01,0x01,0x01,0x00,    0x00,0x01,0x00,0x01, 0x01,0x01,0x01,0x01,
-    0x00,0x01,0x01,0x00, 0x00,0x00,0x00,0x00,    0x00,0x01,0x01,0x00, 0x00,0x00,0x00,0x01,    0x00,0x01,0x01,0x00, 0x00,0x00,0x01,0x00,    0x00,0x01,0x01,0x00, 0x00,0x00,0x01,0x01,    0x00,0x01,0x01,0x00, 0x00,0x01,0x00,0x00,    0x00,0x01,0x01,0x00, 0x00,0x01,0x00,0x01,
-    0x00,0x01,0x01,0x00, 0x00,0x01,0x01,0x00,    0x00,0x01,0x01,0x00, 0x00,0x01,0x01,0x01,    0x00,0x01,0x01,0x00, 0x01,0x00,0x00,0x00,    0x00,0x01,0x01,0x00, 0x01,0x00,0x00,0x01,    0x00,0x01,0x01,0x00, 0x01,0x00,0x01,0x00,    0x00,0x01,0x01,0x00, 0x01,0x00,0x01,0x01,
-    0x00,0x01,0x01,0x00, 0x01,0x01,0x00,0x00,    0x00,0x01,0x01,0x00, 0x01,0x01,0x00,0x01,    0x00,0x01,0x01,0x00, 0x01,0x01,0x01,0x00,    0x00,0x01,0x01,0x00, 0x01,0x01,0x01,0x01,    0x00,0x01,0x01,0x01, 0x00,0x00,0x00,0x00,    0x00,0x01,0x01,0x01, 0x00,0x00,0x00,0x01,
-    0x00,0x01,0x01,0x01, 0x00,0x00,0x01,0x00,    0x00,0x01,0x01,0x01, 0x00,0x00,0x01,0x01,    0x00,0x01,0x01,0x01, 0x00,0x01,0x00,0x00,    0x00,0x01,0x01,0x01, 0x00,0x01,0x00,0x01,    0x00,0x01,0x01,0x01, 0x00,0x01,0x01,0x00,    0x00,0x01,0x01,0x01, 0x00,0x01,0x01,0x01,
-    0x00,0x01,0x01,0x01, 0x01,0x00,0x00,0x00,    0x00,0x01,0x01,0x01, 0x01,0x00,0x00,0x01,    0x00,0x01,0x01,0x01, 0x01,0x00,0x01,0x00,    0x00,0x01,0x01,0x01, 0x01,0x00,0x01,0x01,    0x00,0x01,0x01,0x01, 0x01,0x01,0x00,0x00,    0x00,0x01,0x01,0x01, 0x01,0x01,0x00,0x01,
-    0x00,0x01,0x01,0x01, 0x01,0x01,0x01,0x00,    0x00,0x01,0x01,0x01, 0x01,0x01,0x01,0x01,    0x01,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,    0x01,0x00,0x00,0x00, 0x00,0x00,0x00,0x01,    0x01,0x00,0x00,0x00, 0x00,0x00,0x01,0x00,    0x01,0x00,0x00,0x00, 0x00,0x00,0x01,0x01,
-    0x01,0x00,0x00,0x00, 0x00,0x01,0x00,0x00,    0x01,0x00,0x00,0x00, 0x00,0x01,0x00,0x01,    0x01,0x00,0x00,0x00, 0x00,0x01,0x01,0x00,    0x01,0x00,0x00,0x00, 0x00,0x01,0x01,0x01,    0x01,0x00,0x00,0x00, 0x01,0x00,0x00,0x00,    0x01,0x00,0x00,0x00, 0x01,0x00,0x00,0x01,
-    0x01,0x00,0x00,0x00, 0x01,0x00,0x01,0x00,    0x01,0x00,0x00,0x00, 0x01,0x00,0x01,0x01,    0x01,0x00,0x00,0x00, 0x01,0x01,0x00,0x00,    0x01,0x00,0x00,0x00, 0x01,0x01,0x00,0x01,    0x01,0x00,0x00,0x00, 0x01,0x01,0x01,0x00,    0x01,0x00,0x00,0x00, 0x01,0x01,0x01,0x01,
-    0x01,0x00,0x00,0x01, 0x00,0x00,0x00,0x00,    0x01,0x00,0x00,0x01, 0x00,0x00,0x00,0x01,    0x01,0x00,0x00,0x01, 0x00,0x00,0x01,0x00,    0x01,0x00,0x00,0x01, 0x00,0x00,0x01,0x01,    0x01,0x00,0x00,0x01, 0x00,0x01,0x00,0x00,    0x01,0x00,0x00,0x01, 0x00,0x01,0x00,0x01,
-    0x01,0x00,0x00,0x01, 0x00,0x01,0x01,0x00,    0x01,0x00,0x00,0x01, 0x00,0x01,0x01,0x01,    0x01,0x00,0x00,0x01, 0x01,0x00,0x00,0x00,    0x01,0x00,0x00,0x01, 0x01,0x00,0x00,0x01,    0x01,0x00,0x00,0x01, 0x01,0x00,0x01,0x00,    0x01,0x00,0x00,0x01, 0x01,0x00,0x01,0x01,
-    0x01,0x00,0x00,0x01, 0x01,0x01,0x00,0x00,    0x01,0x00,0x00,0x01, 0x01,0x01,0x00,0x01,    0x01,0x00,0x00,0x01, 0x01,0x01,0x01,0x00,    0x01,0x00,0x00,0x01, 0x01,0x01,0x01,0x01,    0x01,0x00,0x01,0x00, 0x00,0x00,0x00,0x00,    0x01,0x00,0x01,0x00, 0x00,0x00,0x00,0x01,
-    0x01,0x00,0x01,0x00, 0x00,0x00,0x01,0x00,    0x01,0x00,0x01,0x00, 0x00,0x00,0x01,0x01,    0x01,0x00,0x01,0x00, 0x00,0x01,0x00,0x00,    0x01,0x00,0x01,0x00, 0x00,0x01,0x00,0x01,    0x01,0x00,0x01,0x00, 0x00,0x01,0x01,0x00,    0x01,0x00,0x01,0x00, 0x00,0x01,0x01,0x01,
-    0x01,0x00,0x01,0x00, 0x01,0x00,0x00,0x00,    0x01,0x00,0x01,0x00, 0x01,0x00,0x00,0x01,    0x01,0x00,0x01,0x00, 0x01,0x00,0x01,0x00,    0x01,0x00,0x01,0x00, 0x01,0x00,0x01,0x01,    0x01,0x00,0x01,0x00, 0x01,0x01,0x00,0x00,    0x01,0x00,0x01,0x00, 0x01,0x01,0x00,0x01,
-    0x01,0x00,0x01,0x00, 0x01,0x01,0x01,0x00,    0x01,0x00,0x01,0x00, 0x01,0x01,0x01,0x01,    0x01,0x00,0x01,0x01, 0x00,0x00,0x00,0x00,    0x01,0x00,0x01,0x01, 0x00,0x00,0x00,0x01,    0x01,0x00,0x01,0x01, 0x00,0x00,0x01,0x00,    0x01,0x00,0x01,0x01, 0x00,0x00,0x01,0x01,
-    0x01,0x00,0x01,0x01, 0x00,0x01,0x00,0x00,    0x01,0x00,0x01,0x01, 0x00,0x01,0x00,0x01,    0x01,0x00,0x01,0x01, 0x00,0x01,0x01,0x00,    0x01,0x00,0x01,0x01, 0x00,0x01,0x01,0x01,    0x01,0x00,0x01,0x01, 0x01,0x00,0x00,0x00,    0x01,0x00,0x01,0x01, 0x01,0x00,0x00,0x01,
-    0x01,0x00,0x01,0x01, 0x01,0x00,0x01,0x00,    0x01,0x00,0x01,0x01, 0x01,0x00,0x01,0x01,    0x01,0x00,0x01,0x01, 0x01,0x01,0x00,0x00,    0x01,0x00,0x01,0x01, 0x01,0x01,0x00,0x01,    0x01,0x00,0x01,0x01, 0x01,0x01,0x01,0x00,    0x01,0x00,0x01,0x01, 0x01,0x01,0x01,0x01,
-    0x01,0x01,0x00,0x00, 0x00,0x00,0x00,0x00,    0x01,0x01,0x00,0x00, 0x00,0x00,0x00,0x01,    0x01,0x01,0x00,0x00, 0x00,0x00,0x01,0x00,    0x01,0x01,0x00,0x00, 0x00,0x00,0x01,0x01,    0x01,0x01,0x00,0x00, 0x00,0x01,0x00,0x00,    0x01,0x01,0x00,0x00, 0x00,0x01,0x00,0x01,
-    0x01,0x01,0x00,0x00, 0x00,0x01,0x01,0x00,    0x01,0x01,0x00,0x00, 0x00,0x01,0x01,0x01,    0x01,0x01,0x00,0x00, 0x01,0x00,0x00,0x00,    0x01,0x01,0x00,0x00, 0x01,0x00,0x00,0x01,    0x01,0x01,0x00,0x00, 0x01,0x00,0x01,0x00,    0x01,0x01,0x00,0x00, 0x01,0x00,0x01,0x01,
-    0x01,0x01,0x00,0x00, 0x01,0x01,0x00,0x00,    0x01,0x01,0x00,0x00, 0x01,0x01,0x00,0x01,    0x01,0x01,0x00,0x00, 0x01,0x01,0x01,0x00,    0x01,0x01,0x00,0x00, 0x01,0x01,0x01,0x01,    0x01,0x01,0x00,0x01, 0x00,0x00,0x00,0x00,    0x01,0x01,0x00,0x01, 0x00,0x00,0x00,0x01,
-    0x01,0x01,0x00,0x01, 0x00,0x00,0x01,0x00,    0x01,0x01,0x00,0x01, 0x00,0x00,0x01,0x01,    0x01,0x01,0x00,0x01, 0x00,0x01,0x00,0x00,    0x01,0x01,0x00,0x01, 0x00,0x01,0x00,0x01,    0x01,0x01,0x00,0x01, 0x00,0x01,0x01,0x00,    0x01,0x01,0x00,0x01, 0x00,0x01,0x01,0x01,
-    0x01,0x01,0x00,0x01, 0x01,0x00,0x00,0x00,    0x01,0x01,0x00,0x01, 0x01,0x00,0x00,0x01,    0x01,0x01,0x00,0x01, 0x01,0x00,0x01,0x00,    0x01,0x01,0x00,0x01, 0x01,0x00,0x01,0x01,    0x01,0x01,0x00,0x01, 0x01,0x01,0x00,0x00,    0x01,0x01,0x00,0x01, 0x01,0x01,0x00,0x01,
-    0x01,0x01,0x00,0x01, 0x01,0x01,0x01,0x00,    0x01,0x01,0x00,0x01, 0x01,0x01,0x01,0x01,    0x01,0x01,0x01,0x00, 0x00,0x00,0x00,0x00,    0x01,0x01,0x01,0x00, 0x00,0x00,0x00,0x01,    0x01,0x01,0x01,0x00, 0x00,0x00,0x01,0x00,    0x01,0x01,0x01,0x00, 0x00,0x00,0x01,0x01,
-    0x01,0x01,0x01,0x00, 0x00,0x01,0x00,0x00,    0x01,0x01,0x01,0x00, 0x00,0x01,0x00,0x01,    0x01,0x01,0x01,0x00, 0x00,0x01,0x01,0x00,    0x01,0x01,0x01,0x00, 0x00,0x01,0x01,0x01,    0x01,0x01,0x01,0x00, 0x01,0x00,0x00,0x00,    0x01,0x01,0x01,0x00, 0x01,0x00,0x00,0x01,
-    0x01,0x01,0x01,0x00, 0x01,0x00,0x01,0x00,    0x01,0x01,0x01,0x00, 0x01,0x00,0x01,0x01,    0x01,0x01,0x01,0x00, 0x01,0x01,0x00,0x00,    0x01,0x01,0x01,0x00, 0x01,0x01,0x00,0x01,    0x01,0x01,0x01,0x00, 0x01,0x01,0x01,0x00,    0x01,0x01,0x01,0x00, 0x01,0x01,0x01,0x01,
-    0x01,0x01,0x01,0x01, 0x00,0x00,0x00,0x00,    0x01,0x01,0x01,0x01, 0x00,0x00,0x00,0x01,    0x01,0x01,0x01,0x01, 0x00,0x00,0x01,0x00,    0x01,0x01,0x01,0x01, 0x00,0x00,0x01,0x01,    0x01,0x01,0x01,0x01, 0x00,0x01,0x00,0x00,    0x01,0x01,0x01,0x01, 0x00,0x01,0x00,0x01,
-    0x01,0x01,0x01,0x01, 0x00,0x01,0x01,0x00,    0x01,0x01,0x01,0x01, 0x00,0x01,0x01,0x01,    0x01,0x01,0x01,0x01, 0x01,0x00,0x00,0x00,    0x01,0x01,0x01,0x01, 0x01,0x00,0x00,0x01,    0x01,0x01,0x01,0x01, 0x01,0x00,0x01,0x00,    0x01,0x01,0x01,0x01, 0x01,0x00,0x01,0x01,
-    0x01,0x01,0x01,0x01, 0x01,0x01,0x00,0x00,    0x01,0x01,0x01,0x01, 0x01,0x01,0x00,0x01,    0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x00,    0x01,0x01,0x01,0x01, 0x01,0x01,0x01,0x01
-};
-
+    mdjvu_bitops.pack_row(BMP->data[y], bytes, BMP->width);
+}
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_unpack_row
     (mdjvu_bitmap_t b, unsigned char *bytes, int32 y)
 {
-    unsigned char *bits = BMP->data[y];
-    int w = BMP->width;
-
-    uint32 a = *bits;
-    while (w > 0) {
-        unsigned char * data = (unsigned char *) lookup_table_unpack_row + a * 8;
-        const size_t len = (w >= 8)? 8 : w;
-        memcpy(bytes, data, len);
-        w -= 8;
-        if (w > 0) {
-            bytes += len;
-            a = *++bits;
-        }
-    }
-
+    mdjvu_bitops.unpack_row(bytes, BMP->data[y], BMP->width, 0xFF);
 }
 
-/* FIXME: this is almost a copy of the previous function */
 MDJVU_IMPLEMENT void mdjvu_bitmap_unpack_row_0_or_1
     (mdjvu_bitmap_t b, unsigned char *bytes, int32 y)
 {
-    unsigned char *bits = BMP->data[y];
-    int w = BMP->width;
-
-    uint32 a = *bits;
-    while (w > 0) {
-        unsigned char * data = (unsigned char *) lookup_table_unpack_row_0_1 + a * 8;
-        const size_t len = (w >= 8)? 8 : w;
-        memcpy(bytes, data, len);
-        w -= 8;
-        if (w > 0) {
-            bytes += len;
-            a = *++bits;
-        }
-    }
+    mdjvu_bitops.unpack_row(bytes, BMP->data[y], BMP->width, 1);
 }
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_pack_all
@@ -372,57 +539,92 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_bitmap_crop
 
 /* _______________________________   bbox   ________________________________ */
 
-static int row_is_empty(Bitmap *bmp, int32 y)
-{
-    unsigned char *row = bmp->data[y];
-    int32 bytes_to_check = BYTES_PER_ROW(bmp->width) - 1;
-    int32 bits_to_check = bmp->width - (bytes_to_check << 3);
-    int32 mask = 0xFF << (8 - bits_to_check);
-    int32 i;
-
-    for (i = 0; i < bytes_to_check; i++)
-        if (row[i]) return 0;
+/* Rows and columns are checked a word at a time. */
 
-    if (row[bytes_to_check] & mask) return 0;
-    return 1;
+/* Bytes `pos'... of a row as a big-endian word,
+ * without the bits after the end of the row (they may be garbage)
+ */
+static uint64_t load_row_word(const unsigned char *row, int32 width, int32 pos)
+{
+    int32 size = BYTES_PER_ROW(width) - pos;
+    int32 bits = width - pos * 8;
+    uint64_t word = mdjvu_load_be64(row + pos, size < 8 ? size : 8);
+    if (bits < 64)
+        word &= ~(uint64_t) 0 << (64 - bits);
+    return word;
 }
 
-static int column_is_empty(Bitmap *bmp, int32 x)
+static int row_is_empty(Bitmap *bmp, int32 y)
 {
-    int32 byte_offset = x >> 3;
-    int mask = 1 << (7 - (x & 7));
-    int32 bytes_per_row = BYTES_PER_ROW(bmp->width);
-    unsigned char *p = bmp->data[0] + byte_offset;
-    int32 i = bmp->height;
+    const unsigned char *row = bmp->data[y];
+    int32 size = BYTES_PER_ROW(bmp->width), pos;
+    uint64_t acc = 0, word;
 
-    while(i--)
+    for (pos = 0; pos + 8 < size; pos += 8)
     {
-        if (*p & mask) return 0;
-        p += bytes_per_row;
+        memcpy(&word, row + pos, 8);
+        acc |= word;
     }
+    return !(acc | load_row_word(row, bmp->width, pos));
+}
 
-    return 1;
+/* Leftmost and rightmost black pixels of a row, which must not be empty */
+static void get_row_extent(const unsigned char *row, int32 width,
+                           int32 *left, int32 *right)
+{
+    int32 pos;
+    uint64_t word;
+
+    for (pos = 0; !(word = load_row_word(row, width, pos)); pos += 8) {}
+    *left = pos * 8 + mdjvu_clz64(word);
+
+    pos = (BYTES_PER_ROW(width) - 1) & ~7;
+    for (; !(word = load_row_word(row, width, pos)); pos -= 8) {}
+    *right = pos * 8 + mdjvu_clz64(word & (~word + 1)); /* the lowest bit */
 }
 
+/* Empty rows are skipped from both ends, the rest are ORed together,
+ * and the columns are found in the result.
+ * An empty bitmap gets the box of its top left pixel.
+ */
 MDJVU_IMPLEMENT void mdjvu_bitmap_get_bounding_box(mdjvu_bitmap_t b,
     int32 *pl, int32 *pt, int32 *pw, int32 *ph)
 {
-    int32 right = BMP->width - 1;
-    int32 left = 0;
+    int32 row_size = ROW_SIZE;
     int32 bottom = BMP->height - 1;
     int32 top = 0;
-
-    while (column_is_empty(BMP, right) && right) right--;
-    while (column_is_empty(BMP, left) && left < right) left++;
-
-    *pl = left;
-    *pw = right - left + 1;
+    int32 left, right, y;
+    unsigned char *columns;
 
     while (row_is_empty(BMP, bottom) && bottom) bottom--;
     while (row_is_empty(BMP, top) && top < bottom) top++;
 
+    if (top == bottom && row_is_empty(BMP, top))
+    {
+        *pl = *pt = 0;
+        *pw = *ph = 1;
+        return;
+    }
+
     *pt = top;
     *ph = bottom - top + 1;
+
+    if (top == bottom)
+    {
+        get_row_extent(BMP->data[top], BMP->width, &left, &right);
+    }
+    else
+    {
+        columns = (unsigned char *) malloc(row_size);
+        memcpy(columns, BMP->data[top], row_size);
+        for (y = top + 1; y <= bottom; y++)
+            mdjvu_bitops.or_row(columns, BMP->data[y], row_size);
+        get_row_extent(columns, BMP->width, &left, &right);
+        free(columns);
+    }
+
+    *pl = left;
+    *pw = right - left + 1;
 }
 
 MDJVU_IMPLEMENT void mdjvu_bitmap_remove_margins
@@ -438,26 +640,60 @@ MDJVU_IMPLEMENT void mdjvu_bitmap_remove_margins
     mdjvu_bitmap_destroy(cropped);
 }
 
-/* _______________________________   misc   ________________________________ */
+/* Shift `size' bytes of a row left by `shift' bits, filling with zeros.
+ * Words are read ahead of where they are written, so this works in place.
+ */
+static void shift_row_left(unsigned char *row, int32 size, int32 shift)
+{
+    int32 skip = shift >> 3, s = shift & 7, pos;
 
-// Generate a lookup table for 8 bit integers
-#define B2(n) n, n + 1, n + 1, n + 2
-#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
-#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
+    for (pos = 0; pos < size; pos += 8)
+    {
+        int32 from = pos + skip;
+        int32 avail = size - from;
+        uint64_t word = 0;
+        if (avail > 0)
+        {
+            word = mdjvu_load_be64(row + from, avail < 8 ? avail : 8) << s;
+            if (s && avail > 8)
+                word |= row[from + 8] >> (8 - s);
+        }
+        mdjvu_store_be64(row + pos, word, size - pos < 8 ? size - pos : 8);
+    }
+}
+
+/* The top margin is dropped by moving `data' down the table of rows,
+ * the right and bottom ones by making the bitmap smaller;
+ * the stride stays, so the rest of each row is zeros.
+ */
+MDJVU_IMPLEMENT void mdjvu_bitmap_trim_margins
+    (mdjvu_bitmap_t b, int32 *px, int32 *py)
+{
+    int32 w, h, y;
+    mdjvu_bitmap_get_bounding_box(b, px, py, &w, &h);
+    if (!*px && !*py && w == BMP->width && h == BMP->height)
+        return;
 
-// Lookup table that store the sum of bits for all uchar values
+    if (*py)
+    {
+        adopt_data(BMP); /* the slab will free the table from its start */
+        BMP->data += *py;
+    }
+    if (*px)
+    {
+        for (y = 0; y < h; y++)
+            shift_row_left(BMP->data[y], ROW_SIZE, *px);
+    }
+    BMP->width = w;
+    BMP->height = h;
+}
 
-const unsigned char lookup_mass[256] = { B6(0), B6(1), B6(1), B6(2) };
+/* _______________________________   misc   ________________________________ */
 
 MDJVU_IMPLEMENT int32 mdjvu_bitmap_get_mass(mdjvu_bitmap_t b)
 {
-    int32 m = 0;
-    int32 y;
-    for (y = 0; y < BMP->height; y++) {
-        unsigned char *data = BMP->data[y];
-        int x;
-        for (x = 0; x < BYTES_PER_ROW(BMP->width); x++)
-            m += lookup_mass[data[x]];
-    }
-    return m;
+    /* rows are stored contiguously (see mdjvu_create_2d_array()),
+     * and bits after the end of a row, up to the stride, are zero
+     */
+    return mdjvu_bitops.popcount(BMP->data[0], BMP->stride * BMP->height);
 }
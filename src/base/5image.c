@@ -55,6 +55,19 @@ const int32 artifact_sizes[] = MDJVU_ARTIFACT_SIZES;
 #define MAX_ARTIFACT_SIZE 16  /* supposing that pointers can't have size > 16 */
 
 
+/* To find the blits in a rectangle, the page is cut into square cells,
+ * and each cell lists the blits that overlap it.
+ */
+#define CELL_SHIFT 8 /* cells of 256 x 256 pixels */
+
+typedef struct
+{
+    int32 columns, rows;
+    int32 *start;    /* for each cell, where its blits begin in `blits' */
+    int32 *blits;
+} BlitIndex;
+
+
 
 typedef struct
 {
@@ -74,6 +87,9 @@ typedef struct
     int32 resolution; /* 0 - unknown */
 
     void *artifacts[mdjvu_artifacts_count];
+
+    /* built by mdjvu_image_get_blits_in_rect(), NULL if blits have changed */
+    BlitIndex *blit_index;
 } Image;
 
 
@@ -175,6 +191,8 @@ MDJVU_IMPLEMENT mdjvu_image_t mdjvu_image_create(int32 width, int32 height)
     for (i = 0; i < mdjvu_artifacts_count; i++)
         image->artifacts[i] = NULL;
 
+    image->blit_index = NULL;
+
     return (mdjvu_image_t) image;
 }
 
@@ -193,6 +211,12 @@ MDJVU_IMPLEMENT int mdjvu_image_mem_size(mdjvu_image_t img)
     for (int i = 0; i < image->bitmaps_count; i++)
         res += mdjvu_bitmap_mem_size(image->bitmaps[i]);
 
+    if (image->blit_index) {
+        BlitIndex *index = image->blit_index;
+        int cells = index->columns * index->rows;
+        res += sizeof(BlitIndex) + (cells + 1 + index->start[cells]) * sizeof(int32);
+    }
+
     if (image->dictionary) {
         res += mdjvu_image_mem_size(image->dictionary);
     }
@@ -203,10 +227,22 @@ MDJVU_IMPLEMENT int mdjvu_image_mem_size(mdjvu_image_t img)
 
 /* ______________________________   destroy   _______________________________ */
 
+static void drop_blit_index(Image *image)
+{
+    if (image->blit_index)
+    {
+        free(image->blit_index->start);
+        free(image->blit_index->blits);
+        free(image->blit_index);
+        image->blit_index = NULL;
+    }
+}
+
 MDJVU_IMPLEMENT void mdjvu_image_destroy(mdjvu_image_t image)
 {
     int32 i;
     int k;
+    drop_blit_index(IMG);
     free(IMG->blits);
     free(IMG->x);
     free(IMG->y);
@@ -421,6 +457,7 @@ MDJVU_IMPLEMENT int32 mdjvu_image_add_blit(mdjvu_image_t image,
         IMG->blits = (mdjvu_bitmap_t *) realloc(IMG->blits,
                                 IMG->blits_allocated * sizeof(mdjvu_bitmap_t));
     }
+    drop_blit_index(IMG);
     IMG->x[IMG->blits_count] = x;
     IMG->y[IMG->blits_count] = y;
     IMG->blits[IMG->blits_count] = bitmap;
@@ -446,6 +483,7 @@ MDJVU_IMPLEMENT void mdjvu_image_remove_NULL_blits(mdjvu_image_t image)
         }
     }
 
+    drop_blit_index(IMG);
     free(IMG->x);
     free(IMG->y);
     free(IMG->blits);
@@ -472,12 +510,14 @@ MDJVU_IMPLEMENT int32 mdjvu_image_get_blit_y(mdjvu_image_t image, int32 i)
 MDJVU_IMPLEMENT void mdjvu_image_set_blit_x(mdjvu_image_t image, int32 i, int32 x)
 {
     assert(i >= 0 && i < IMG->blits_count);
+    drop_blit_index(IMG);
     IMG->x[i] = x;
 }
 
 MDJVU_IMPLEMENT void mdjvu_image_set_blit_y(mdjvu_image_t image, int32 i, int32 y)
 {
     assert(i >= 0 && i < IMG->blits_count);
+    drop_blit_index(IMG);
     IMG->y[i] = y;
 }
 
@@ -491,6 +531,7 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t
 MDJVU_IMPLEMENT void mdjvu_image_set_blit_bitmap(mdjvu_image_t image, int32 i, mdjvu_bitmap_t b)
 {
     assert(i >= 0 && i < IMG->blits_count);
+    drop_blit_index(IMG);
     IMG->blits[i] = b;
 }
 
@@ -499,12 +540,118 @@ MDJVU_IMPLEMENT void mdjvu_image_exchange_blits(mdjvu_image_t image, int32 i, in
 {
     int32 t; mdjvu_bitmap_t b;
     if (i == j) return;
+    drop_blit_index(IMG);
     t = IMG->x[i];     IMG->x[i]     = IMG->x[j];     IMG->x[j] = t;
     t = IMG->y[i];     IMG->y[i]     = IMG->y[j];     IMG->y[j] = t;
     b = IMG->blits[i]; IMG->blits[i] = IMG->blits[j]; IMG->blits[j] = b;
 }
 
 
+/* _____________________________   blit index   ____________________________ */
+
+/* Get the part of a blit (or of a rectangle) that is on the page,
+ * as the columns x0..x1-1 and the rows y0..y1-1; returns 0 if it's empty.
+ */
+static int clip_to_page(Image *image, int32 x, int32 y, int32 w, int32 h,
+                        int32 *x0, int32 *y0, int32 *x1, int32 *y1)
+{
+    *x0 = x > 0 ? x : 0;
+    *y0 = y > 0 ? y : 0;
+    *x1 = x + w < image->width  ? x + w : image->width;
+    *y1 = y + h < image->height ? y + h : image->height;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+static int clip_blit(Image *image, int32 i,
+                     int32 *x0, int32 *y0, int32 *x1, int32 *y1)
+{
+    mdjvu_bitmap_t bitmap = image->blits[i];
+    if (!bitmap) return 0;
+    return clip_to_page(image, image->x[i], image->y[i],
+                        mdjvu_bitmap_get_width(bitmap),
+                        mdjvu_bitmap_get_height(bitmap), x0, y0, x1, y1);
+}
+
+static BlitIndex *build_blit_index(Image *image)
+{
+    BlitIndex *index = (BlitIndex *) malloc(sizeof(BlitIndex));
+    int32 ncells, i, cx, cy;
+
+    index->columns = ((image->width  - 1) >> CELL_SHIFT) + 1;
+    index->rows    = ((image->height - 1) >> CELL_SHIFT) + 1;
+    ncells = index->columns * index->rows;
+    index->start = (int32 *) calloc(ncells + 1, sizeof(int32));
+
+    /* counting, then filling as in a counting sort */
+    for (i = 0; i < image->blits_count; i++)
+    {
+        int32 x0, y0, x1, y1;
+        if (!clip_blit(image, i, &x0, &y0, &x1, &y1)) continue;
+        for (cy = y0 >> CELL_SHIFT; cy <= (y1 - 1) >> CELL_SHIFT; cy++)
+        for (cx = x0 >> CELL_SHIFT; cx <= (x1 - 1) >> CELL_SHIFT; cx++)
+            index->start[cy * index->columns + cx + 1]++;
+    }
+    for (i = 0; i < ncells; i++)
+        index->start[i + 1] += index->start[i];
+    index->blits = (int32 *) malloc(index->start[ncells] * sizeof(int32));
+    for (i = 0; i < image->blits_count; i++)
+    {
+        int32 x0, y0, x1, y1;
+        if (!clip_blit(image, i, &x0, &y0, &x1, &y1)) continue;
+        for (cy = y0 >> CELL_SHIFT; cy <= (y1 - 1) >> CELL_SHIFT; cy++)
+        for (cx = x0 >> CELL_SHIFT; cx <= (x1 - 1) >> CELL_SHIFT; cx++)
+            index->blits[index->start[cy * index->columns + cx]++] = i;
+    }
+    /* the loop has moved every start to the next one */
+    for (i = ncells; i > 0; i--)
+        index->start[i] = index->start[i - 1];
+    index->start[0] = 0;
+    return index;
+}
+
+/* A blit overlapping several cells of the rectangle is taken in the first
+ * of them, so that it's found once.
+ */
+MDJVU_IMPLEMENT int32 mdjvu_image_get_blits_in_rect(mdjvu_image_t image,
+    int32 x, int32 y, int32 w, int32 h, int32 *result)
+{
+    BlitIndex *index;
+    int32 x0, y0, x1, y1, cx0, cy0, cx, cy, k, count = 0;
+
+    if (!clip_to_page(IMG, x, y, w, h, &x0, &y0, &x1, &y1))
+        return 0;
+
+    #pragma omp critical(mdjvu_image_blit_index)
+    {
+        if (!IMG->blit_index)
+            IMG->blit_index = build_blit_index(IMG);
+        index = IMG->blit_index;
+    }
+
+    cx0 = x0 >> CELL_SHIFT;
+    cy0 = y0 >> CELL_SHIFT;
+    for (cy = cy0; cy <= (y1 - 1) >> CELL_SHIFT; cy++)
+    for (cx = cx0; cx <= (x1 - 1) >> CELL_SHIFT; cx++)
+    {
+        int32 cell = cy * index->columns + cx;
+        for (k = index->start[cell]; k < index->start[cell + 1]; k++)
+        {
+            int32 i = index->blits[k];
+            int32 bx0, by0, bx1, by1, first_cx, first_cy;
+            clip_blit(IMG, i, &bx0, &by0, &bx1, &by1);
+            first_cx = bx0 >> CELL_SHIFT;
+            first_cy = by0 >> CELL_SHIFT;
+            if (cx != (first_cx > cx0 ? first_cx : cx0)
+             || cy != (first_cy > cy0 ? first_cy : cy0))
+                continue; /* taken in another cell */
+            if (bx0 < x1 && bx1 > x0 && by0 < y1 && by1 > y0)
+                result[count++] = i;
+        }
+    }
+    return count;
+}
+
+
 /* _____________________________   image info   ____________________________ */
 
 MDJVU_IMPLEMENT int32 mdjvu_image_get_resolution(mdjvu_image_t image)
@@ -703,6 +850,7 @@ MDJVU_IMPLEMENT void mdjvu_image_remove_bitmap_margins(mdjvu_image_t image)
     delta_x = (int32 *) malloc(n * sizeof(int32));
     delta_y = (int32 *) malloc(n * sizeof(int32));
 
+    drop_blit_index(IMG);
     for (i = 0; i < n; i++)
         mdjvu_bitmap_remove_margins(IMG->bitmaps[i], &delta_x[i], &delta_y[i]);
 
@@ -0,0 +1,191 @@
+/*
+ * 7runs.c - run-length encoded bitonal pages
+ */
+
+#include "../base/mdjvucfg.h"
+#include <minidjvu-mod/minidjvu-mod.h>
+#include "bitops.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Rows are stored in one pool in the order they were set.
+ * A row set again gets new space; the old one is wasted until destruction.
+ */
+typedef struct
+{
+    int32 width, height;
+    int32 *first; /* for each row, the index of its runs in the pool */
+    int32 *count; /* for each row, the number of its runs */
+    int32 *pool;  /* pairs of coordinates */
+    int32 pool_size, pool_allocated;
+} Runs;
+
+#define RUNS ((Runs *) runs)
+
+#define COUNT(BYTES) mdjvu_memory_count(mdjvu_memory_runs, (ptrdiff_t) (BYTES))
+
+/* ______________________________   create/destroy   ________________________ */
+
+MDJVU_IMPLEMENT mdjvu_runs_t mdjvu_runs_create(int32 width, int32 height)
+{
+    Runs *r = MDJVU_MALLOC(Runs);
+    mdjvu_init();
+    r->width = width;
+    r->height = height;
+    r->first = (int32 *) calloc(height, sizeof(int32));
+    r->count = (int32 *) calloc(height, sizeof(int32));
+    r->pool_allocated = 256;
+    r->pool = MDJVU_MALLOCV(int32, r->pool_allocated);
+    r->pool_size = 0;
+    COUNT(mdjvu_runs_mem_size((mdjvu_runs_t) r));
+    return (mdjvu_runs_t) r;
+}
+
+MDJVU_IMPLEMENT void mdjvu_runs_destroy(mdjvu_runs_t runs)
+{
+    COUNT(-mdjvu_runs_mem_size(runs));
+    MDJVU_FREEV(RUNS->first);
+    MDJVU_FREEV(RUNS->count);
+    MDJVU_FREEV(RUNS->pool);
+    MDJVU_FREE(RUNS);
+}
+
+MDJVU_IMPLEMENT void mdjvu_runs_exchange(mdjvu_runs_t runs, mdjvu_runs_t other)
+{
+    Runs tmp = *RUNS;
+    *RUNS = *(Runs *) other;
+    *(Runs *) other = tmp;
+}
+
+MDJVU_IMPLEMENT int32 mdjvu_runs_get_width(mdjvu_runs_t runs)
+    { return RUNS->width; }
+
+MDJVU_IMPLEMENT int32 mdjvu_runs_get_height(mdjvu_runs_t runs)
+    { return RUNS->height; }
+
+MDJVU_IMPLEMENT int mdjvu_runs_mem_size(mdjvu_runs_t runs)
+{
+    return sizeof(Runs) + 2 * RUNS->height * sizeof(int32)
+         + RUNS->pool_allocated * sizeof(int32);
+}
+
+/* _______________________________   rows   _________________________________ */
+
+/* Make room for `size' more coordinates at the end of the pool */
+static int32 *reserve(Runs *r, int32 size)
+{
+    if (r->pool_size + size > r->pool_allocated)
+    {
+        COUNT(-(ptrdiff_t) (r->pool_allocated * sizeof(int32)));
+        while (r->pool_size + size > r->pool_allocated)
+            r->pool_allocated <<= 1;
+        r->pool = (int32 *) realloc(r->pool, r->pool_allocated * sizeof(int32));
+        COUNT(r->pool_allocated * sizeof(int32));
+    }
+    return r->pool + r->pool_size;
+}
+
+MDJVU_IMPLEMENT void mdjvu_runs_set_row
+    (mdjvu_runs_t runs, int32 y, const int32 *row, int32 count)
+{
+    assert(y >= 0 && y < RUNS->height);
+    memcpy(reserve(RUNS, 2 * count), row, 2 * count * sizeof(int32));
+    RUNS->first[y] = RUNS->pool_size;
+    RUNS->count[y] = count;
+    RUNS->pool_size += 2 * count;
+}
+
+/* The row is scanned a word at a time, as in split:
+ * leading zeros (or ones) give the next run boundary.
+ */
+MDJVU_IMPLEMENT void mdjvu_runs_set_packed_row
+    (mdjvu_runs_t runs, int32 y, const unsigned char *packed_row)
+{
+    int32 w = RUNS->width;
+    int32 row_size = (w + 7) >> 3;
+    int32 *out = reserve(RUNS, w + 1), *start = out;
+    int32 pos;
+    int inside = 0;
+
+    assert(y >= 0 && y < RUNS->height);
+    for (pos = 0; pos < row_size; pos += 8)
+    {
+        uint64_t word = mdjvu_load_be64(packed_row + pos,
+                                        row_size - pos < 8 ? row_size - pos : 8);
+        int32 x0 = pos * 8;
+        int bit = 0;
+
+        if (w - x0 < 64) /* margin bits are not guaranteed to be 0s */
+            word &= ~(uint64_t) 0 << (64 - (w - x0));
+
+        if (inside ? !~word : !word)
+            continue;
+
+        while (1)
+        {
+            uint64_t rest = (inside ? ~word : word) << bit;
+            if (!rest) break;
+            bit += mdjvu_clz64(rest);
+            *out++ = x0 + bit;
+            inside = !inside;
+        }
+    }
+    if (inside)
+        *out++ = w;
+
+    RUNS->first[y] = RUNS->pool_size;
+    RUNS->count[y] = (int32) (out - start) / 2;
+    RUNS->pool_size += (int32) (out - start);
+}
+
+MDJVU_IMPLEMENT const int32 *mdjvu_runs_get_row
+    (mdjvu_runs_t runs, int32 y, int32 *count)
+{
+    *count = RUNS->count[y];
+    return RUNS->pool + RUNS->first[y];
+}
+
+MDJVU_IMPLEMENT void mdjvu_runs_get_packed_row
+    (mdjvu_runs_t runs, int32 y, unsigned char *packed_row)
+{
+    const int32 *p = RUNS->pool + RUNS->first[y];
+    int32 i, n = RUNS->count[y];
+
+    memset(packed_row, 0, (RUNS->width + 7) >> 3);
+    for (i = 0; i < n; i++, p += 2)
+        mdjvu_fill_bits(packed_row, p[0], p[1] - 1);
+}
+
+MDJVU_IMPLEMENT int32 mdjvu_runs_get_mass(mdjvu_runs_t runs)
+{
+    int32 mass = 0, y, i;
+    for (y = 0; y < RUNS->height; y++)
+    {
+        const int32 *p = RUNS->pool + RUNS->first[y];
+        for (i = 0; i < RUNS->count[y]; i++, p += 2)
+            mass += p[1] - p[0];
+    }
+    return mass;
+}
+
+/* ____________________________   conversions   _____________________________ */
+
+MDJVU_IMPLEMENT mdjvu_runs_t mdjvu_runs_create_from_bitmap(mdjvu_bitmap_t b)
+{
+    int32 h = mdjvu_bitmap_get_height(b);
+    mdjvu_runs_t runs = mdjvu_runs_create(mdjvu_bitmap_get_width(b), h);
+    int32 y;
+    for (y = 0; y < h; y++)
+        mdjvu_runs_set_packed_row(runs, y, mdjvu_bitmap_access_packed_row(b, y));
+    return runs;
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_runs_to_bitmap(mdjvu_runs_t runs)
+{
+    mdjvu_bitmap_t b = mdjvu_bitmap_create_aligned(RUNS->width, RUNS->height);
+    int32 y;
+    for (y = 0; y < RUNS->height; y++)
+        mdjvu_runs_get_packed_row(runs, y, mdjvu_bitmap_access_packed_row(b, y));
+    return b;
+}
@@ -0,0 +1,496 @@
+/*
+ * bitops.c - word-level kernels over packed bitmap rows
+ */
+
+#include "../base/mdjvucfg.h"
+#include <minidjvu-mod/minidjvu-mod.h>
+#include "bitops.h"
+
+/* On x86-64 with GCC or clang, kernels are also compiled for POPCNT
+ * (with BMI2 for packing) and AVX2 through target attributes,
+ * and the CPU is probed at run time.
+ * Everywhere else only the scalar variant exists.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+    #define BITOPS_X86
+    #include <immintrin.h>
+    #define TARGET_POPCNT __attribute__((target("popcnt")))
+    #define TARGET_BMI2   __attribute__((target("popcnt,bmi2")))
+    #define TARGET_AVX2   __attribute__((target("avx2,popcnt")))
+#endif
+
+/* ______________________________   word loops   ___________________________ */
+
+/* The same loops are instantiated for every variant;
+ * only the word popcount and the target differ.
+ */
+#define DEFINE_WORD_KERNELS(TIER, ATTR, POPCOUNT64) \
+ \
+ATTR static int popcount_##TIER(const unsigned char *p, int size) \
+{ \
+    int s = 0; \
+    for (; size >= 8; p += 8, size -= 8) \
+        s += POPCOUNT64(mdjvu_load_be64(p, 8)); \
+    return s + POPCOUNT64(mdjvu_load_be64(p, size)); \
+} \
+ \
+ATTR static int xor_popcount_##TIER(const unsigned char *a, \
+                                    const unsigned char *b, int size) \
+{ \
+    int s = 0; \
+    for (; size >= 8; a += 8, b += 8, size -= 8) \
+        s += POPCOUNT64(mdjvu_load_be64(a, 8) ^ mdjvu_load_be64(b, 8)); \
+    return s + POPCOUNT64(mdjvu_load_be64(a, size) ^ mdjvu_load_be64(b, size)); \
+} \
+ \
+ATTR static int xor_popcount_shifted_##TIER(const unsigned char *a, int a_len, \
+                                            const unsigned char *b, int b_len, \
+                                            int shift) \
+{ \
+    const int a_size = (a_len + 7) >> 3; \
+    const int b_size = (b_len + 7) >> 3; \
+    const int min_size = a_size < b_size ? a_size : b_size; \
+    const int a_end = a_len + shift; \
+    const int words = ((a_end > b_len ? a_end : b_len) + 63) >> 6; \
+    uint64_t carry = 0, val; \
+    int i, s = 0; \
+ \
+    if (!shift) /* no carry between words, and no shift by 64 below */ \
+        return xor_popcount_##TIER(a, b, min_size) \
+             + popcount_##TIER(a + min_size, a_size - min_size) \
+             + popcount_##TIER(b + min_size, b_size - min_size); \
+ \
+    /* whole words of both rows */ \
+    for (i = 0; i < min_size >> 3; i++) \
+    { \
+        val = mdjvu_load_be64(a + 8 * i, 8); \
+        s += POPCOUNT64((carry | (val >> shift)) ^ mdjvu_load_be64(b + 8 * i, 8)); \
+        carry = val << (64 - shift); \
+    } \
+ \
+    /* the rest, with every load kept within its row */ \
+    for (; i < words; i++) \
+    { \
+        int a_bytes = a_size - 8 * i, b_bytes = b_size - 8 * i; \
+        a_bytes = a_bytes < 0 ? 0 : a_bytes > 8 ? 8 : a_bytes; \
+        b_bytes = b_bytes < 0 ? 0 : b_bytes > 8 ? 8 : b_bytes; \
+        val = a_bytes ? mdjvu_load_be64(a + 8 * i, a_bytes) : 0; \
+        s += POPCOUNT64((carry | (val >> shift)) \
+                        ^ (b_bytes ? mdjvu_load_be64(b + 8 * i, b_bytes) : 0)); \
+        carry = val << (64 - shift); \
+    } \
+    return s; \
+} \
+ \
+ATTR static int xor_popcount_rows_##TIER(const unsigned char *a, int a_stride, int a_len, \
+                                         const unsigned char *b, int b_stride, int b_len, \
+                                         int shift, int rows, int ceiling) \
+{ \
+    int s = 0; \
+ \
+    for (; rows > 0; rows--, a += a_stride, b += b_stride) \
+    { \
+        s += xor_popcount_shifted_##TIER(a, a_len, b, b_len, shift); \
+        if (s > ceiling) break; \
+    } \
+    return s; \
+} \
+ \
+ATTR static int xor_popcount_words_##TIER(const uint64_t *a, const uint64_t *b, \
+                                          int count, int shift, int ceiling) \
+{ \
+    int s = 0; \
+    for (; count >= 4; a += 4, b += 4, count -= 4) \
+    { \
+        s += POPCOUNT64((a[0] >> shift) ^ b[0]) + POPCOUNT64((a[1] >> shift) ^ b[1]) \
+           + POPCOUNT64((a[2] >> shift) ^ b[2]) + POPCOUNT64((a[3] >> shift) ^ b[3]); \
+        if (s > ceiling) return s; \
+    } \
+    for (; count > 0; count--) \
+        s += POPCOUNT64((*a++ >> shift) ^ *b++); \
+    return s; \
+} \
+ \
+ATTR static void or_row_##TIER(unsigned char *dst, const unsigned char *src, int size) \
+{ \
+    uint64_t d, v; \
+    for (; size >= 8; dst += 8, src += 8, size -= 8) \
+    { \
+        memcpy(&d, dst, 8); memcpy(&v, src, 8); \
+        d |= v; \
+        memcpy(dst, &d, 8); \
+    } \
+    while (size--) *dst++ |= *src++; \
+} \
+ \
+ATTR static void and_row_##TIER(unsigned char *dst, const unsigned char *src, int size) \
+{ \
+    uint64_t d, v; \
+    for (; size >= 8; dst += 8, src += 8, size -= 8) \
+    { \
+        memcpy(&d, dst, 8); memcpy(&v, src, 8); \
+        d &= v; \
+        memcpy(dst, &d, 8); \
+    } \
+    while (size--) *dst++ &= *src++; \
+} \
+ \
+ATTR static void andn_row_##TIER(unsigned char *dst, const unsigned char *src, int size) \
+{ \
+    uint64_t d, v; \
+    for (; size >= 8; dst += 8, src += 8, size -= 8) \
+    { \
+        memcpy(&d, dst, 8); memcpy(&v, src, 8); \
+        d &= ~v; \
+        memcpy(dst, &d, 8); \
+    } \
+    while (size--) *dst++ &= (unsigned char) ~*src++; \
+}
+
+/* ______________________________   packing   ______________________________ */
+
+/* 8 pixels of a packed byte go to 8 bytes of a word, the leftmost pixel
+ * to the most significant byte, so that words are stored big-endian.
+ * Unpacking makes bytes of 0 and 1, multiplied by the black value then;
+ * packing takes 0x80 from each nonzero byte and gathers them to a byte.
+ */
+#define DEFINE_PACKING_KERNELS(TIER, ATTR, SPREAD8, GATHER8) \
+ \
+ATTR static void unpack_row_##TIER(unsigned char *bytes, const unsigned char *bits, \
+                                   int width, unsigned char black) \
+{ \
+    for (; width >= 8; width -= 8, bytes += 8) \
+        mdjvu_store_be64(bytes, SPREAD8(*bits++) * black, 8); \
+    if (width) \
+        mdjvu_store_be64(bytes, SPREAD8(*bits) * black, width); \
+} \
+ \
+ATTR static void pack_row_##TIER(unsigned char *bits, const unsigned char *bytes, int width) \
+{ \
+    for (; width >= 8; width -= 8, bytes += 8) \
+        *bits++ = (unsigned char) GATHER8(nonzero_bytes(mdjvu_load_be64(bytes, 8))); \
+    if (width) \
+        *bits = (unsigned char) GATHER8(nonzero_bytes(mdjvu_load_be64(bytes, width))); \
+}
+
+/* 0x80 in each nonzero byte, 0 in the others */
+static inline uint64_t nonzero_bytes(uint64_t x)
+{
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7Fu;
+    return (x | ((x & low7) + low7)) & ~low7;
+}
+
+/* Without PDEP and PEXT, bits are moved by multiplication:
+ * the partial products don't overlap, so nothing is carried.
+ */
+static inline uint64_t spread8_scalar(unsigned int a)
+{
+    return nonzero_bytes((a * 0x0101010101010101u) & 0x8040201008040201u) >> 7;
+}
+
+static inline uint64_t gather8_scalar(uint64_t x)
+{
+    return ((x >> 7) * 0x0102040810204080u) >> 56;
+}
+
+DEFINE_WORD_KERNELS(scalar, , mdjvu_popcount64)
+DEFINE_PACKING_KERNELS(scalar, , spread8_scalar, gather8_scalar)
+
+#ifdef BITOPS_X86
+
+DEFINE_WORD_KERNELS(popcnt, TARGET_POPCNT, __builtin_popcountll)
+DEFINE_PACKING_KERNELS(popcnt, TARGET_POPCNT, spread8_scalar, gather8_scalar)
+
+/* PDEP and PEXT take a cycle or three where they are done in hardware,
+ * but are microcoded on AMD before Zen 3, where multiplication is faster.
+ */
+TARGET_BMI2 static inline uint64_t spread8_bmi2(unsigned int a)
+{
+    return _pdep_u64(a, 0x0101010101010101u);
+}
+
+TARGET_BMI2 static inline uint64_t gather8_bmi2(uint64_t x)
+{
+    return _pext_u64(x, 0x8080808080808080u);
+}
+
+DEFINE_PACKING_KERNELS(bmi2, TARGET_BMI2, spread8_bmi2, gather8_bmi2)
+
+static int has_fast_bmi2(void)
+{
+    if (!__builtin_cpu_supports("bmi2"))
+        return 0;
+    return !(__builtin_cpu_is("amd")
+             && (__builtin_cpu_is("amdfam15h") || __builtin_cpu_is("amdfam17h")));
+}
+
+/* ______________________________   AVX2   _________________________________ */
+
+/* Popcount of 32 bytes at once via nibble lookup (W. Mula's method),
+ * added up as four 64-bit sums.
+ */
+TARGET_AVX2 static __m256i popcount_epi64_avx2(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                  _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+TARGET_AVX2 static int sum_epi64_avx2(__m256i acc)
+{
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                              _mm256_extracti128_si256(acc, 1));
+    return (int) (_mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1));
+}
+
+TARGET_AVX2 static int popcount_avx2(const unsigned char *p, int size)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int s;
+    for (; size >= 32; p += 32, size -= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        acc = _mm256_add_epi64(acc, popcount_epi64_avx2(v));
+    }
+    s = sum_epi64_avx2(acc);
+    return s + popcount_popcnt(p, size);
+}
+
+TARGET_AVX2 static int xor_popcount_avx2(const unsigned char *a,
+                                         const unsigned char *b, int size)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int s;
+    for (; size >= 32; a += 32, b += 32, size -= 32)
+    {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) a),
+                                     _mm256_loadu_si256((const __m256i *) b));
+        acc = _mm256_add_epi64(acc, popcount_epi64_avx2(v));
+    }
+    s = sum_epi64_avx2(acc);
+    return s + xor_popcount_popcnt(a, b, size);
+}
+
+/* The same word of 4 consecutive rows, one row per 64-bit lane */
+TARGET_AVX2 static __m256i load_rows_avx2(const unsigned char *p, int stride, int size)
+{
+    if (!size) return _mm256_setzero_si256();
+    return _mm256_set_epi64x(mdjvu_load_be64(p + 3 * stride, size),
+                             mdjvu_load_be64(p + 2 * stride, size),
+                             mdjvu_load_be64(p + stride, size),
+                             mdjvu_load_be64(p, size));
+}
+
+/* Rows are taken 4 at a time, each in its own lane, so that shifts
+ * and popcounts go over the whole group at once.
+ */
+TARGET_AVX2 static int xor_popcount_rows_avx2(const unsigned char *a, int a_stride, int a_len,
+                                              const unsigned char *b, int b_stride, int b_len,
+                                              int shift, int rows, int ceiling)
+{
+    const int a_size = (a_len + 7) >> 3;
+    const int b_size = (b_len + 7) >> 3;
+    const int a_len_shifted = a_len + shift;
+    const int words = ((a_len_shifted > b_len ? a_len_shifted : b_len) + 63) >> 6;
+    const __m128i right = _mm_cvtsi32_si128(shift);
+    const __m128i left = _mm_cvtsi32_si128(64 - shift); /* 64 gives zeros */
+    int s = 0;
+
+    for (; rows >= 4; rows -= 4, a += 4 * a_stride, b += 4 * b_stride)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        __m256i carry = _mm256_setzero_si256();
+        int i;
+
+        for (i = 0; i < words; i++)
+        {
+            int a_bytes = a_size - 8 * i, b_bytes = b_size - 8 * i;
+            __m256i va, vb;
+
+            a_bytes = a_bytes < 0 ? 0 : a_bytes > 8 ? 8 : a_bytes;
+            b_bytes = b_bytes < 0 ? 0 : b_bytes > 8 ? 8 : b_bytes;
+            va = load_rows_avx2(a_bytes ? a + 8 * i : a, a_stride, a_bytes);
+            vb = load_rows_avx2(b_bytes ? b + 8 * i : b, b_stride, b_bytes);
+
+            acc = _mm256_add_epi64(acc, popcount_epi64_avx2(_mm256_xor_si256(
+                      _mm256_or_si256(carry, _mm256_srl_epi64(va, right)), vb)));
+            carry = _mm256_sll_epi64(va, left);
+        }
+
+        s += sum_epi64_avx2(acc);
+        if (s > ceiling) return s;
+    }
+
+    if (rows)
+        s += xor_popcount_rows_popcnt(a, a_stride, a_len, b, b_stride, b_len,
+                                      shift, rows, ceiling - s);
+    return s;
+}
+
+TARGET_AVX2 static int xor_popcount_words_avx2(const uint64_t *a, const uint64_t *b,
+                                               int count, int shift, int ceiling)
+{
+    const __m128i right = _mm_cvtsi32_si128(shift);
+    int s = 0;
+
+    for (; count >= 8; a += 8, b += 8, count -= 8)
+    {
+        __m256i x0 = _mm256_xor_si256(
+            _mm256_srl_epi64(_mm256_loadu_si256((const __m256i *) a), right),
+            _mm256_loadu_si256((const __m256i *) b));
+        __m256i x1 = _mm256_xor_si256(
+            _mm256_srl_epi64(_mm256_loadu_si256((const __m256i *) (a + 4)), right),
+            _mm256_loadu_si256((const __m256i *) (b + 4)));
+
+        s += sum_epi64_avx2(_mm256_add_epi64(popcount_epi64_avx2(x0),
+                                             popcount_epi64_avx2(x1)));
+        if (s > ceiling) return s;
+    }
+
+    return s + xor_popcount_words_popcnt(a, b, count, shift, ceiling - s);
+}
+
+#define DEFINE_ROW_OP_AVX2(NAME, OP) \
+TARGET_AVX2 static void NAME##_avx2(unsigned char *dst, const unsigned char *src, int size) \
+{ \
+    for (; size >= 32; dst += 32, src += 32, size -= 32) \
+    { \
+        __m256i d = _mm256_loadu_si256((const __m256i *) dst); \
+        __m256i v = _mm256_loadu_si256((const __m256i *) src); \
+        _mm256_storeu_si256((__m256i *) dst, OP); \
+    } \
+    NAME##_popcnt(dst, src, size); \
+}
+
+DEFINE_ROW_OP_AVX2(or_row,   _mm256_or_si256(d, v))
+DEFINE_ROW_OP_AVX2(and_row,  _mm256_and_si256(d, v))
+DEFINE_ROW_OP_AVX2(andn_row, _mm256_andnot_si256(v, d))
+
+/* 32 pixels at a time: each of 4 packed bytes is copied to 8 bytes,
+ * and every byte keeps only its own bit.
+ */
+TARGET_AVX2 static void unpack_row_avx2(unsigned char *bytes, const unsigned char *bits,
+                                        int width, unsigned char black)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+                                            1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2,
+                                            3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit = _mm256_set1_epi64x(0x0102040810204080);
+    const __m256i fill = _mm256_set1_epi8((char) black);
+
+    for (; width >= 32; width -= 32, bits += 4, bytes += 32)
+    {
+        int32_t four;
+        __m256i v;
+        memcpy(&four, bits, 4);
+        v = _mm256_shuffle_epi8(_mm256_set1_epi32(four), spread);
+        v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bit), bit);
+        _mm256_storeu_si256((__m256i *) bytes, _mm256_and_si256(v, fill));
+    }
+    unpack_row_popcnt(bytes, bits, width, black);
+}
+
+/* 32 bytes at a time: bytes are reversed within each 8,
+ * so that the mask of nonzero ones comes out as 4 packed bytes.
+ */
+TARGET_AVX2 static void pack_row_avx2(unsigned char *bits, const unsigned char *bytes, int width)
+{
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (; width >= 32; width -= 32, bytes += 32, bits += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) bytes);
+        uint32_t four = ~(uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_shuffle_epi8(v, reverse), zero));
+        memcpy(bits, &four, 4);
+    }
+    pack_row_popcnt(bits, bytes, width);
+}
+
+#endif /* BITOPS_X86 */
+
+/* ______________________________   dispatch   _____________________________ */
+
+#define KERNEL_TABLE(TIER) \
+{ \
+    popcount_##TIER, \
+    xor_popcount_##TIER, \
+    xor_popcount_shifted_##TIER, \
+    xor_popcount_rows_##TIER, \
+    xor_popcount_words_##TIER, \
+    or_row_##TIER, \
+    and_row_##TIER, \
+    andn_row_##TIER, \
+    unpack_row_##TIER, \
+    pack_row_##TIER \
+}
+
+static const MdjvuBitOps scalar_ops = KERNEL_TABLE(scalar);
+
+#ifdef BITOPS_X86
+static const MdjvuBitOps popcnt_ops = KERNEL_TABLE(popcnt);
+
+static const MdjvuBitOps avx2_ops =
+{
+    popcount_avx2,
+    xor_popcount_avx2,
+    xor_popcount_shifted_popcnt, /* carries between words, nothing to gain */
+    xor_popcount_rows_avx2,
+    xor_popcount_words_avx2,
+    or_row_avx2,
+    and_row_avx2,
+    andn_row_avx2,
+    unpack_row_avx2,
+    pack_row_avx2
+};
+#endif
+
+MdjvuBitOps mdjvu_bitops = KERNEL_TABLE(scalar);
+
+int mdjvu_bitops_init(int max_level)
+{
+    const MdjvuBitOps *ops = &scalar_ops;
+    int level = MDJVU_BITOPS_SCALAR;
+
+#ifdef BITOPS_X86
+    __builtin_cpu_init();
+    if (max_level >= MDJVU_BITOPS_POPCNT
+     && __builtin_cpu_supports("popcnt"))
+    {
+        ops = &popcnt_ops;
+        level = MDJVU_BITOPS_POPCNT;
+
+        if (max_level >= MDJVU_BITOPS_AVX2 && __builtin_cpu_supports("avx2"))
+        {
+            ops = &avx2_ops;
+            level = MDJVU_BITOPS_AVX2;
+        }
+    }
+#else
+    (void) max_level;
+#endif
+
+    mdjvu_bitops = *ops;
+
+#ifdef BITOPS_X86
+    /* AVX2 packs 32 pixels at a time, only its tails go by bytes */
+    if (level == MDJVU_BITOPS_POPCNT && has_fast_bmi2())
+    {
+        mdjvu_bitops.unpack_row = unpack_row_bmi2;
+        mdjvu_bitops.pack_row = pack_row_bmi2;
+    }
+#endif
+    return level;
+}
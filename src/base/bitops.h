@@ -0,0 +1,201 @@
+/*
+ * bitops.h - word-level kernels over packed bitmap rows (library-internal)
+ */
+
+/* Packed rows are bit streams with the leftmost pixel in the most significant
+ * bit of the first byte. To work with them a word at a time, bytes are loaded
+ * big-endian into 64-bit words, so that shifts move pixels left and right.
+ *
+ * Single words are handled by the inline functions below.
+ * Spans of bytes go through the `mdjvu_bitops' table, which is filled
+ * by mdjvu_bitops_init() with the best variant the CPU supports.
+ */
+
+#ifndef MDJVU_BITOPS_H
+#define MDJVU_BITOPS_H
+
+#include <stdint.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <endian.h> // macros __BYTE_ORDER
+#else
+#include <stdlib.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline uint64_t mdjvu_bswap64(uint64_t val)
+{
+#if defined(__GNUC__)
+    return __builtin_bswap64(val);
+#elif defined(_MSC_VER)
+    return _byteswap_uint64(val);
+#else
+    uint64_t res = 0;
+    int i;
+    for (i = 0; i < 8; i++, val >>= 8)
+        res = (res << 8) | (val & 0xFF);
+    return res;
+#endif
+}
+
+/* Load `size' (0..8) bytes big-endian; missing low bytes are zeros. */
+static inline uint64_t mdjvu_load_be64(const unsigned char *p, int size)
+{
+    uint64_t val = 0;
+    memcpy(&val, p, size);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    val = mdjvu_bswap64(val);
+#endif
+    return val;
+}
+
+/* Store the `size' (0..8) most significant bytes of `val'. */
+static inline void mdjvu_store_be64(unsigned char *p, uint64_t val, int size)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    val = mdjvu_bswap64(val);
+#endif
+    memcpy(p, &val, size);
+}
+
+static inline int mdjvu_popcount64(uint64_t val)
+{
+#if defined(__GNUC__) && defined(__POPCNT__)
+    return __builtin_popcountll(val);
+#else
+    /* constants are 0x5555..., 0x3333..., 0x0F0F... and 0x0101... */
+    const uint64_t ones = ~(uint64_t) 0;
+    val = val - ((val >> 1) & (ones / 3));
+    val = (val & (ones / 15 * 3)) + ((val >> 2) & (ones / 15 * 3));
+    val = (val + (val >> 4)) & (ones / 255 * 15);
+    return (int) ((val * (ones / 255)) >> 56);
+#endif
+}
+
+/* Number of leading zero bits; `val' must not be zero */
+static inline int mdjvu_clz64(uint64_t val)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(val);
+#else
+    int n = 0, step;
+    for (step = 32; step; step >>= 1)
+    {
+        if (!(val >> (64 - step)))
+        {
+            n += step;
+            val <<= step;
+        }
+    }
+    return n;
+#endif
+}
+
+/* Bitmaps narrower than this have every row in a single word,
+ * so kernels over them carry no bits between words
+ */
+#define MDJVU_NARROW_WIDTH 64
+
+/* Rows padded to whole words (see mdjvu_bitmap_create_aligned()) are read
+ * and written a word at a time, with no partial word at the end.
+ * These give word `i' of such a row as a native number.
+ */
+#define MDJVU_PADDED_ROW_SIZE(WIDTH) ((((WIDTH) + 63) >> 6) << 3)
+
+static inline uint64_t mdjvu_load_word(const unsigned char *row, int i)
+{
+    return mdjvu_load_be64(row + 8 * i, 8);
+}
+
+static inline void mdjvu_store_word(unsigned char *row, int i, uint64_t val)
+{
+    mdjvu_store_be64(row + 8 * i, val, 8);
+}
+
+/* Blacken pixels x1..x2 inclusive in a packed row */
+static inline void mdjvu_fill_bits(unsigned char *row, int x1, int x2)
+{
+    unsigned char *p = row + (x1 >> 3);
+    unsigned char *last = row + (x2 >> 3);
+    unsigned char head = 0xFF >> (x1 & 7);
+    unsigned char tail = (unsigned char) (0xFF << (7 - (x2 & 7)));
+    if (p == last)
+    {
+        *p |= head & tail;
+        return;
+    }
+    *p++ |= head;
+    if (p < last)
+        memset(p, 0xFF, last - p);
+    *last |= tail;
+}
+
+typedef struct
+{
+    /* number of black pixels in `size' bytes */
+    int (*popcount)(const unsigned char *p, int size);
+
+    /* number of differing pixels in `size' bytes */
+    int (*xor_popcount)(const unsigned char *a, const unsigned char *b, int size);
+
+    /* number of pixels differing between row `a' of `a_len' pixels
+     * shifted right by `shift' (0..63) and row `b' of `b_len' pixels;
+     * the lengths may be any, and nothing past either row is read;
+     * the unused bits of their last bytes must be 0
+     */
+    int (*xor_popcount_shifted)(const unsigned char *a, int a_len,
+                                const unsigned char *b, int b_len, int shift);
+
+    /* number of pixels differing between `rows' rows of `a_len' pixels
+     * shifted right by `shift' (0..63) and `rows' rows of `b_len' pixels,
+     * `a_stride' and `b_stride' bytes apart. The sum is compared to
+     * `ceiling' after every few rows, and as soon as it exceeds it,
+     * is returned incomplete.
+     */
+    int (*xor_popcount_rows)(const unsigned char *a, int a_stride, int a_len,
+                             const unsigned char *b, int b_stride, int b_len,
+                             int shift, int rows, int ceiling);
+
+    /* sum of popcount((a[i] >> shift) ^ b[i]) over `count' words,
+     * returned early once above `ceiling' as in xor_popcount_rows
+     */
+    int (*xor_popcount_words)(const uint64_t *a, const uint64_t *b,
+                              int count, int shift, int ceiling);
+
+    /* dst |= src, dst &= src, dst &= ~src over `size' bytes */
+    void (*or_row)  (unsigned char *dst, const unsigned char *src, int size);
+    void (*and_row) (unsigned char *dst, const unsigned char *src, int size);
+    void (*andn_row)(unsigned char *dst, const unsigned char *src, int size);
+
+    /* `width' pixels of a packed row to `width' bytes, `black' or 0 */
+    void (*unpack_row)(unsigned char *bytes, const unsigned char *bits,
+                       int width, unsigned char black);
+
+    /* `width' bytes, nonzero for black, to a packed row;
+     * the bits of the last byte after the row are zeros
+     */
+    void (*pack_row)(unsigned char *bits, const unsigned char *bytes, int width);
+} MdjvuBitOps;
+
+extern MdjvuBitOps mdjvu_bitops;
+
+/* Variants of kernels, from the most portable one */
+#define MDJVU_BITOPS_SCALAR 0
+#define MDJVU_BITOPS_POPCNT 1
+#define MDJVU_BITOPS_AVX2   2
+#define MDJVU_BITOPS_BEST   2
+
+/* Select the best variant not above `max_level' that the CPU supports.
+ * Returns the level chosen. Called from mdjvu_init();
+ * until then the scalar variant is used.
+ */
+int mdjvu_bitops_init(int max_level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MDJVU_BITOPS_H */
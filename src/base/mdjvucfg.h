@@ -33,6 +33,8 @@
 
 /* #endif */
 
+#include <stddef.h>
+
 
 /**
  * Global initialization of the shared library.
@@ -44,3 +46,15 @@
  * This function is implemented in 0porting.c.
  */
 void mdjvu_init(void);
+
+
+/**
+ * Count `bytes' more memory of the given MinidjvuMemoryKind in use,
+ * or fewer, if negative. Any thread may call it.
+ *
+ * This function is implemented in 0porting.c.
+ */
+#ifdef __cplusplus
+extern "C"
+#endif
+void mdjvu_memory_count(int kind, ptrdiff_t bytes);
@@ -129,3 +129,25 @@ MDJVU_IMPLEMENT mdjvu_image_t mdjvu_load_djvu_page(const char *path, mdjvu_error
     return result;
 }
 
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_djvu_page_bitmap(mdjvu_file_t file, mdjvu_error_t *perr)
+{
+    int32 length;
+    if (!mdjvu_locate_jb2_chunk(file, &length, perr))
+        return NULL;
+    return mdjvu_file_load_jb2_bitmap(file, length, perr);
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_load_djvu_page_bitmap(const char *path, mdjvu_error_t *perr)
+{
+    mdjvu_bitmap_t result;
+    FILE *f = fopen(path, "rb");
+    if (perr) *perr = NULL;
+    if (!f)
+    {
+        if (perr) *perr = mdjvu_get_error(mdjvu_error_fopen_read);
+        return NULL;
+    }
+    result = mdjvu_file_load_djvu_page_bitmap((mdjvu_file_t) f, perr);
+    fclose(f);
+    return result;
+}
@@ -183,21 +183,15 @@ static void invert_row(unsigned char *row, int32 bytes_per_row, int32 w)
     if (!(X)) \
     { \
         if (perr) *perr = mdjvu_get_error(mdjvu_error_corrupted_bmp); \
-        return NULL; \
+        return 0; \
     } \
 }
 #define FFs 0xFFFFFF
-MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_bmp(mdjvu_file_t file, mdjvu_error_t *perr)
+/* Reads the header of a 1-bit uncompressed BMP */
+static int read_header_1bit(FILE *f, int32 *w, int32 *h, int *invert, mdjvu_error_t *perr)
 {
-    FILE *f = (FILE *) file;
-    mdjvu_bitmap_t result;
-    int32 w, h, y;
-    int32 DIB_row_size, bytes_per_row;
-    int invert;
     Header header;
 
-    if (perr) *perr = NULL;
-
     CHECK(fgetc(f)=='B');
     CHECK(fgetc(f)=='M');
     read_bmp_header(f, &header);
@@ -207,30 +201,106 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_bmp(mdjvu_file_t file, mdjvu_erro
     CHECK(((header.color_0 & FFs) == 0 && (header.color_1 & FFs) == FFs) ||
           ((header.color_1 & FFs) == 0 && (header.color_0 & FFs) == FFs ));
 
-    invert = (header.color_0 & FFs) == 0;
-    w = header.width;
-    h = header.height;
-    result = mdjvu_bitmap_create(w, h);
-    DIB_row_size = ((w + 31) & ~31) >> 3; /* padding to 32 bit */
+    *invert = (header.color_0 & FFs) == 0;
+    *w = header.width;
+    *h = header.height;
+    return 1;
+}
+#undef CHECK
+
+/* Reads a DIB row, skipping its padding to 32 bits */
+static int read_row(FILE *f, unsigned char *row, int32 bytes_per_row, int32 w, int invert)
+{
+    int32 DIB_row_size = ((w + 31) & ~31) >> 3;
+    int k;
+
+    if (fread(row, bytes_per_row, 1, f) != 1)
+        return 0;
+
+    for (k = 0; k < DIB_row_size - bytes_per_row; k++)
+        fgetc(f);
+
+    if (invert)
+        invert_row(row, bytes_per_row, w);
+    return 1;
+}
+
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_bmp(mdjvu_file_t file, mdjvu_error_t *perr)
+{
+    FILE *f = (FILE *) file;
+    mdjvu_bitmap_t result;
+    int32 w, h, y;
+    int32 bytes_per_row;
+    int invert;
+
+    if (perr) *perr = NULL;
+
+    if (!read_header_1bit(f, &w, &h, &invert, perr))
+        return NULL;
+
+    result = mdjvu_bitmap_create_aligned(w, h);
     bytes_per_row = mdjvu_bitmap_get_packed_row_size(result);
 
     for (y = h; y; y--)
     {
         unsigned char *row = mdjvu_bitmap_access_packed_row(result, y - 1);
-        int k;
-        if (fread(row, bytes_per_row, 1, f) != 1)
+        if (!read_row(f, row, bytes_per_row, w, invert))
         {
             if (perr) *perr = mdjvu_get_error(mdjvu_error_io);
             return NULL;
         }
+    }
 
-        for (k = 0; k < DIB_row_size - bytes_per_row; k++)
-            fgetc(f);
+    return result;
+}
+
+MDJVU_IMPLEMENT mdjvu_splitter_t mdjvu_file_load_bmp_split(mdjvu_file_t file, mdjvu_split_options_t opt, mdjvu_error_t *perr)
+{
+    FILE *f = (FILE *) file;
+    mdjvu_splitter_t result;
+    int32 w, h, y;
+    int32 bytes_per_row;
+    int invert;
+    unsigned char *row;
 
-        if (invert)
-            invert_row(row, bytes_per_row, w);
+    if (perr) *perr = NULL;
+
+    if (!read_header_1bit(f, &w, &h, &invert, perr))
+        return NULL;
+
+    result = mdjvu_splitter_create(w, h, opt);
+    bytes_per_row = (w + 7) >> 3;
+    row = (unsigned char *) malloc(bytes_per_row);
+
+    /* DIB rows go bottom to top */
+    for (y = h; y; y--)
+    {
+        if (!read_row(f, row, bytes_per_row, w, invert))
+        {
+            if (perr) *perr = mdjvu_get_error(mdjvu_error_io);
+            free(row);
+            mdjvu_splitter_destroy(result);
+            return NULL;
+        }
+        mdjvu_splitter_add_row(result, y - 1, row);
     }
 
+    free(row);
+    return result;
+}
+
+MDJVU_IMPLEMENT mdjvu_splitter_t mdjvu_load_bmp_split(const char *path, mdjvu_split_options_t opt, mdjvu_error_t *perr)
+{
+    FILE *f = fopen(path, "rb");
+    mdjvu_splitter_t result;
+    if (!f)
+    {
+        if (perr) *perr = mdjvu_get_error(mdjvu_error_fopen_read);
+        return NULL;
+    }
+    if (perr) *perr = NULL;
+    result = mdjvu_file_load_bmp_split((mdjvu_file_t) f, opt, perr);
+    fclose(f);
     return result;
 }
 
@@ -5,6 +5,7 @@
 #include "../base/mdjvucfg.h"
 #include <minidjvu-mod/minidjvu-mod.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 static void skip_to_the_end_of_line(FILE *file)
 {
@@ -98,19 +99,15 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_load_pbm(const char *path, mdjvu_error_t *p
 #define COMPLAIN \
 { \
     if (perr) *perr = mdjvu_get_error(mdjvu_error_corrupted_pbm); \
-    return NULL; \
+    return 0; \
 }
-MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_pbm(mdjvu_file_t f, mdjvu_error_t *perr)
+static int read_pbm_header(FILE *file, int32 *width, int32 *height, mdjvu_error_t *perr)
 {
-    FILE *file = (FILE *) f;
-    int32 width, height, bytes_per_row, i;
-    mdjvu_bitmap_t result;
-    if (perr) *perr = NULL;
     if (fgetc(file) != 'P') COMPLAIN;
     if (fgetc(file) != '4') COMPLAIN;
     mdjvu_skip_pbm_whitespace_and_comments((mdjvu_file_t) file);
     if (fscanf(file,
-        MDJVU_INT32_FORMAT" "MDJVU_INT32_FORMAT, &width, &height) != 2)
+        MDJVU_INT32_FORMAT" "MDJVU_INT32_FORMAT, width, height) != 2)
     {
         COMPLAIN;
     }
@@ -123,8 +120,32 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_pbm(mdjvu_file_t f, mdjvu_error_t
         default:
             COMPLAIN;
     }
+    return 1;
+}
+#undef COMPLAIN
+
+/* PBM doesn't define the padding bits, but they must be 0s in bitmaps */
+static void clear_margin(unsigned char *row, int32 bytes_per_row, int32 w)
+{
+    if (w & 7)
+        row[bytes_per_row - 1] &= ~(0xFF >> (w & 7));
+}
+
+#define COMPLAIN \
+{ \
+    if (perr) *perr = mdjvu_get_error(mdjvu_error_corrupted_pbm); \
+    return NULL; \
+}
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_pbm(mdjvu_file_t f, mdjvu_error_t *perr)
+{
+    FILE *file = (FILE *) f;
+    int32 width, height, bytes_per_row, i;
+    mdjvu_bitmap_t result;
+    if (perr) *perr = NULL;
+    if (!read_pbm_header(file, &width, &height, perr))
+        return NULL;
 
-    result = mdjvu_bitmap_create(width, height);
+    result = mdjvu_bitmap_create_aligned(width, height);
     bytes_per_row = mdjvu_bitmap_get_packed_row_size(result);
     for (i = 0; i < height; i++)
     {
@@ -134,6 +155,50 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_pbm(mdjvu_file_t f, mdjvu_error_t
             mdjvu_bitmap_destroy(result);
             COMPLAIN;
         }
+        clear_margin(current_row, bytes_per_row, width);
     }
     return result;
 }
+
+MDJVU_IMPLEMENT mdjvu_splitter_t mdjvu_file_load_pbm_split(mdjvu_file_t f, mdjvu_split_options_t opt, mdjvu_error_t *perr)
+{
+    FILE *file = (FILE *) f;
+    int32 width, height, bytes_per_row, i;
+    mdjvu_splitter_t result;
+    unsigned char *row;
+    if (perr) *perr = NULL;
+    if (!read_pbm_header(file, &width, &height, perr))
+        return NULL;
+
+    result = mdjvu_splitter_create(width, height, opt);
+    bytes_per_row = (width + 7) >> 3;
+    row = (unsigned char *) malloc(bytes_per_row);
+    for (i = 0; i < height; i++)
+    {
+        if (fread(row, bytes_per_row, 1, file) != 1)
+        {
+            free(row);
+            mdjvu_splitter_destroy(result);
+            COMPLAIN;
+        }
+        clear_margin(row, bytes_per_row, width);
+        mdjvu_splitter_add_row(result, i, row);
+    }
+    free(row);
+    return result;
+}
+
+MDJVU_IMPLEMENT mdjvu_splitter_t mdjvu_load_pbm_split(const char *path, mdjvu_split_options_t opt, mdjvu_error_t *perr)
+{
+    FILE *file = fopen(path, "rb");
+    mdjvu_splitter_t result;
+    if (perr) *perr = NULL;
+    if (!file)
+    {
+        if(perr) *perr = mdjvu_get_error(mdjvu_error_fopen_read);
+        return NULL;
+    }
+    result = mdjvu_file_load_pbm_split((mdjvu_file_t) file, opt, perr);
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,46 @@
+/*
+ * pgm.c - saving graymaps in PGM ("portable graymap") format
+ */
+
+#include "../base/mdjvucfg.h"
+#include <minidjvu-mod/minidjvu-mod.h>
+#include <stdio.h>
+
+MDJVU_IMPLEMENT int mdjvu_save_pgm(unsigned char **pixels, int32 width, int32 height,
+                                   const char *path, mdjvu_error_t *perr)
+{
+    FILE *file = fopen(path, "wb");
+    int result;
+    if (perr) *perr = NULL;
+    if (!file)
+    {
+        if (perr) *perr = mdjvu_get_error(mdjvu_error_fopen_write);
+        return 0;
+    }
+    result = mdjvu_file_save_pgm(pixels, width, height, (mdjvu_file_t) file, perr);
+    fclose(file);
+    return result;
+}
+
+MDJVU_IMPLEMENT int mdjvu_file_save_pgm(unsigned char **pixels, int32 width, int32 height,
+                                        mdjvu_file_t f, mdjvu_error_t *perr)
+{
+    FILE *file = (FILE *) f;
+    int32 i;
+
+    if (perr) *perr = NULL;
+
+    fprintf(file, "P5\n"MDJVU_INT32_FORMAT" "MDJVU_INT32_FORMAT"\n255\n",
+            width, height);
+
+    for (i = 0; i < height; i++)
+    {
+        if (fwrite(pixels[i], width, 1, file) != 1)
+        {
+            if (perr) *perr = mdjvu_get_error(mdjvu_error_io);
+            return 0;
+        }
+    }
+
+    return 1;
+}
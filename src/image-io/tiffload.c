@@ -15,15 +15,20 @@
 
 #ifdef HAVE_LIBTIFF
 
-static mdjvu_bitmap_t load_tiff(const char *path, int32 *presolution, mdjvu_error_t *perr, uint32 idx)
+typedef struct
 {
-    uint16 photometric;
+    TIFF *tiff;
     uint32 w, h;
-    uint16 bits_per_sample = 0, samples_per_pixel = 0;
-    float dpi;
-    mdjvu_bitmap_t result;
+    uint16 photometric;
     tsize_t scanline_size;
     unsigned char *scanline;
+} Reader;
+
+/* Opens page `idx' of a bitonal TIFF, returns 0 if failed */
+static int open_tiff(Reader *r, const char *path, int32 *presolution, mdjvu_error_t *perr, uint32 idx)
+{
+    uint16 bits_per_sample = 0, samples_per_pixel = 0;
+    float dpi;
     uint32 i;
 
     TIFF *tiff = TIFFOpen(path, "r");
@@ -37,7 +42,7 @@ static mdjvu_bitmap_t load_tiff(const char *path, int32 *presolution, mdjvu_erro
     if (!tiff || i<idx)
     {
         *perr = mdjvu_get_error(mdjvu_error_fopen_read);
-        return NULL;
+        return 0;
     }
 
     /* test if bitonal */
@@ -47,20 +52,20 @@ static mdjvu_bitmap_t load_tiff(const char *path, int32 *presolution, mdjvu_erro
     {
         *perr = mdjvu_get_error(mdjvu_error_corrupted_tiff);
         TIFFClose(tiff);
-        return NULL;
+        return 0;
     }
 
     /* photometric */
-    photometric = PHOTOMETRIC_MINISWHITE;
-    TIFFGetFieldDefaulted(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+    r->photometric = PHOTOMETRIC_MINISWHITE;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_PHOTOMETRIC, &r->photometric);
 
     /* image size */
-    if (!TIFFGetFieldDefaulted(tiff, TIFFTAG_IMAGEWIDTH, &w)
-     || !TIFFGetFieldDefaulted(tiff, TIFFTAG_IMAGELENGTH, &h))
+    if (!TIFFGetFieldDefaulted(tiff, TIFFTAG_IMAGEWIDTH, &r->w)
+     || !TIFFGetFieldDefaulted(tiff, TIFFTAG_IMAGELENGTH, &r->h))
     {
         *perr = mdjvu_get_error(mdjvu_error_corrupted_tiff);
         TIFFClose(tiff);
-        return NULL;
+        return 0;
     }
 
     /* get the resolution */
@@ -72,52 +77,103 @@ static mdjvu_bitmap_t load_tiff(const char *path, int32 *presolution, mdjvu_erro
         }
     }
 
-    result = mdjvu_bitmap_create(w, h);
-
-    scanline_size = TIFFScanlineSize(tiff);
+    r->scanline_size = TIFFScanlineSize(tiff);
 
-    if (scanline_size < mdjvu_bitmap_get_packed_row_size(result))
+    if (r->scanline_size < (tsize_t) ((r->w + 7) >> 3))
     {
         *perr = mdjvu_get_error(mdjvu_error_corrupted_tiff);
         TIFFClose(tiff);
-        mdjvu_bitmap_destroy(result);
-        return NULL;
+        return 0;
+    }
+
+    r->tiff = tiff;
+    r->scanline = (unsigned char *) malloc(r->scanline_size);
+    return 1;
+}
+
+static void close_tiff(Reader *r)
+{
+    free(r->scanline);
+    TIFFClose(r->tiff);
+}
+
+/* Reads row `i' into r->scanline in the packed row format, returns 0 if failed */
+static int read_row(Reader *r, uint32 i, mdjvu_error_t *perr)
+{
+    if (TIFFReadScanline(r->tiff, (tdata_t)r->scanline, i, 0) < 0)
+    {
+        *perr = mdjvu_get_error(mdjvu_error_corrupted_tiff);
+        return 0;
+    }
+
+    if (r->photometric != PHOTOMETRIC_MINISWHITE)
+    {
+        /* invert the row */
+        int32 k;
+        int32 s = (int32) r->scanline_size;
+        for (k = 0; k < s; k++)
+            r->scanline[k] = ~r->scanline[k];
     }
 
-    scanline = (unsigned char *) malloc(scanline_size);
+    /* clear the padding bits */
+    if (r->w & 7)
+        r->scanline[r->scanline_size - 1] &= ~(0xFF >> (r->w & 7));
+    return 1;
+}
+
+static mdjvu_bitmap_t load_tiff(const char *path, int32 *presolution, mdjvu_error_t *perr, uint32 idx)
+{
+    Reader r;
+    mdjvu_bitmap_t result;
+    uint32 i;
+
+    if (!open_tiff(&r, path, presolution, perr, idx))
+        return NULL;
+
+    result = mdjvu_bitmap_create_aligned(r.w, r.h);
 
-    for (i = 0; i < h; i++)
+    for (i = 0; i < r.h; i++)
     {
-        if (TIFFReadScanline(tiff, (tdata_t)scanline, i, 0) < 0)
+        if (!read_row(&r, i, perr))
         {
-            *perr = mdjvu_get_error(mdjvu_error_corrupted_tiff);
-            TIFFClose(tiff);
-            free(scanline);
+            close_tiff(&r);
             mdjvu_bitmap_destroy(result);
             return NULL;
         }
 
-        if (photometric != PHOTOMETRIC_MINISWHITE)
-        {
-            /* invert the row */
-            int32 k;
-            int32 s = (int32) scanline_size;
-            for (k = 0; k < s; k++)
-                scanline[k] = ~scanline[k];
-        }
-
-        /* clear the padding bits */
-        if (w & 7)
-            scanline[scanline_size - 1] &= ~(0xFF >> (w & 7));
-
         memcpy(mdjvu_bitmap_access_packed_row(result, i),
-               scanline,
+               r.scanline,
                mdjvu_bitmap_get_packed_row_size(result));
     }
 
-    free(scanline);
+    close_tiff(&r);
+    return result;
+}
+
+static mdjvu_splitter_t load_tiff_split(const char *path, int32 *presolution, mdjvu_split_options_t opt, mdjvu_error_t *perr, uint32 idx)
+{
+    Reader r;
+    mdjvu_splitter_t result;
+    uint32 i;
+
+    if (!open_tiff(&r, path, presolution, perr, idx))
+        return NULL;
+
+    result = mdjvu_splitter_create(r.w, r.h, opt);
+
+    for (i = 0; i < r.h; i++)
+    {
+        if (!read_row(&r, i, perr))
+        {
+            close_tiff(&r);
+            mdjvu_splitter_destroy(result);
+            return NULL;
+        }
+
+        mdjvu_splitter_add_row(result, i, r.scanline);
+    }
 
-    TIFFClose(tiff);
+    close_tiff(&r);
     return result;
 }
 
@@ -148,3 +204,13 @@ MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_load_tiff(const char *path, int32 *presolut
         return NULL;
     #endif
 }
+
+MDJVU_IMPLEMENT mdjvu_splitter_t mdjvu_load_tiff_split(const char *path, int32 *presolution, mdjvu_split_options_t opt, mdjvu_error_t *perr, uint32 idx)
+{
+    #ifdef HAVE_LIBTIFF
+        return load_tiff_split(path, presolution, opt, perr, idx);
+    #else
+        *perr = mdjvu_get_error(mdjvu_error_tiff_support_disabled);
+        return NULL;
+    #endif
+}
@@ -266,7 +266,8 @@ mdjvu_bitmap_t JB2BitmapDecoder::decode(mdjvu_image_t img, mdjvu_bitmap_t proto)
         int32 ph = mdjvu_bitmap_get_height(proto);
         int32 w = pw + zp.decode(symbol_width_difference);
         int32 h = ph + zp.decode(symbol_height_difference);
-        mdjvu_bitmap_t shape = mdjvu_image_new_bitmap(img, w, h);
+        mdjvu_bitmap_t shape = img ? mdjvu_image_new_bitmap(img, w, h)
+                                   : mdjvu_bitmap_create(w, h);
 
         code_image_by_refinement(shape, proto, NULL);
 
@@ -276,7 +277,8 @@ mdjvu_bitmap_t JB2BitmapDecoder::decode(mdjvu_image_t img, mdjvu_bitmap_t proto)
     {
         int32 w = zp.decode(symbol_width);
         int32 h = zp.decode(symbol_height);
-        mdjvu_bitmap_t shape = mdjvu_image_new_bitmap(img, w, h);
+        mdjvu_bitmap_t shape = img ? mdjvu_image_new_bitmap(img, w, h)
+                                   : mdjvu_bitmap_create(w, h);
 
         code_image_directly(shape, NULL);
 
@@ -46,6 +46,7 @@ class JB2BitmapCoder
 class JB2BitmapDecoder : public JB2BitmapCoder
 {
     public:
+        // the shape is added to the image, or left alone if it is NULL
         mdjvu_bitmap_t decode(mdjvu_image_t,
                               mdjvu_bitmap_t prototype = NULL);
         JB2BitmapDecoder(ZPDecoder &, ZPMemoryWatcher *w = NULL);
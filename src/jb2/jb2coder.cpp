@@ -188,11 +188,16 @@ void JB2Encoder::encode_character_position(int x, int y, int w, int h)/*{{{*/
 int32 JB2Decoder::decode_blit(mdjvu_image_t img, int32 shape_index)
 {
     mdjvu_bitmap_t shape = mdjvu_image_get_bitmap(img, shape_index);
+    int32 x, y;
+    decode_blit(shape, x, y);
+    return mdjvu_image_add_blit(img, x, y, shape);
+}
+
+void JB2Decoder::decode_blit(mdjvu_bitmap_t shape, int32 &x, int32 &y)
+{
     int32 w = mdjvu_bitmap_get_width(shape);
     int32 h = mdjvu_bitmap_get_height(shape);
-    int32 x, y;
     decode_character_position(x, y, w, h);
-    return mdjvu_image_add_blit(img, x, y, shape);
 }
 
 void JB2Encoder::encode_blit(mdjvu_image_t img, int32 blit, int32 w, int32 h)
@@ -79,6 +79,9 @@ struct JB2Decoder : JB2Coder, JB2BitmapDecoder
     // decodes character position and creates a new blit
     int32 decode_blit(mdjvu_image_t, int32 shape_index);
 
+    // same, but only returns the position
+    void decode_blit(mdjvu_bitmap_t shape, int32 &x, int32 &y);
+
     void reset(); // resets numcontexts as required by "reset" record
 
     private:
@@ -34,7 +34,7 @@ static mdjvu_bitmap_t decode_lib_shape/*{{{*/
     }
 
     int32 x, y;
-    mdjvu_bitmap_remove_margins(shape, &x, &y);
+    mdjvu_bitmap_trim_margins(shape, &x, &y);
 
     if (with_blit)
     {
@@ -45,36 +45,45 @@ static mdjvu_bitmap_t decode_lib_shape/*{{{*/
     return shape;
 }/*}}}*/
 
-#define COMPLAIN \
-{ \
-    if (perr) *perr = mdjvu_get_error(mdjvu_error_corrupted_jb2); \
-    return NULL; \
-}
-MDJVU_IMPLEMENT mdjvu_image_t mdjvu_file_load_jb2(mdjvu_file_t file, int32 length, mdjvu_error_t *perr)/*{{{*/
+// Decode the records up to the start of image and the page size.
+// Returns false if the start of image is not there.
+static bool decode_start_of_image(JB2Decoder &jb2, int32 &w, int32 &h)/*{{{*/
 {
-    if (perr) *perr = NULL;
-    FILE *f = (FILE *) file;
-    JB2Decoder jb2(f, length);
     ZPDecoder &zp = jb2.zp;
-
-    int32 d = 0;
     int32 t = jb2.decode_record_type();
 
     if (t == jb2_require_dictionary_or_reset)
     {
-        d = zp.decode(jb2.required_dictionary_size);
+        zp.decode(jb2.required_dictionary_size); /* dropped for now - XXX */
         t = jb2.decode_record_type();
     }
 
-    if (t != jb2_start_of_image) COMPLAIN;
+    if (t != jb2_start_of_image) return false;
 
-    int32 w = zp.decode(jb2.image_size);
-    int32 h = zp.decode(jb2.image_size);
+    w = zp.decode(jb2.image_size);
+    h = zp.decode(jb2.image_size);
     zp.decode(jb2.eventual_image_refinement); // dropped
     jb2.symbol_column_number.set_interval(1, w);
     jb2.symbol_row_number.set_interval(1, h);
+    return true;
+}/*}}}*/
+
+#define COMPLAIN \
+{ \
+    if (perr) *perr = mdjvu_get_error(mdjvu_error_corrupted_jb2); \
+    return NULL; \
+}
+MDJVU_IMPLEMENT mdjvu_image_t mdjvu_file_load_jb2(mdjvu_file_t file, int32 length, mdjvu_error_t *perr)/*{{{*/
+{
+    if (perr) *perr = NULL;
+    FILE *f = (FILE *) file;
+    JB2Decoder jb2(f, length);
+    ZPDecoder &zp = jb2.zp;
 
-    mdjvu_image_t img = mdjvu_image_create(w, h); /* d is dropped for now - XXX*/
+    int32 w, h, t;
+    if (!decode_start_of_image(jb2, w, h)) COMPLAIN;
+
+    mdjvu_image_t img = mdjvu_image_create(w, h);
 
     int32 lib_count = 0, lib_alloc = 128;
     mdjvu_bitmap_t *library;
@@ -185,3 +194,137 @@ MDJVU_IMPLEMENT mdjvu_image_t mdjvu_file_load_jb2(mdjvu_file_t file, int32 lengt
         } // switch
     } // while(1)
 }/*}}}*/
+
+// Decoding straight into a page {{{
+
+// Same as decode_lib_shape(), but the blit goes right into the page.
+// The shape is trimmed after its position is decoded, as there,
+// so later records see the same library.
+static mdjvu_bitmap_t decode_lib_shape_into_page/*{{{*/
+    (JB2Decoder &jb2, mdjvu_bitmap_t page, bool with_blit, mdjvu_bitmap_t proto)
+{
+    mdjvu_bitmap_t shape = jb2.decode(NULL, proto);
+    int32 x, y;
+
+    if (with_blit)
+    {
+        jb2.decode_blit(shape, x, y);
+        mdjvu_render_shape(page, shape, x, y);
+    }
+
+    mdjvu_bitmap_trim_margins(shape, &x, &y);
+    return shape;
+}/*}}}*/
+
+static void destroy_library(mdjvu_bitmap_t *library, int32 count)/*{{{*/
+{
+    for (int32 i = 0; i < count; i++)
+        mdjvu_bitmap_destroy(library[i]);
+    free(library);
+}/*}}}*/
+
+// There are no blits here: each shape is ORed into the page as soon as
+// its position is known. Shapes that are not added to the library are
+// destroyed right after that; library shapes may be referred to
+// by any later record, so they live until the end of data.
+MDJVU_IMPLEMENT mdjvu_bitmap_t mdjvu_file_load_jb2_bitmap(mdjvu_file_t file, int32 length, mdjvu_error_t *perr)/*{{{*/
+{
+    if (perr) *perr = NULL;
+    FILE *f = (FILE *) file;
+    JB2Decoder jb2(f, length);
+    ZPDecoder &zp = jb2.zp;
+
+    int32 w, h;
+    if (!decode_start_of_image(jb2, w, h)) COMPLAIN;
+
+    mdjvu_bitmap_t page = mdjvu_bitmap_create_aligned(w, h);
+
+    int32 lib_count = 0, lib_alloc = 128;
+    mdjvu_bitmap_t *library;
+
+    library = (mdjvu_bitmap_t *) malloc(lib_alloc * sizeof(mdjvu_bitmap_t));
+
+    while(1)
+    {
+        int32 t = jb2.decode_record_type();
+        mdjvu_bitmap_t match = NULL;
+
+        switch(t)
+        {
+            case jb2_matched_symbol_with_refinement_add_to_image_and_library:
+            case jb2_matched_symbol_with_refinement_add_to_library_only:
+            case jb2_matched_symbol_with_refinement_add_to_image_only:
+            case jb2_matched_symbol_copy_to_image_without_refinement:
+                if (!lib_count)
+                {
+                    mdjvu_bitmap_destroy(page);
+                    destroy_library(library, lib_count);
+                    COMPLAIN;
+                }
+                jb2.matching_symbol_index.set_interval(0, lib_count - 1);
+                match = library[zp.decode(jb2.matching_symbol_index)];
+            break;
+        }
+
+        switch(t)
+        {
+            case jb2_new_symbol_add_to_image_and_library:
+            case jb2_matched_symbol_with_refinement_add_to_image_and_library:
+                *(append_to_list<mdjvu_bitmap_t>(library, lib_count, lib_alloc))
+                 = decode_lib_shape_into_page(jb2, page, true, match);
+            break;
+            case jb2_new_symbol_add_to_library_only:
+            case jb2_matched_symbol_with_refinement_add_to_library_only:
+                *(append_to_list<mdjvu_bitmap_t>(library, lib_count, lib_alloc))
+                 = decode_lib_shape_into_page(jb2, page, false, match);
+            break;
+            case jb2_new_symbol_add_to_image_only:
+            case jb2_matched_symbol_with_refinement_add_to_image_only:
+            {
+                mdjvu_bitmap_t shape = jb2.decode(NULL, match);
+                int32 x, y;
+                jb2.decode_blit(shape, x, y);
+                mdjvu_render_shape(page, shape, x, y);
+                mdjvu_bitmap_destroy(shape);
+            }
+            break;
+            case jb2_matched_symbol_copy_to_image_without_refinement:
+            {
+                int32 x, y;
+                jb2.decode_blit(match, x, y);
+                mdjvu_render_shape(page, match, x, y);
+            }
+            break;
+            case jb2_non_symbol_data:
+            {
+                mdjvu_bitmap_t shape = jb2.decode(NULL);
+                int32 x = zp.decode(jb2.symbol_column_number) - 1;
+                int32 y = h - zp.decode(jb2.symbol_row_number);
+                mdjvu_render_shape(page, shape, x, y);
+                mdjvu_bitmap_destroy(shape);
+            }
+            break;
+
+            case jb2_require_dictionary_or_reset:
+                jb2.reset();
+            break;
+
+            case jb2_comment:
+            {
+                int32 len = zp.decode(jb2.comment_length);
+                while (len--) zp.decode(jb2.comment_octet);
+            }
+            break;
+
+            case jb2_end_of_data:
+                destroy_library(library, lib_count);
+                return page;
+            default:
+                destroy_library(library, lib_count);
+                mdjvu_bitmap_destroy(page);
+                COMPLAIN;
+        } // switch
+    } // while(1)
+}/*}}}*/
+
+// Decoding straight into a page }}}
@@ -6,210 +6,309 @@
 #include <minidjvu-mod/minidjvu-mod.h>
 #include <stdlib.h>
 #include <string.h>
-#ifndef _MSC_VER
-#include <endian.h> // macros __BYTE_ORDER
-#endif
+#include "../base/bitops.h"
 
 #define THRESHOLD 21
 
-// Generate a lookup table for 32 bit integers
-#define B2(n) n, n + 1, n + 1, n + 2
-#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
-#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
-
-// Lookup table that store the sum of bits for all uchar values
-
-const unsigned char lookuptable[256] = { B6(0), B6(1), B6(1), B6(2) };
-
-__inline unsigned char sum_s(size_t val) {
-	unsigned char* c = (unsigned char *) &val;
-	if ( sizeof (size_t) == 8 ) {
-		return lookuptable[c[0]] + lookuptable[c[1]] + lookuptable[c[2]] + lookuptable[c[3]] +
-				lookuptable[c[4]] + lookuptable[c[5]] + lookuptable[c[6]] + lookuptable[c[7]];
-	} else {
-		return lookuptable[c[0]] + lookuptable[c[1]] + lookuptable[c[2]] + lookuptable[c[3]];
-	}
+/* Returns rows of a narrow bitmap as native 64-bit words,
+ * leftmost pixel in the most significant bit (NULL for wide bitmaps).
+ */
+static uint64_t *load_narrow_rows(mdjvu_bitmap_t bitmap)
+{
+    int32 w = mdjvu_bitmap_get_width(bitmap);
+    int32 h = mdjvu_bitmap_get_height(bitmap);
+    int32 row_size = mdjvu_bitmap_get_packed_row_size(bitmap);
+    uint64_t *rows;
+    int32 i;
+
+    if (w >= MDJVU_NARROW_WIDTH) return NULL;
+
+    rows = (uint64_t *) malloc(h * sizeof(uint64_t));
+    for (i = 0; i < h; i++)
+        rows[i] = mdjvu_load_be64(mdjvu_bitmap_access_packed_row(bitmap, i), row_size);
+    return rows;
 }
 
-#if __BYTE_ORDER == __BIG_ENDIAN
-__inline size_t swap_t(size_t* val) {
-	return *val;
+/* Black pixels in rows [from, to) of a bitmap; rows are stored contiguously,
+ * and padding, if any, is zero
+ */
+static int32 popcount_rows(mdjvu_bitmap_t bitmap, int32 from, int32 to)
+{
+    if (from >= to) return 0;
+    return mdjvu_bitops.popcount(mdjvu_bitmap_access_packed_row(bitmap, from),
+                                 (to - from) * mdjvu_bitmap_get_row_stride(bitmap));
 }
-#elif __BYTE_ORDER == __LITTLE_ENDIAN
-__inline size_t swap_t(size_t val) {
-	unsigned char * a = (unsigned char *) &val;
-	unsigned char t;
-	for (unsigned int i = 0; i < (sizeof (size_t)/2); i++) {
-		t = a[i];
-		a[i] = a[sizeof (size_t) - i - 1];
-		a[sizeof (size_t) - i - 1] = t;
-	}
-	return val;
+
+static int32 popcount_words(const uint64_t *rows, int32 from, int32 to)
+{
+    int32 s = 0;
+    for (; from < to; from++)
+        s += mdjvu_popcount64(rows[from]);
+    return s;
 }
-#endif
 
-static unsigned int diff_bits_to_zero(unsigned char * a, unsigned int a_len)
+/* Counts pixels differing between the image and the prototype,
+ * centered one over another. Rows sticking out of the other bitmap
+ * are counted first, then overlapping rows go through one kernel call
+ * over the whole overlap, which gives up once the sum exceeds `ceiling'.
+ * A result above `ceiling' is only known to be above it.
+ */
+static int diff(mdjvu_bitmap_t image, const uint64_t *image_rows,
+                mdjvu_bitmap_t prototype, const uint64_t *prototype_rows,
+                int32 ceiling)
 {
-    // non-meaning bits in last bytes must be 0s
-	unsigned int res = 0;
+    int32 pw = mdjvu_bitmap_get_width (prototype);
+    int32 ph = mdjvu_bitmap_get_height(prototype);
+    int32 iw = mdjvu_bitmap_get_width (image);
+    int32 ih = mdjvu_bitmap_get_height(image);
+    int32 shift_x, shift_y, top, bottom;
+    int32 s;
 
-	const unsigned int size_of_t_len = sizeof(size_t)*8;
-	const unsigned int a_len_size_t = a_len / size_of_t_len;
-	const unsigned int a_len_tail = ((a_len % size_of_t_len) + 7) >> 3;
+    if (abs(iw - pw) > 2) return INT32_MAX;
+    if (abs(ih - ph) > 2) return INT32_MAX;
+
+    shift_x = (pw - pw/2) - (iw - iw/2); /* in fact only -1, 0 or 1 */
+    shift_y = ph/2 - ih/2;
 
-	size_t * a_s = (size_t *) a;
+    /* prototype rows [top, bottom) overlap image rows shift_y above them */
+    top = shift_y > 0 ? shift_y : 0;
+    bottom = ih + shift_y < ph ? ih + shift_y : ph;
 
-	for (unsigned int i = 0; i < a_len_size_t; i++) {
-		res += sum_s(a_s[i]);
+    if (image_rows && prototype_rows)
+    {
+        /* narrow bitmaps: every row in a single word */
+        s = popcount_words(prototype_rows, 0, top)
+          + popcount_words(prototype_rows, bottom, ph)
+          + popcount_words(image_rows, 0, top - shift_y)
+          + popcount_words(image_rows, bottom - shift_y, ih);
+        if (s > ceiling) return s;
+
+        if (shift_x < 0)
+            return s + mdjvu_bitops.xor_popcount_words(
+                prototype_rows + top, image_rows + top - shift_y,
+                bottom - top, -shift_x, ceiling - s);
+        else
+            return s + mdjvu_bitops.xor_popcount_words(
+                image_rows + top - shift_y, prototype_rows + top,
+                bottom - top, shift_x, ceiling - s);
     }
 
-	size_t val = 0;
+    s = popcount_rows(prototype, 0, top)
+      + popcount_rows(prototype, bottom, ph)
+      + popcount_rows(image, 0, top - shift_y)
+      + popcount_rows(image, bottom - shift_y, ih);
+    if (s > ceiling) return s;
 
-	memcpy(&val, a_s + a_len_size_t, a_len_tail);
-	res += sum_s(val);
-    return res;
+    // non-meaning bits in last bytes must be 0s
+    if (shift_x < 0)
+        return s + mdjvu_bitops.xor_popcount_rows(
+            mdjvu_bitmap_access_packed_row(prototype, top),
+            mdjvu_bitmap_get_row_stride(prototype), pw,
+            mdjvu_bitmap_access_packed_row(image, top - shift_y),
+            mdjvu_bitmap_get_row_stride(image), iw,
+            -shift_x, bottom - top, ceiling - s);
+    else
+        return s + mdjvu_bitops.xor_popcount_rows(
+            mdjvu_bitmap_access_packed_row(image, top - shift_y),
+            mdjvu_bitmap_get_row_stride(image), iw,
+            mdjvu_bitmap_access_packed_row(prototype, top),
+            mdjvu_bitmap_get_row_stride(prototype), pw,
+            shift_x, bottom - top, ceiling - s);
 }
 
+/* ___________________________   size index   ______________________________ */
 
-static unsigned int diff_bits_no_shift(unsigned char * a, unsigned int a_len, unsigned char * b, unsigned int b_len)
-{
-	// abs(a_len-b_len) must be < sizeof(size_t)
-    // non-meaning bits in last bytes must be 0s
-	unsigned int res = 0;
-
-	const unsigned int min_len = a_len < b_len ? a_len : b_len;
-	const unsigned int size_of_t_len = sizeof(size_t)*8;
-	const unsigned int min_len_size_t = min_len / size_of_t_len;
-	const unsigned int a_left = a_len - min_len_size_t*size_of_t_len;
-	const unsigned int b_left = b_len - min_len_size_t*size_of_t_len;
-	const unsigned int a_tail = (a_left + 7) >> 3; // may be equal to sizeof(size_t) for length 64 compared to 63 for ex.
-	const unsigned int b_tail = (b_left + 7) >> 3;
+/* diff() never matches bitmaps that differ by more than 2 pixels
+ * in width or height, so candidates are looked up by size:
+ * bitmaps of an image are sorted by (width, height, mass) and a hash table
+ * maps each (width, height) to its run in that order.
+ */
 
-	size_t * a_s = (size_t *) a;
-	size_t * b_s = (size_t *) b;
+#define SIZE_TOLERANCE 2
 
-	for (unsigned int i = 0; i < min_len_size_t; i++) {
-		res += sum_s( a_s[i] ^ b_s[i] );
-    }
+typedef struct
+{
+    int32 width, height, mass;
+    int32 index; /* of the bitmap in the image */
+} Entry;
 
-	size_t val1 = 0;
-	size_t val2 = 0;
+typedef struct
+{
+    int32 start, end; /* run in the entries, start == -1 if empty */
+} Slot;
 
-	memcpy(&val1, a_s + min_len_size_t, a_tail);
-	memcpy(&val2, b_s + min_len_size_t, b_tail);
-	res += sum_s(val1 ^ val2);
+typedef struct
+{
+    mdjvu_image_t image;
+    int32 count;
+    uint64_t **narrow_rows;
+    Entry *entries;
+    Slot *slots;
+    int32 slot_mask;
+} Library;
+
+typedef struct
+{
+    int32 mass_diff;
+    int32 key; /* dictionary bitmaps first, then bitmaps of the page */
+} Candidate;
 
-    return res;
+static uint32 hash_size(int32 w, int32 h)
+{
+    return (uint32) w * 2654435761u ^ (uint32) h * 40503u;
 }
 
+static int compare_entries(const void *p1, const void *p2)
+{
+    const Entry *e1 = (const Entry *) p1;
+    const Entry *e2 = (const Entry *) p2;
+    if (e1->width  != e2->width)  return e1->width  < e2->width  ? -1 : 1;
+    if (e1->height != e2->height) return e1->height < e2->height ? -1 : 1;
+    if (e1->mass   != e2->mass)   return e1->mass   < e2->mass   ? -1 : 1;
+    return e1->index < e2->index ? -1 : e1->index > e2->index;
+}
 
-static unsigned int diff_bits_shifted(unsigned char * a, unsigned int a_len, unsigned char * b, unsigned int b_len, unsigned int shift)
+static int compare_candidates(const void *p1, const void *p2)
 {
-	// abs(a_len-b_len) must be < sizeof(size_t)-shift
-    // shifted array must be "a", only one array is shifted
-    // non-meaning bits in last bytes must be 0s
+    const Candidate *c1 = (const Candidate *) p1;
+    const Candidate *c2 = (const Candidate *) p2;
+    if (c1->mass_diff != c2->mass_diff)
+        return c1->mass_diff < c2->mass_diff ? -1 : 1;
+    return c1->key < c2->key ? -1 : c1->key > c2->key;
+}
 
-	unsigned int res = 0;
+/* masses must be enabled in the image */
+static void library_init(Library *lib, mdjvu_image_t image)
+{
+    int32 n = mdjvu_image_get_bitmap_count(image);
+    int32 i, size = 16;
 
-	const unsigned int a_len_shifted = a_len + shift;
-	const unsigned int min_len = a_len_shifted < b_len ? a_len_shifted : b_len;
-	const unsigned int size_of_t_len = sizeof(size_t)*8;
-	const unsigned int min_len_size_t = min_len / size_of_t_len;
-	const unsigned int a_left = a_len - min_len_size_t*size_of_t_len;
-	const unsigned int b_left = b_len - min_len_size_t*size_of_t_len;
-	const unsigned int a_tail = (a_left + 7) >> 3;
-	const unsigned int b_tail = (b_left + 7) >> 3;
-	const unsigned int shift_right = size_of_t_len - shift;
+    lib->image = image;
+    lib->count = n;
+    lib->narrow_rows = (uint64_t **) malloc((n + 1) * sizeof(uint64_t *));
+    lib->entries = (Entry *) malloc((n + 1) * sizeof(Entry));
 
-	size_t * a_s = (size_t *) a;
-	size_t * b_s = (size_t *) b;
+    for (i = 0; i < n; i++)
+    {
+        mdjvu_bitmap_t bitmap = mdjvu_image_get_bitmap(image, i);
+        lib->narrow_rows[i] = load_narrow_rows(bitmap);
+        lib->entries[i].width  = mdjvu_bitmap_get_width(bitmap);
+        lib->entries[i].height = mdjvu_bitmap_get_height(bitmap);
+        lib->entries[i].mass   = mdjvu_image_get_mass(image, bitmap);
+        lib->entries[i].index  = i;
+    }
+    qsort(lib->entries, n, sizeof(Entry), compare_entries);
 
-	size_t buf = 0;
-	size_t val;
+    while (size < 2 * n) size <<= 1;
+    lib->slot_mask = size - 1;
+    lib->slots = (Slot *) malloc(size * sizeof(Slot));
+    for (i = 0; i < size; i++)
+        lib->slots[i].start = -1;
 
-	for (unsigned int i = 0; i < min_len_size_t; i++) {
-		val = swap_t(a_s[i]);
-		res += sum_s( (buf | (val >> shift)) ^ swap_t(b_s[i]) );
-		buf = val << shift_right;
+    for (i = 0; i < n; )
+    {
+        Entry *e = &lib->entries[i];
+        uint32 k = hash_size(e->width, e->height) & lib->slot_mask;
+        int32 end = i + 1;
+
+        while (end < n && lib->entries[end].width == e->width
+                       && lib->entries[end].height == e->height)
+            end++;
+
+        while (lib->slots[k].start != -1)
+            k = (k + 1) & lib->slot_mask;
+        lib->slots[k].start = i;
+        lib->slots[k].end = end;
+        i = end;
     }
+}
 
-	val = 0;
-	size_t val2 = 0;
+static void library_free(Library *lib)
+{
+    int32 i;
+    for (i = 0; i < lib->count; i++)
+        free(lib->narrow_rows[i]);
+    free(lib->narrow_rows);
+    free(lib->entries);
+    free(lib->slots);
+}
 
-	memcpy(&val, a_s+min_len_size_t, a_tail);
-	memcpy(&val2, b_s+min_len_size_t, b_tail);
-	val = swap_t(val) >> shift;
-	val2 = swap_t(val2);
-	res += sum_s( (buf | val) ^ val2);
+static Slot *library_find(Library *lib, int32 w, int32 h)
+{
+    uint32 k = hash_size(w, h) & lib->slot_mask;
 
-    return res;
+    while (lib->slots[k].start != -1)
+    {
+        Entry *e = &lib->entries[lib->slots[k].start];
+        if (e->width == w && e->height == h)
+            return &lib->slots[k];
+        k = (k + 1) & lib->slot_mask;
+    }
+    return NULL;
 }
 
-
-static int diff(mdjvu_bitmap_t image,
-                mdjvu_bitmap_t prototype,
-                int32 ceiling)
+/* Append bitmaps of close size with mass within `max_diff',
+ * taking only those with index below `limit'; keys are offset by `key_base'.
+ */
+static void library_get_candidates(Library *lib, int32 w, int32 h,
+                                   int32 mass, int32 max_diff,
+                                   int32 limit, int32 key_base,
+                                   Candidate **list, int32 *count,
+                                   int32 *allocated)
 {
-    int32 pw = mdjvu_bitmap_get_width (prototype);
-    int32 ph = mdjvu_bitmap_get_height(prototype);
-    int32 iw = mdjvu_bitmap_get_width (image);
-    int32 ih = mdjvu_bitmap_get_height(image);
-    int32 shift_x, shift_y;
-	int32 s = 0, i;
-    unsigned char *ir;
-    unsigned char *pr;
+    int32 dw, dh;
 
-    if (abs(iw - pw) > 2) return INT32_MAX;
-    if (abs(ih - ph) > 2) return INT32_MAX;
-
-    shift_x = (pw - pw/2) - (iw - iw/2); /* center favors right, always >= 0 */
-    shift_y = ph/2 - ih/2;
+    for (dw = -SIZE_TOLERANCE; dw <= SIZE_TOLERANCE; dw++)
+    for (dh = -SIZE_TOLERANCE; dh <= SIZE_TOLERANCE; dh++)
+    {
+        Slot *slot = library_find(lib, w + dw, h + dh);
+        int32 lo, hi;
 
-    int shift_pr = 0;
-    if (shift_x < 0) {
-        shift_pr = 1;
-        shift_x *= -1; // in fact only shift_x == -1 is expected
-    }
+        if (!slot) continue;
 
-    for (i = -1; i <= ph; i++)
-    {
-        int32 y = i - shift_y;
-
-        ir = (y >= 0 && y < ih) ? mdjvu_bitmap_access_packed_row(image, y) : NULL;
-        pr = (i >= 0 && i < ph) ? mdjvu_bitmap_access_packed_row(prototype, i) : NULL;
-
-        if (pr == ir)  {
-            continue;
-        } else if (!pr) {
-            s += diff_bits_to_zero(ir, iw);
-        } else if (!ir) {
-            s += diff_bits_to_zero(pr, pw);
-        } else {
-            if (!shift_x) {
-                s += diff_bits_no_shift(ir, iw, pr, pw);
-            } else {
-                if (shift_pr) {
-                    s += diff_bits_shifted(pr, pw, ir, iw, shift_x);
-                } else {
-                    s += diff_bits_shifted(ir, iw, pr, pw, shift_x);
-                }
-            }
+        /* first entry with mass >= mass - max_diff */
+        lo = slot->start; hi = slot->end;
+        while (lo < hi)
+        {
+            int32 mid = (lo + hi) / 2;
+            if (lib->entries[mid].mass < mass - max_diff)
+                lo = mid + 1;
+            else
+                hi = mid;
         }
 
-        if (s > ceiling) {
-            return s;
+        for (; lo < slot->end && lib->entries[lo].mass <= mass + max_diff; lo++)
+        {
+            Entry *e = &lib->entries[lo];
+            if (e->index >= limit) continue;
+            if (*count == *allocated)
+            {
+                *allocated <<= 1;
+                *list = (Candidate *) realloc(*list, *allocated * sizeof(Candidate));
+            }
+            (*list)[*count].mass_diff = abs(mass - e->mass);
+            (*list)[*count].key = key_base + e->index;
+            (*count)++;
         }
-
     }
-
-    return s;
 }
 
+/* ___________________________   prototype search   ________________________ */
+
+/* For every bitmap, the best prototype is the one with the least diff()
+ * among dictionary bitmaps and earlier bitmaps on the page,
+ * ties going to the dictionary and then to the lower index.
+ * Candidates are tried in order of mass difference, which bounds diff()
+ * from below, so the search stops as soon as it can't improve.
+ */
 static void find_prototypes
-	(mdjvu_image_t dict, mdjvu_image_t img)
+	(Library *dict, mdjvu_image_t img)
 {
-    int32 d = dict ? mdjvu_image_get_bitmap_count(dict) : 0;
+    int32 d = dict ? dict->count : 0;
     int32 i, n = mdjvu_image_get_bitmap_count(img);
+    int32 allocated = 64;
+    Candidate *candidates = (Candidate *) malloc(allocated * sizeof(Candidate));
+    Library page;
 
     if (!mdjvu_image_has_prototypes(img))
         mdjvu_image_enable_prototypes(img);
@@ -217,6 +316,9 @@ static void find_prototypes
         mdjvu_image_enable_substitutions(img);
     if (!mdjvu_image_has_masses(img))
         mdjvu_image_enable_masses(img); /* calculates them, not just enables */
+
+    library_init(&page, img);
+
     for (i = 0; i < n; i++)
     {
         mdjvu_bitmap_t current = mdjvu_image_get_bitmap(img, i);
@@ -224,45 +326,37 @@ static void find_prototypes
         int32 w = mdjvu_bitmap_get_width(current);
         int32 h = mdjvu_bitmap_get_height(current);
         int32 max_score = w * h * THRESHOLD / 100;
-        int32 j;
+        int32 j, count = 0;
         mdjvu_bitmap_t best_match = NULL;
+        int32 best_key = -1;
         int32 best_score = max_score;
 
-        for (j = 0; j < d; j++)
-        {
-            int32 score;
-            mdjvu_bitmap_t candidate = mdjvu_image_get_bitmap(dict, j);
-            int32 c_mass = mdjvu_image_get_mass(dict, candidate);
-            if (abs(mass - c_mass) > best_score) continue;
+        if (dict)
+            library_get_candidates(dict, w, h, mass, max_score, d, 0,
+                                   &candidates, &count, &allocated);
+        library_get_candidates(&page, w, h, mass, max_score, i, d,
+                               &candidates, &count, &allocated);
+        qsort(candidates, count, sizeof(Candidate), compare_candidates);
 
-			score = diff(current,
-                         candidate,
-                         best_score);
+        for (j = 0; j < count; j++)
+        {
+            int32 score, key = candidates[j].key;
+            Library *lib = key < d ? dict : &page;
+            int32 index = key < d ? key : key - d;
+            mdjvu_bitmap_t candidate = mdjvu_image_get_bitmap(lib->image, index);
 
-            if (score < best_score)
-            {
-                best_score = score;
-                best_match = candidate;
-                if (!score)
-                    break; /* a perfect match is found */
-            }
-        }
+            if (candidates[j].mass_diff > best_score) break;
 
-        if (best_score) for (j = 0; j < i; j++)
-        {
-            int32 score;
-            mdjvu_bitmap_t candidate = mdjvu_image_get_bitmap(img, j);
-            int32 c_mass = mdjvu_image_get_mass(img, candidate);
-            if (abs(mass - c_mass) > best_score) continue;
-			score = diff(current,
-                         candidate,
+			score = diff(current, page.narrow_rows[i],
+                         candidate, lib->narrow_rows[index],
                          best_score);
-            if (score < best_score)
+
+            if (score < best_score
+             || (best_match && score == best_score && key < best_key))
             {
                 best_score = score;
                 best_match = candidate;
-                if (!score)
-                    break; /* a perfect match is found */
+                best_key = key;
             }
         }
 
@@ -272,6 +366,8 @@ static void find_prototypes
             mdjvu_image_set_substitution(img, current, best_match);
     }
 
+    library_free(&page);
+    free(candidates);
 }
 
 MDJVU_IMPLEMENT void mdjvu_find_prototypes(mdjvu_image_t img)
@@ -286,13 +382,34 @@ MDJVU_IMPLEMENT void mdjvu_multipage_find_prototypes(mdjvu_image_t dict,
                                                      void *param)
 {
     int i;
+    int next_report = 0;
+    unsigned char *done;
+    Library lib;
 
     if (!mdjvu_image_has_masses(dict))
         mdjvu_image_enable_masses(dict); /* calculates them, not just enables */
 
+    library_init(&lib, dict);
+    done = (unsigned char *) calloc(npages ? npages : 1, 1);
+
+    /* Pages only read the dictionary and write their own artifacts,
+     * so they are searched concurrently. Results don't depend on the order;
+     * progress is still reported page by page in increasing order,
+     * as soon as all pages before are finished.
+     */
+#pragma omp parallel for schedule(dynamic, 1)
     for (i = 0; i < npages; i++)
     {
-		find_prototypes(dict, pages[i]);
-        report(param, i);
+        find_prototypes(&lib, pages[i]);
+
+#pragma omp critical (mdjvu_prototypes_report)
+        {
+            done[i] = 1;
+            while (next_report < npages && done[next_report])
+                report(param, next_report++);
+        }
     }
+
+    free(done);
+    library_free(&lib);
 }
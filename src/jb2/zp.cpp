@@ -19,6 +19,14 @@ ZPMemoryWatcher::~ZPMemoryWatcher()
 // NumContext {{{
 
 enum {numcontext_first_allocation_size = 512};
+
+// Count the memory of `allocated' nodes, see mdjvu_memory_get_current()
+static void count_nodes(int32 allocated, int sign)
+{
+    mdjvu_memory_count(mdjvu_memory_coder, sign * (ptrdiff_t) allocated
+                       * (ptrdiff_t) (sizeof(ZPBitContext) + 2 * sizeof(uint16)));
+}
+
 void ZPNumContext::init()/*{{{*/
 {
     n = 1;
@@ -33,10 +41,12 @@ ZPNumContext::ZPNumContext(int32 amin, int32 amax, ZPMemoryWatcher *w)/*{{{*/
     nodes = (ZPBitContext *) malloc(allocated * sizeof(ZPBitContext));
     left  = (uint16 *) malloc(allocated * sizeof(uint16));
     right = (uint16 *) malloc(allocated * sizeof(uint16));
+    count_nodes(allocated, 1);
     init();
 }/*}}}*/
 ZPNumContext::~ZPNumContext()/*{{{*/
 {
+    count_nodes(allocated, -1);
     free(nodes);
     free(left);
     free(right);
@@ -63,6 +73,7 @@ uint16 ZPNumContext::new_node()/*{{{*/
 {
     if (n == allocated)
     {
+        count_nodes(allocated, 1); // doubled
         allocated <<= 1;
         nodes = (ZPBitContext *) realloc(nodes, allocated * sizeof(*nodes));
         left  = (uint16 *)       realloc(left , allocated * sizeof(*left));
@@ -77,7 +88,9 @@ uint16 ZPNumContext::new_node()/*{{{*/
 }/*}}}*/
 void ZPNumContext::reset()/*{{{*/
 {
+    count_nodes(allocated, -1);
     allocated = numcontext_first_allocation_size;
+    count_nodes(allocated, 1);
     nodes = (ZPBitContext *) realloc(nodes, allocated * sizeof(ZPBitContext));
     left  = (uint16 *) realloc(left, allocated * sizeof(uint16));
     right = (uint16 *) realloc(right, allocated * sizeof(uint16));
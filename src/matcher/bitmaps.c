@@ -1,8 +1,8 @@
 #include "bitmaps.h"
+#include "../base/bitops.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
-#include <endian.h>
 
 
 unsigned char **allocate_bitmap(int w, int h)
@@ -39,6 +39,30 @@ void free_bitmap(unsigned char **p)
 }
 
 
+unsigned char **allocate_packed_bitmap(int w, int h)
+{
+    const size_t row_size = MDJVU_PADDED_ROW_SIZE(w);
+    const size_t table = (h * sizeof(unsigned char *) + 7) & ~(size_t) 7;
+    unsigned char **result = (unsigned char **)
+        calloc(1, table + row_size * h + 8 /* the spare word */);
+    unsigned char *data = (unsigned char *) result + table;
+    int i;
+
+    assert(w > 0 && h > 0);
+
+    for (i = 0; i < h; i++)
+        result[i] = data + row_size * i;
+
+    return result;
+}
+
+
+void free_packed_bitmap(unsigned char **p)
+{
+    free(p);
+}
+
+
 unsigned char **allocate_bitmap_with_margins(int w, int h)
 {
     unsigned char **result = allocate_bitmap(w + 2, h + 2);
@@ -122,59 +146,34 @@ void assign_unpacked_bitmap(unsigned char **dst, unsigned char **src, int w, int
 }
 
 
-#if __BYTE_ORDER == __BIG_ENDIAN
-inline size_t swap_t(size_t* val, int size) {
-    if (size >= sizeof (size_t))
-        return *val;
-
-    size_t res = 0;
-    memcpy(&res, val, size);
-    return res;
-}
-#elif __BYTE_ORDER == __LITTLE_ENDIAN
-inline size_t swap_t(size_t* val, unsigned int size) {
-    size_t res = 0;
-    unsigned char * a = (unsigned char *) &res;
-    memcpy(&res, val, size);
-    unsigned char t;
-    for (unsigned int i = 0; i < (sizeof (size_t)/2); i++) {
-        t = a[i];
-        a[i] = a[sizeof (size_t) - i - 1];
-        a[sizeof (size_t) - i - 1] = t;
-    }
-    return res;
-}
-#endif
-
 void assign_unpacked_bitmap_with_shift(unsigned char **dst, unsigned char **src, int w, int h, int N)
 {
-    const size_t int_len_in_bits = sizeof (size_t)*8;
+    const int int_len_in_bits = 64;
     assert(N < 8);
 
-    const size_t true_len = (w + (int_len_in_bits -1) ) / int_len_in_bits;
-    const size_t true_tail_len = (w % int_len_in_bits) ? ((w % int_len_in_bits) + 7) >> 3 : sizeof (size_t);
+    const int true_len = (w + (int_len_in_bits -1) ) / int_len_in_bits;
+    const int true_tail_len = (w % int_len_in_bits) ? ((w % int_len_in_bits) + 7) >> 3 : 8;
 
     w += N;
-    const size_t len = (w + (int_len_in_bits -1) ) / int_len_in_bits;
-    const size_t tail_len = (w % int_len_in_bits) ? ((w % int_len_in_bits) + 7) >> 3 : sizeof (size_t);
+    const int len = (w + (int_len_in_bits -1) ) / int_len_in_bits;
+    const int tail_len = (w % int_len_in_bits) ? ((w % int_len_in_bits) + 7) >> 3 : 8;
 
     for (int y = 0; y < h; y++) {
-        size_t *d_p = (size_t *) dst[y+N];
-        size_t *s_p = (size_t *) src[y];
+        unsigned char *d_p = dst[y+N];
+        unsigned char *s_p = src[y];
 
-        size_t buf = 0;
+        uint64_t buf = 0;
 
-        for (unsigned int i = 0; i < len; i++) {
-            size_t cur = 0;
+        for (int i = 0; i < len; i++) {
+            uint64_t cur = 0;
             if (i < true_len) {
-               cur = swap_t(s_p++, i==true_len-1?true_tail_len:sizeof (size_t));
+               cur = mdjvu_load_be64(s_p + 8*i, i==true_len-1?true_tail_len:8);
             }
 
-            size_t val = buf | (cur >> N);
+            uint64_t val = buf | (cur >> N);
             buf = cur << (int_len_in_bits - N);
 
-            val = swap_t(&val, /*i==len-1?tail_len:*/sizeof (size_t));
-            memcpy(d_p++, &val, (i==len-1)?tail_len:sizeof (size_t));
+            mdjvu_store_be64(d_p + 8*i, val, (i==len-1)?tail_len:8);
         }
     }
 }
@@ -280,15 +279,13 @@ void invert_bitmap_0_or_1(unsigned char **pixels, int w, int h)
 
 void invert_bitmap(unsigned char **pixels, int w, int h)
 {
-    const int int_len_in_bytes = sizeof (size_t);
-    const size_t tail_mask = (~(size_t)0) << (sizeof (size_t)*8 - (w % (sizeof (size_t)*8)));
+    const uint64_t tail_mask = (w % 64) ? (~(uint64_t)0) << (64 - (w % 64)) : 0;
 
-//    w = (w + 7) >> 3;
-    const int len = w / (int_len_in_bytes*8);
-    const int tail_len = ((w % (int_len_in_bytes*8)) + 7) >> 3;
+    const int len = w / 64;
+    const int tail_len = ((w % 64) + 7) >> 3;
 
     for (int j = 0; j < h; j++) {
-        size_t * row_i = (size_t *) pixels[j];
+        uint64_t * row_i = (uint64_t *) pixels[j];
 
         for (int i = 0; i < len; i++) {
             *row_i = ~*row_i;
@@ -296,10 +293,9 @@ void invert_bitmap(unsigned char **pixels, int w, int h)
         }
 
         if (tail_len) {
-            size_t val = swap_t(row_i, tail_len);
+            uint64_t val = mdjvu_load_be64((unsigned char *) row_i, tail_len);
             val = ~val & tail_mask;
-            val = swap_t(&val, sizeof (size_t));
-            memcpy(row_i, &val, tail_len);
+            mdjvu_store_be64((unsigned char *) row_i, val, tail_len);
         }
     }
 }
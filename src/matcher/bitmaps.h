@@ -41,6 +41,15 @@ void assign_unpacked_bitmap(unsigned char **dst, unsigned char **src, int w, int
 void assign_unpacked_bitmap_with_shift(unsigned char **dst, unsigned char **src, int w, int h, int N);
 unsigned char **copy_bitmap(unsigned char **, int w, int h);
 
+/* Allocate a packed w * h bitmap, cleared, for word-at-a-time processing.
+ * Rows are padded to whole 64-bit words and start at word boundaries,
+ * and a spare word follows the last row, so that a word may be read
+ * from any byte of any row.
+ * Free the allocated bitmap with free_packed_bitmap().
+ */
+unsigned char **allocate_packed_bitmap(int w, int h);
+void free_packed_bitmap(unsigned char **);
+
 
 
 /* Allocate a w * h bitmap with margins of 1 pixels at each side.
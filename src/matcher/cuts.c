@@ -12,6 +12,7 @@
 
 #include "../base/mdjvucfg.h"
 #include <minidjvu-mod/minidjvu-mod.h>
+#include <stdlib.h>
 #include <assert.h>
 
 
@@ -34,47 +35,99 @@
 
 typedef unsigned char byte;
 
-static int32 sum_column_gray(byte **pixels, int32 x, int32 y1, int32 y2)
+/* Running sums of an image, built in one pass and shared by all cut levels.
+ * Any row or column span is then summed in constant time.
+ * If the tables can't be allocated, spans are summed pixel by pixel.
+ */
+typedef struct
 {
-    int sum = 0, y;
-    for (y = y1; y <= y2; y++) sum += pixels[y][x];
-    return sum;
+    byte **pixels;
+    int32 width;
+    int black_and_white; /* count nonzero pixels as 1 */
+    int32 *rows;    /* height rows of (width + 1) running sums along a row */
+    int32 *columns; /* (height + 1) rows of width running sums down columns */
+} Sums;
+
+static void alloc_sums(Sums *s, byte **pixels, int32 w, int32 h, int black_and_white)
+{
+    s->pixels = pixels;
+    s->width = w;
+    s->black_and_white = black_and_white;
+    s->rows = MALLOCV(int32, h * (w + 1));
+    s->columns = MALLOCV(int32, (h + 1) * w);
+    if (!s->rows || !s->columns)
+    {
+        FREEV(s->rows);
+        FREEV(s->columns);
+        s->rows = s->columns = NULL;
+    }
 }
 
-static int32 sum_row_gray(byte *row, int32 x1, int32 x2)
+static void free_sums(Sums *s)
 {
-    int sum = 0, x, n = x2 - x1;
-    byte *p = row + x1;
-    for (x = 0; x <= n; x++) sum += p[x];
-    return sum;
+    FREEV(s->rows);
+    FREEV(s->columns);
 }
 
-static int32 sum_column_black_and_white(byte **pixels, int32 x, int32 y1, int32 y2)
+static void fill_sums(Sums *s, int32 h)
 {
-    int sum = 0, y;
-    for (y = y1; y <= y2; y++) if (pixels[y][x]) sum++;
+    int32 x, y, w = s->width;
+
+    if (!s->rows) return;
+
+    for (x = 0; x < w; x++) s->columns[x] = 0;
+
+    for (y = 0; y < h; y++)
+    {
+        byte *row = s->pixels[y];
+        int32 *r = s->rows + y * (w + 1);
+        int32 *c_up = s->columns + y * w, *c = c_up + w;
+        r[0] = 0;
+        for (x = 0; x < w; x++)
+        {
+            int32 p = s->black_and_white ? (row[x] ? 1 : 0) : row[x];
+            r[x + 1] = r[x] + p;
+            c[x] = c_up[x] + p;
+        }
+    }
+}
+
+static int32 sum_row(Sums *s, int32 y, int32 x1, int32 x2)
+{
+    int32 sum = 0, x;
+    byte *row;
+
+    if (s->rows)
+    {
+        int32 *r = s->rows + y * (s->width + 1);
+        return r[x2 + 1] - r[x1];
+    }
+
+    row = s->pixels[y];
+    for (x = x1; x <= x2; x++)
+        sum += s->black_and_white ? (row[x] ? 1 : 0) : row[x];
     return sum;
 }
 
-static int32 sum_row_black_and_white(byte *row, int32 x1, int32 x2)
+static int32 sum_column(Sums *s, int32 x, int32 y1, int32 y2)
 {
-    int sum = 0, x, n = x2 - x1;
-    byte *p = row + x1;
-    for (x = 0; x <= n; x++) if (p[x]) sum++;
+    int32 sum = 0, y;
+
+    if (s->columns)
+        return s->columns[(y2 + 1) * s->width + x] - s->columns[y1 * s->width + x];
+
+    for (y = y1; y <= y2; y++)
+        sum += s->black_and_white ? (s->pixels[y][x] ? 1 : 0) : s->pixels[y][x];
     return sum;
 }
 
-static void make_vcut(int32 a, int32 l, int32 w, int32 h, byte **pixels,
-                      byte *sig, int32 k,
-                      int32 s_row(byte *, int32, int32),
-                      int32 s_col(byte **, int32, int32, int32),
-                      int32 size);
-
-static void make_hcut(int32 a, int32 l, int32 w, int32 h,
-                      byte **pixels, byte *sig, int32 k,
-                      int32 s_row(byte *, int32, int32),
-                      int32 s_col(byte **, int32, int32, int32),
-                      int32 size)
+/* The part being cut is the rectangle (l, t) - (l + w - 1, t + h - 1). */
+
+static void make_vcut(Sums *s, int32 a, int32 l, int32 t, int32 w, int32 h,
+                      byte *sig, int32 k, int32 size);
+
+static void make_hcut(Sums *s, int32 a, int32 l, int32 t, int32 w, int32 h,
+                      byte *sig, int32 k, int32 size)
 {
     int32 cut = 0; /* how many rows are in the top part */
     int32 up_weight = 0;
@@ -89,7 +142,7 @@ static void make_hcut(int32 a, int32 l, int32 w, int32 h,
 
         while ((up_weight << 1) < a)
         {
-            last_row_weight = s_row(pixels[cut], l, l + w - 1);
+            last_row_weight = sum_row(s, t + cut, l, l + w - 1);
             up_weight += last_row_weight;
             cut++;
         }
@@ -110,15 +163,12 @@ static void make_hcut(int32 a, int32 l, int32 w, int32 h,
         sig[k] = 128;
     }
 
-    make_vcut(up_weight, l, w, cut, pixels, sig, k << 1, s_row, s_col, size);
-    make_vcut(a - up_weight, l, w, h - cut, pixels + cut, sig, (k << 1) | 1, s_row, s_col, size);
+    make_vcut(s, up_weight, l, t, w, cut, sig, k << 1, size);
+    make_vcut(s, a - up_weight, l, t + cut, w, h - cut, sig, (k << 1) | 1, size);
 }
 
-static void make_vcut(int32 a, int32 l, int32 w, int32 h,
-                      byte **pixels, byte *sig, int32 k,
-                      int32 s_row(byte *, int32, int32),
-                      int32 s_col(byte **, int32, int32, int32),
-                      int32 size)
+static void make_vcut(Sums *s, int32 a, int32 l, int32 t, int32 w, int32 h,
+                      byte *sig, int32 k, int32 size)
 {
     int32 cut = 0;          /* how many columns are in the left part */
     int32 left_weight = 0;
@@ -133,7 +183,7 @@ static void make_vcut(int32 a, int32 l, int32 w, int32 h,
 
         while ((left_weight << 1) < a)
         {
-            last_col_weight = s_col(pixels, l + cut, 0, h-1);
+            last_col_weight = sum_column(s, l + cut, t, t + h - 1);
             left_weight += last_col_weight;
             cut++;
         }
@@ -153,33 +203,83 @@ static void make_vcut(int32 a, int32 l, int32 w, int32 h,
         sig[k] = 128;
     }
 
-    make_hcut(left_weight, l, cut, h, pixels, sig, k << 1, s_row, s_col, size);
-    make_hcut(a - left_weight, l + cut, w - cut, h, pixels, sig, (k << 1) | 1, s_row, s_col, size);
+    make_hcut(s, left_weight, l, t, cut, h, sig, k << 1, size);
+    make_hcut(s, a - left_weight, l + cut, t, w - cut, h, sig, (k << 1) | 1, size);
 }
 
-static void get_signature(int32 width, int32 height, byte **pixels, byte *sig,
-            int32 s_row(byte *, int32, int32),
-            int32 s_col(byte **, int32, int32, int32),
-            int32 size)
+static int32 get_total(Sums *s, int32 width, int32 height)
 {
     int32 area = 0, i;
     for (i = 0; i < height; i++)
     {
-        area += s_row(pixels[i], 0, width - 1);
+        area += sum_row(s, i, 0, width - 1);
     }
+    return area;
+}
+
+static void get_signature(Sums *s, int32 width, int32 height,
+                          byte *sig, int32 size)
+{
     /* FIXME: sig[0] is wasted */
-    make_hcut(area, 0, width, height, pixels, sig, 1, s_row, s_col, size);
+    make_hcut(s, get_total(s, width, height), 0, 0, width, height, sig, 1, size);
 }
 
 MDJVU_IMPLEMENT void mdjvu_get_gray_signature(byte **data, int32 w, int32 h,
                                               byte *result, int32 size)
 {
-    get_signature(w, h, data, result, sum_row_gray, sum_column_gray, size);
+    Sums s;
+    alloc_sums(&s, data, w, h, 0);
+    fill_sums(&s, h);
+    get_signature(&s, w, h, result, size);
+    free_sums(&s);
 }
 
 MDJVU_IMPLEMENT void mdjvu_get_black_and_white_signature
                                         (byte **data, int32 w, int32 h,
                                               byte *result, int32 size)
 {
-    get_signature(w, h, data, result, sum_row_black_and_white, sum_column_black_and_white, size);
+    Sums s;
+    alloc_sums(&s, data, w, h, 1);
+    fill_sums(&s, h);
+    get_signature(&s, w, h, result, size);
+    free_sums(&s);
+}
+
+MDJVU_IMPLEMENT void mdjvu_get_pattern_features(byte **data, int32 w, int32 h,
+                                                int32 *mass_center_x,
+                                                int32 *mass_center_y,
+                                                byte *gray_signature,
+                                                byte *black_and_white_signature,
+                                                int32 size)
+{
+    /* all these are exact integers, so the mass center
+     * comes out the same as with per-pixel double accumulation
+     */
+    double x_sum = 0, y_sum = 0, mass = 0;
+    int32 i;
+    Sums gray, bw;
+
+    alloc_sums(&gray, data, w, h, 0);
+    fill_sums(&gray, h);
+
+    for (i = 0; i < h; i++)
+    {
+        int32 row_mass = sum_row(&gray, i, 0, w - 1);
+        y_sum += (double) row_mass * i;
+        mass  += row_mass;
+    }
+    for (i = 0; i < w; i++)
+        x_sum += (double) sum_column(&gray, i, 0, h - 1) * i;
+
+    *mass_center_x = (int32) (x_sum * MDJVU_CENTER_QUANT / mass);
+    *mass_center_y = (int32) (y_sum * MDJVU_CENTER_QUANT / mass);
+
+    get_signature(&gray, w, h, gray_signature, size);
+    free_sums(&gray);
+
+    /* one pair of tables at a time */
+    alloc_sums(&bw, data, w, h, 1);
+    fill_sums(&bw, h);
+    get_signature(&bw, w, h, black_and_white_signature, size);
+    free_sums(&bw);
 }
@@ -10,12 +10,12 @@
 #include "../base/mdjvucfg.h"
 #include <minidjvu-mod/minidjvu-mod.h>
 #include "bitmaps.h"
+#include "../base/bitops.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <endian.h>
 
 #define TIMES_TO_THIN 1
 #define TIMES_TO_THICKEN 1
@@ -378,106 +378,85 @@ static int shiftdiff_equivalence(byte *s1, byte *s2, double falloff, double veto
 #endif
 /* shift signature comparison }}} */
 
-/* Finding mass center {{{ */
 
-static void get_mass_center(unsigned char **pixels, int32 w, int32 h,
-                     int32 *pmass_center_x, int32 *pmass_center_y)
+/* Thinning and thickening work in bitmaps from allocate_packed_bitmap(),
+ * so their rows are processed a word at a time with no partial words
+ * at the end; the results are kept with tight rows, see tight_copy().
+ * Narrow rows go through sweep_narrow().
+ */
+static void sweep_narrow(unsigned char **pixels, unsigned char **source, int w, int h)
 {
-    double x_sum = 0, y_sum = 0, mass = 0;
-    int32 i, j;
-
-    for (i = 0; i < h; i++)
-    {
-        unsigned char *row = pixels[i];
-        for (j = 0; j < w; j++)
-        {
-            unsigned char pixel = row[j];
-            x_sum += pixel * j;
-            y_sum += pixel * i;
-            mass  += pixel;
-        }
-    }
+    const uint64_t last_mask = ~(uint64_t)0 << (64 - w);
+    uint64_t *rows = (uint64_t *) malloc(h * sizeof(uint64_t));
+    int y;
 
-    *pmass_center_x = (int32) (x_sum * MDJVU_CENTER_QUANT / mass);
-    *pmass_center_y = (int32) (y_sum * MDJVU_CENTER_QUANT / mass);
-}
-
-/* Finding mass center }}} */
-
-
-#if __BYTE_ORDER == __BIG_ENDIAN
-inline size_t swap_t(size_t* val, int size) {
-    if (size >= sizeof (size_t))
-        return *val;
+    for (y = 0; y < h; y++)
+        rows[y] = mdjvu_load_word(source[y], 0);
 
-    size_t res = 0;
-    memcpy(&res, val, size);
-    return res;
-}
-#elif __BYTE_ORDER == __LITTLE_ENDIAN
-inline size_t swap_t(size_t* val, unsigned int size) {
-    size_t res_buf = 0;
-    memcpy(&res_buf, val, size);
-
-    unsigned char * a = (unsigned char *) &res_buf;
-    for (unsigned int i = 0; i < (sizeof (size_t)/2); i++) {
-        unsigned char t = a[i];
-        a[i] = a[sizeof (size_t) - i - 1];
-        a[sizeof (size_t) - i - 1] = t;
+    for (y = 0; y < h; y++) {
+        uint64_t t = rows[y];
+        uint64_t res = (t << 1) | t | (t >> 1);
+        if (y > 0)     res |= rows[y-1];
+        if (y + 1 < h) res |= rows[y+1];
+        mdjvu_store_word(pixels[y], 0, res & last_mask);
     }
-    return res_buf;
+
+    free(rows);
 }
-#endif
 
 static void sweep(unsigned char **pixels, unsigned char **source, int w, int h)
 {
     /* pretty same implementation as in mdjvu_smooth() */
 
-    const size_t int_len_in_bits = sizeof (size_t)*8;
-    const size_t len = (w + (int_len_in_bits -1) ) / int_len_in_bits;
-    const size_t tail_len = (w % int_len_in_bits) ? ((w % int_len_in_bits) + 7) >> 3 : sizeof (size_t);
+    const int int_len_in_bits = 64;
+    const int len = (w + (int_len_in_bits -1) ) / int_len_in_bits;
+    const uint64_t last_mask = (~(uint64_t)0) << (len * int_len_in_bits - w);
+
+    const uint64_t mask1 = (~(uint64_t)0x0) << 1; //0b11111..110
+    const uint64_t mask2 = (uint64_t)0x01 << (int_len_in_bits-1); //0b100000.00
+    const uint64_t mask3 = mask2 >> 1; //0b01000..00
+    const uint64_t mask4 = mask3 >> 1; //0b00100..00
+    const uint64_t mask5 = mask1 & ~mask2; //0b01111..10
 
-    const size_t mask1 = (~(size_t)0x0) << 1; //0b11111..110
-    const size_t mask2 = (size_t)0x01 << (int_len_in_bits-1); //0b100000.00
-    const size_t mask3 = mask2 >> 1; //0b01000..00
-    const size_t mask4 = mask3 >> 1; //0b00100..00
-    const size_t mask5 = mask1 & ~mask2; //0b01111..10
+    if (w < MDJVU_NARROW_WIDTH) {
+        sweep_narrow(pixels, source, w, h);
+        return;
+    }
 
     for (int y = 0; y < h; y++) {
-        size_t *r_p = (size_t *) pixels[y]; /* result    */
-        size_t *u_p = (y > 0) ? (size_t *) source[y-1] : NULL;
-        size_t *t_p = (size_t *) source[y];
-        size_t *l_p = (y+1 < h) ? (size_t *) source[y+1] : NULL;
-
-        size_t u_buf = 0, t_buf = 0, l_buf = 0;
-        size_t u_val = 0, t_val = 0, l_val = 0;
-        size_t u_cur = 0, t_cur = 0, l_cur = 0;
-
-        for (unsigned int i = 0; i < len; i++) {
-            if (u_p) {
-                u_cur = swap_t(u_p++, i==len-1?tail_len:sizeof (size_t));
+        unsigned char *r = pixels[y]; /* result    */
+        unsigned char *u = (y > 0) ? source[y-1] : NULL;
+        unsigned char *t = source[y];
+        unsigned char *l = (y+1 < h) ? source[y+1] : NULL;
+
+        uint64_t u_buf = 0, t_buf = 0, l_buf = 0;
+        uint64_t u_val = 0, t_val = 0, l_val = 0;
+        uint64_t u_cur = 0, t_cur = 0, l_cur = 0;
+
+        for (int i = 0; i < len; i++) {
+            if (u) {
+                u_cur = mdjvu_load_word(u, i);
                 u_val = u_buf | (u_cur >> 2);
                 u_buf = u_cur << (int_len_in_bits - 2);
             }
-            if (l_p) {
-                l_cur = swap_t(l_p++, i==len-1?tail_len:sizeof (size_t));
+            if (l) {
+                l_cur = mdjvu_load_word(l, i);
                 l_val = l_buf | (l_cur >> 2);
                 l_buf = l_cur << (int_len_in_bits - 2);
             }
 
-            t_cur = swap_t(t_p++, i==len-1?tail_len:sizeof (size_t));
+            t_cur = mdjvu_load_word(t, i);
             t_val = t_buf | (t_cur >> 2);
             t_buf = t_cur << (int_len_in_bits - 2);
 
-            size_t res = u_val | (t_val << 1) | t_val | (t_val >> 1) | l_val;
+            uint64_t res = u_val | (t_val << 1) | t_val | (t_val >> 1) | l_val;
 
-            size_t tail = res & mask3;
-            size_t head = res & mask4;
+            uint64_t tail = res & mask3;
+            uint64_t head = res & mask4;
 
             if (tail && i) {
                 // for i == 0 tail is always false and this is not called
-                // we access last byte instead of size_t* to not mess with int endiannes
-                *(((unsigned char *)r_p)-1) |= 1; // last bit is always 0 bcs of mask5
+                r[8*i - 1] |= 1; // last bit is always 0 bcs of mask5
             }
 
 
@@ -485,27 +464,42 @@ static void sweep(unsigned char **pixels, unsigned char **source, int w, int h)
 
             if (i != len-1) {
                 res &= mask5;
+            } else {
+                res &= last_mask;
             }
 
             if (head) {
                 res |= mask2;
             }
 
-            res = swap_t(&res, /*i==len-1?-1*tail_len:*/sizeof (size_t));
-            memcpy(r_p++, &res, (i==len-1)?tail_len:sizeof (size_t));
+            mdjvu_store_word(r, i, res);
         }
     }
 
 }
 
-static unsigned char **quick_thin(unsigned char **pixels, int w, int h, int N)
+/* Copy a bitmap from allocate_packed_bitmap() into one with tight rows
+ * and free it. Patterns keep their pith2 bitmaps for long, and padding
+ * letter rows to words would take about twice the memory.
+ */
+static unsigned char **tight_copy(unsigned char **padded, int w, int h)
 {
-    const int row_size = (w+7) >> 3;
+    const int row_size = (w + 7) >> 3;
+    unsigned char **result = mdjvu_create_2d_array(row_size, h);
+    int y;
+
+    for (y = 0; y < h; y++)
+        memcpy(result[y], padded[y], row_size);
+
+    free_packed_bitmap(padded);
+    return result;
+}
 
-    unsigned char **aux = mdjvu_create_2d_array(row_size, h);
-    memcpy(aux[0], pixels[0], row_size*h);
-    unsigned char **buf = mdjvu_create_2d_array(row_size, h);
-    memset(buf[0], 0, row_size*h);
+static unsigned char **quick_thin(unsigned char **pixels, int w, int h, int N)
+{
+    unsigned char **aux = allocate_packed_bitmap(w, h);
+    assign_unpacked_bitmap(aux, pixels, w, h);
+    unsigned char **buf = allocate_packed_bitmap(w, h);
 
     invert_bitmap(aux, w, h);
 
@@ -519,8 +513,8 @@ static unsigned char **quick_thin(unsigned char **pixels, int w, int h, int N)
 
     invert_bitmap(buf, w, h);
 
-    mdjvu_destroy_2d_array(aux);
-    return buf;
+    free_packed_bitmap(aux);
+    return tight_copy(buf, w, h);
 }
 
 static unsigned char **quick_thicken(unsigned char **pixels, int w, int h, int N)
@@ -528,13 +522,9 @@ static unsigned char **quick_thicken(unsigned char **pixels, int w, int h, int N
     int r_w = w + N * 2;
     int r_h = h + N * 2;
 
-    const int row_size = (r_w+7) >> 3;
-
-    unsigned char **aux = mdjvu_create_2d_array(row_size, r_h);
-    memset(aux[0], 0, row_size*r_h);
+    unsigned char **aux = allocate_packed_bitmap(r_w, r_h);
     assign_unpacked_bitmap_with_shift(aux, pixels, w, h, N);
-    unsigned char **buf = mdjvu_create_2d_array(row_size, r_h);
-    memset(buf[0], 0, row_size*r_h);
+    unsigned char **buf = allocate_packed_bitmap(r_w, r_h);
 
 
     while (N--)
@@ -545,8 +535,8 @@ static unsigned char **quick_thicken(unsigned char **pixels, int w, int h, int N
         }
     }
 
-    mdjvu_destroy_2d_array(aux);
-    return buf;
+    free_packed_bitmap(aux);
+    return tight_copy(buf, r_w, r_h);
 }
 
 
@@ -633,6 +623,8 @@ mdjvu_pattern_t mdjvu_pattern_create(mdjvu_matcher_options_t opt, mdjvu_bitmap_t
     if (enforce_lossless) {
         img->pixels = img->pith2_inner = img->pith2_outer = NULL;
         img->mass = img->mass_center_x = img->mass_center_y = 0;
+        img->width = img->height = 0;
+        mdjvu_memory_count(mdjvu_memory_patterns, sizeof(Image));
         return (mdjvu_pattern_t) img;
     }
     
@@ -647,13 +639,10 @@ mdjvu_pattern_t mdjvu_pattern_create(mdjvu_matcher_options_t opt, mdjvu_bitmap_t
 
     mdjvu_soften_pattern(img->pixels, img->pixels, w, h);
 
-    get_mass_center(img->pixels, w, h,
-                    &img->mass_center_x, &img->mass_center_y);
-    mdjvu_get_gray_signature(img->pixels, w, h,
-                             img->signature, SIGNATURE_SIZE);
-
-    mdjvu_get_black_and_white_signature(img->pixels, w, h,
-                                        img->signature2, SIGNATURE_SIZE);
+    mdjvu_get_pattern_features(img->pixels, w, h,
+                               &img->mass_center_x, &img->mass_center_y,
+                               img->signature, img->signature2,
+                               SIGNATURE_SIZE);
 
     //  the !m_opt->aggression is interpreted as lossless now
     // if (!m_opt->aggression)
@@ -709,6 +698,8 @@ mdjvu_pattern_t mdjvu_pattern_create(mdjvu_matcher_options_t opt, mdjvu_bitmap_t
         img->pith2_outer = NULL;
     }
 
+    mdjvu_memory_count(mdjvu_memory_patterns,
+                       mdjvu_pattern_mem_size((mdjvu_pattern_t) img));
     return (mdjvu_pattern_t) img;
 }
 #endif
@@ -722,28 +713,13 @@ MDJVU_IMPLEMENT void mdjvu_pattern_get_center(mdjvu_pattern_t p, int32 *cx, int3
 }
 
 
-// Generate a lookup table for 8 bit integers
-#define B2(n) n, n + 1, n + 1, n + 2
-#define B4(n) B2(n), B2(n + 1), B2(n + 1), B2(n + 2)
-#define B6(n) B4(n), B4(n + 1), B4(n + 1), B4(n + 2)
-
-// Lookup table that store the sum of bits for all uchar values
-
-const unsigned char lookup_table[256] = { B6(0), B6(1), B6(1), B6(2) };
-
-
-inline int32 pith2_calc_val(size_t val) {
-    unsigned char* v = (unsigned char*) &val;
-    int32 s = 0;
-    for (int i = 0; i < sizeof(size_t); i++)
-        s += lookup_table[v[i]];
-    return s;
-}
-
-inline size_t pith2_row_subset_op(size_t val_a, size_t val_b, char inverted) {
+static inline uint64_t pith2_row_subset_op(uint64_t val_a, uint64_t val_b, char inverted) {
     return (inverted)    ?    val_b & ~val_a    :    val_a & ~val_b;
 }
 
+/* Rows are tight, so the last word of a span is loaded only as far as
+ * the span goes; the bits past its end are masked out.
+ */
 static int32 pith2_row_subset(byte *A, int32 pos_a, byte *B, int32 pos_b, int32 w)
 {
     A += pos_a / 8; pos_a %= 8;
@@ -756,63 +732,43 @@ static int32 pith2_row_subset(byte *A, int32 pos_a, byte *B, int32 pos_b, int32
         inv = 1;
     }
 
-    const int size_t_len_bits = sizeof(size_t)*8;
+    const int word_len_bits = 64;
     const unsigned char shift_right = pos_a - pos_b; // shift_right is < 8
 
-    const size_t mask = ~(size_t)0;
-    const size_t start_mask = mask >> pos_a;
-    const size_t end_mask   = mask << (size_t_len_bits - ( (pos_a + w) % size_t_len_bits)) % size_t_len_bits;
+    const uint64_t mask = ~(uint64_t)0;
+    const uint64_t start_mask = mask >> pos_a;
+    const uint64_t end_mask   = mask << (word_len_bits - ( (pos_a + w) % word_len_bits)) % word_len_bits;
 
-    int len_a = (pos_a + w) / size_t_len_bits;
-    int len_b = (pos_b + w) / size_t_len_bits;
-    int tail_a = (((pos_a + w) % size_t_len_bits) + 7) >> 3;
-    int tail_b = (((pos_b + w) % size_t_len_bits) + 7) >> 3;
-    if (!tail_a) {
-        len_a--; tail_a = sizeof(size_t);
-    }
-    if (!tail_b) {
-        len_b--; tail_b = sizeof(size_t);
-    }
-
-    size_t * a = (size_t *) A;
-    size_t * b = (size_t *) B;
+    /* B's span ends no later than A's one, pos_b <= pos_a */
+    const int words = (pos_a + w + word_len_bits - 1) / word_len_bits;
+    const int bytes_a = (pos_a + w + 7) >> 3;
+    const int bytes_b = (pos_b + w + 7) >> 3;
 
-    size_t val_a, val_b, buf = 0;
+    uint64_t val_a, val_b, buf = 0;
 
-    int first = 1;
     int32 s = 0;
-    while (len_a >= 0) { // len_a >= len_b
-        if (len_a > 0) {
-            val_a = swap_t(a++, sizeof(size_t));
-        } else if (len_a == 0 && tail_a) {
-            val_a = swap_t(a, tail_a);
-        } else val_a = 0;
-
-        if (len_b > 0) {
-            val_b = swap_t(b++, sizeof(size_t));
-        } else if (len_b == 0 && tail_b) {
-            val_b = swap_t(b, tail_b);
-        } else val_b = 0;
+    for (int i = 0; i < words; i++) {
+        const int size_a = bytes_a - 8*i;
+        const int size_b = bytes_b - 8*i;
+        val_a = mdjvu_load_be64(A + 8*i, size_a < 8 ? size_a : 8);
+        val_b = size_b > 0 ? mdjvu_load_be64(B + 8*i, size_b < 8 ? size_b : 8) : 0;
 
         if (shift_right) {
-            size_t t = val_b << (size_t_len_bits - shift_right);
+            uint64_t t = val_b << (word_len_bits - shift_right);
             val_b = buf | (val_b >> shift_right);
             buf = t;
         }
 
-        size_t val =  pith2_row_subset_op(val_a, val_b, inv);
+        uint64_t val =  pith2_row_subset_op(val_a, val_b, inv);
 
-        if (first) {
+        if (i == 0) {
             val &= start_mask;
-            first = 0;
         }
-        if (len_a == 0) {
+        if (i == words - 1) {
             val &= end_mask;
         }
 
-        len_a--; len_b--;
-
-        s += pith2_calc_val( val );
+        s += mdjvu_popcount64( val );
     }
 
 //    if (!(len_a+len_b)) {
@@ -872,14 +828,12 @@ static int32 pith2_row_has_black(byte *row, int32 start_idx, int32 length)
     const int32 len = ((start_idx + length + 7) >> 3) - 1;
 
     if (len) {
-        int32 i, s = lookup_table[row[0] & start_mask];
-        for (i = 1; i < len; i++) {
-            s += lookup_table[row[i]];
-        }
-        s += lookup_table[row[len] & end_mask];
+        int32 s = mdjvu_popcount64(row[0] & start_mask);
+        s += mdjvu_bitops.popcount(row + 1, len - 1);
+        s += mdjvu_popcount64(row[len] & end_mask);
         return s * 255;
     }
-    return lookup_table[*row & start_mask & end_mask] * 255;
+    return mdjvu_popcount64(*row & start_mask & end_mask) * 255;
 }
 
 static int32 pith2_row_subset_old(byte *A, byte *B, int32 length)
@@ -1139,15 +1093,20 @@ MDJVU_IMPLEMENT int mdjvu_pattern_mem_size(mdjvu_pattern_t p)
    int res = sizeof(Image);
    if (img->pixels) res += img->width * img->height + size_of_pointers_map;
 
-   const int row_size = (img->width + 7) >> 3;
-   if (img->pith2_inner) res += row_size * img->height + size_of_pointers_map;
-   if (img->pith2_outer) res += row_size * img->height + size_of_pointers_map;
+   const int outer_width  = img->width  + TIMES_TO_THICKEN*2;
+   const int outer_height = img->height + TIMES_TO_THICKEN*2;
+   if (img->pith2_inner)
+       res += ((img->width + 7) >> 3) * img->height + size_of_pointers_map;
+   if (img->pith2_outer)
+       res += ((outer_width + 7) >> 3) * outer_height
+            + outer_height * sizeof(unsigned char *);
    return res;
 }
 
 MDJVU_IMPLEMENT void mdjvu_pattern_destroy(mdjvu_pattern_t p)/*{{{*/
 {
     Image *img = (Image *) p;
+    mdjvu_memory_count(mdjvu_memory_patterns, -mdjvu_pattern_mem_size(p));
     if (img->pixels)
         free_bitmap(img->pixels);
 
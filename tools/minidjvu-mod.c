@@ -70,6 +70,7 @@ static void show_usage_and_exit(void)           /* {{{ */
     printf(_("    -c, --clean:                   remove small black pieces\n"));
     printf(_("    -d <n>, --dpi <n>:             set resolution in dots per inch\n"));
     printf(_("    -e, --erosion:                 sacrifice quality to gain in size\n"));
+    printf(_("    -f, --footprint:               print memory taken by each stage\n"));
     printf(_("    -i, --indirect:                generate an indirect multipage document\n"));
     printf(_("    -j, --jb2:                     save pages as jb2 chunks instead of djvu.\n"));
     printf(_("                                   implies indirect mode.\n"));
@@ -78,6 +79,8 @@ static void show_usage_and_exit(void)           /* {{{ */
     printf(_("    -n, --no-prototypes:           do not search for prototypes\n"));
     printf(_("    -p <n>, --pages-per-dict <n>:  pages per dictionary (default 10)\n"));
     printf(_("    -r, --report:                  report multipage coding progress\n"));
+    printf(_("    -R <n>, --Reduce <n>:          save a graymap n times smaller\n"));
+    printf(_("                                   (when saving to a .pgm file)\n"));
     printf(_("    -s, --smooth:                  remove some bad-looking pixels\n"));
     printf(_("    -S <settings-file>:            read document settings from <settings-file>.\n"));
     printf(_("                                   <settings-file> must be a .txt file.\n"));
@@ -122,6 +125,11 @@ static int decide_if_pbm(const char *path)
 {
     return mdjvu_ends_with_ignore_case(path, ".pbm");
 }
+
+static int decide_if_pgm(const char *path)
+{
+    return mdjvu_ends_with_ignore_case(path, ".pgm");
+}
 /* ========================================================================= */
 
 static mdjvu_image_t load_image(const char *path)
@@ -145,6 +153,30 @@ static mdjvu_image_t load_image(const char *path)
     return image;
 }
 
+/* Same as mdjvu_render(load_image(path)), but the page is rendered
+ * while it is decoded, so no image is kept.
+ */
+static mdjvu_bitmap_t load_and_render(const char *path)
+{
+    mdjvu_error_t error;
+    mdjvu_bitmap_t bitmap;
+
+    if (options.verbose) printf(_("loading a DjVu page from `%s'\n"), path);
+    bitmap = mdjvu_load_djvu_page_bitmap(path, &error);
+    if (!bitmap)
+    {
+        fprintf(stderr, "%s: %s\n", path, mdjvu_get_error_message(error));
+        exit(1);
+    }
+    if (options.verbose)
+    {
+        printf(_("bitmap %d x %d rendered\n"),
+               mdjvu_bitmap_get_width(bitmap),
+               mdjvu_bitmap_get_height(bitmap));
+    }
+    return bitmap;
+}
+
 static mdjvu_matcher_options_t get_matcher_options(struct DjbzOptions* djbz)
 {
     mdjvu_matcher_options_t m_options = NULL;
@@ -159,6 +191,45 @@ static mdjvu_matcher_options_t get_matcher_options(struct DjbzOptions* djbz)
     return m_options;
 }
 
+/* Print the memory taken by the library now and at most since the last
+ * report, that is, during the stage that has just ended.
+ * The peaks are for the whole process, so while Djbz groups run in parallel
+ * a group prints only what is taken now; the peaks of all groups together
+ * are printed and reset after the groups are done.
+ */
+static void report_group_memory(const char *stage, const struct DjbzOptions *djbz)
+{
+    int kind;
+    int peaks = 1;
+    if (!options.footprint) return;
+
+#ifdef _OPENMP
+    peaks = !omp_in_parallel();
+#endif
+
+    #pragma omp critical(report_memory)
+    {
+        if (djbz)
+            printf("%s: ", djbz->chunk_id);
+        printf(peaks ? _("memory after %s, MiB now/peak:") : _("memory after %s, MiB now:"), stage);
+        for (kind = 0; kind < mdjvu_memory_kinds_count; kind++)
+        {
+            printf(" %s %0.2f", mdjvu_memory_get_name((MinidjvuMemoryKind) kind),
+                   mdjvu_memory_get_current((MinidjvuMemoryKind) kind) / 1048576.0);
+            if (peaks)
+                printf("/%0.2f", mdjvu_memory_get_peak((MinidjvuMemoryKind) kind) / 1048576.0);
+        }
+        printf("\n");
+        if (peaks)
+            mdjvu_memory_reset_peaks();
+    }
+}
+
+static void report_memory(const char *stage)
+{
+    report_group_memory(stage, NULL);
+}
+
 static void sort_and_save_image(mdjvu_image_t image, const char *path, const struct InputFile* in)
 {
     mdjvu_error_t error;
@@ -172,6 +243,7 @@ static void sort_and_save_image(mdjvu_image_t image, const char *path, const str
     mdjvu_set_averaging(compr_opts, options.default_djbz_options->averaging);
     mdjvu_compress_image(image, compr_opts);
     mdjvu_compression_options_destroy(compr_opts);
+    report_memory(_("compression"));
 
     if (options.verbose) printf(_("encoding to `%s'\n"), path);
 
@@ -188,13 +260,12 @@ static void sort_and_save_image(mdjvu_image_t image, const char *path, const str
         fprintf(stderr, "%s: %s\n", path, mdjvu_get_error_message(error));
         exit(1);
     }
+    report_memory(_("saving"));
 }
 
-static mdjvu_bitmap_t load_bitmap(struct InputFile* in)
+// sets the output dpi from options, returns 1 if it should come from the file
+static int init_output_dpi(struct InputFile* in)
 {
-    mdjvu_error_t error = NULL;
-    mdjvu_bitmap_t bitmap;
-
     int detect_dpi = 1;
     in->output_dpi = options.default_image_options->dpi;
     if (options.default_image_options->dpi_specified) { // default dpi is overwritten
@@ -204,6 +275,28 @@ static mdjvu_bitmap_t load_bitmap(struct InputFile* in)
         in->output_dpi = in->image_options->dpi;
         detect_dpi = 0;
     }
+    return detect_dpi;
+}
+
+static void set_output_dpi_from_file(struct InputFile* in, int dpi_from_file)
+{
+    if (dpi_from_file != -1) { // we tried to read dpi from file
+        if (dpi_from_file < 20 || dpi_from_file > 2000) {
+            if (options.verbose) printf(_("Warning: image %s reports incorrect DPI value (%d) and default resolution %d will be used\n"), in->name, dpi_from_file, in->output_dpi);
+        } else {
+            in->output_dpi = dpi_from_file;
+        }
+    }
+
+    if (options.verbose) printf(_("resolution is %d dpi\n"), in->output_dpi);
+}
+
+static mdjvu_bitmap_t load_bitmap(struct InputFile* in)
+{
+    mdjvu_error_t error = NULL;
+    mdjvu_bitmap_t bitmap;
+
+    int detect_dpi = init_output_dpi(in);
 
     const struct ImageOptions* img_opts = in->image_options ? in->image_options : options.default_image_options;
 
@@ -221,27 +314,11 @@ static mdjvu_bitmap_t load_bitmap(struct InputFile* in)
             mdjvu_disable_tiff_warnings();
         int dpi_from_file = -1;
         bitmap = mdjvu_load_tiff(in->name, detect_dpi ? &dpi_from_file : NULL, &error, in->page);
-        if (detect_dpi && dpi_from_file != -1) { // we tried to read dpi from file
-            if (dpi_from_file < 20 || dpi_from_file > 2000) {
-                if (options.verbose) printf(_("Warning: image %s reports incorrect DPI value (%d) and default resolution %d will be used\n"), in->name, dpi_from_file, in->output_dpi);
-            } else {
-                in->output_dpi = dpi_from_file;
-            }
-        }
-
-        if (options.verbose) printf(_("resolution is %d dpi\n"), in->output_dpi);
+        set_output_dpi_from_file(in, dpi_from_file);
     }
     else if (decide_if_djvu(in->name))
     {
-        mdjvu_image_t image = load_image(in->name);
-        bitmap = mdjvu_render(image);
-        mdjvu_image_destroy(image);
-        if (options.verbose)
-        {
-            printf(_("bitmap %d x %d rendered\n"),
-                   mdjvu_bitmap_get_width(bitmap),
-                   mdjvu_bitmap_get_height(bitmap));
-        }
+        bitmap = load_and_render(in->name);
     }
     else
     {
@@ -296,6 +373,42 @@ static void save_bitmap(mdjvu_bitmap_t bitmap, const char *path, const struct In
 }
 
 /* ========================================================================= */
+/* A page decoded into a graymap is rendered right at the reduced size */
+static void decode_gray(mdjvu_image_t image)
+{
+    mdjvu_error_t error;
+    unsigned char **pixels;
+    int32 width, height;
+
+    pixels = mdjvu_render_gray(image, options.Reduce, &width, &height);
+    mdjvu_image_destroy(image);
+    report_memory(_("rendering"));
+
+    if (options.verbose)
+    {
+        printf(_("graymap %d x %d rendered\n"), width, height);
+        printf(_("saving to PGM file `%s'\n"), options.output_file);
+    }
+
+    if (!mdjvu_save_pgm(pixels, width, height, options.output_file, &error))
+    {
+        fprintf(stderr, "%s: %s\n", options.output_file, mdjvu_get_error_message(error));
+        exit(1);
+    }
+    mdjvu_destroy_2d_array(pixels);
+    report_memory(_("saving"));
+}
+
+/* A whole bitmap (not from DjVu, or smoothed) is rendered as a page of one blit */
+static void save_bitmap_gray(mdjvu_bitmap_t bitmap)
+{
+    mdjvu_image_t image = mdjvu_image_create(mdjvu_bitmap_get_width(bitmap),
+                                             mdjvu_bitmap_get_height(bitmap));
+    mdjvu_image_add_bitmap(image, bitmap);
+    mdjvu_image_add_blit(image, 0, 0, bitmap);
+    decode_gray(image);
+}
+
 static void decode()
 {
     mdjvu_image_t image;    /* a sequence of blits (what is stored in DjVu) */
@@ -306,19 +419,19 @@ static void decode()
         printf(_("________\n\n"));
     }
 
-    image = load_image(options.file_list.files[0]->name);
-    bitmap = mdjvu_render(image);
-    mdjvu_image_destroy(image);
+    const struct InputFile* in = options.file_list.files[0];
+    const struct ImageOptions* img_opts = in->image_options ? in->image_options : options.default_image_options;
 
-    if (options.verbose)
+    // smoothing works on the full-size page, so it is rendered first then
+    if (decide_if_pgm(options.output_file) && !img_opts->smooth)
     {
-        printf(_("bitmap %d x %d rendered\n"),
-               mdjvu_bitmap_get_width(bitmap),
-               mdjvu_bitmap_get_height(bitmap));
+        image = load_image(in->name);
+        report_memory(_("loading"));
+        decode_gray(image);
+        return;
     }
-
-    const struct InputFile* in = options.file_list.files[0];
-    const struct ImageOptions* img_opts = in->image_options ? in->image_options : options.default_image_options;
+    bitmap = load_and_render(in->name);
+    report_memory(_("loading and rendering"));
 
     if (img_opts->smooth)
     {
@@ -326,10 +439,48 @@ static void decode()
         mdjvu_smooth(bitmap);
     }
 
+    if (decide_if_pgm(options.output_file))
+    {
+        save_bitmap_gray(bitmap);
+        return;
+    }
+
     save_bitmap(bitmap, options.output_file, in);
     mdjvu_bitmap_destroy(bitmap);
+    report_memory(_("saving"));
+}
+
+
+static mdjvu_image_t clean_split_image(mdjvu_image_t image, const struct InputFile* in)
+{
+    const struct ImageOptions* img_opts = in->image_options ? in->image_options : options.default_image_options;
+
+    if (options.verbose)
+    {
+        printf(_("the split image has %d pieces\n"),
+               mdjvu_image_get_blit_count(image));
+    }
+
+    if (img_opts->clean)
+    {
+        if (options.verbose) printf(_("cleaning\n"));
+        mdjvu_clean(image);
+        if (options.verbose)
+        {
+            printf(_("the cleaned image has %d pieces\n"),
+                   mdjvu_image_get_blit_count(image));
+        }
+    }
+    return image;
 }
 
+// Split options of a page; flyspecks in halftones are erased during the split
+static mdjvu_split_options_t create_split_options(const struct ImageOptions* img_opts)
+{
+    mdjvu_split_options_t opt = mdjvu_split_options_create();
+    mdjvu_split_options_set_clean(opt, img_opts->clean);
+    return opt;
+}
 
 static mdjvu_image_t split_and_destroy(mdjvu_bitmap_t bitmap, const struct InputFile* in)
 {
@@ -349,30 +500,62 @@ static mdjvu_image_t split_and_destroy(mdjvu_bitmap_t bitmap, const struct Input
 
         return image;
     }
-    image = mdjvu_split(bitmap, in->output_dpi, /* options:*/ NULL);
+    mdjvu_split_options_t opt = create_split_options(img_opts);
+    image = mdjvu_split(bitmap, in->output_dpi, opt);
+    mdjvu_split_options_destroy(opt);
     mdjvu_bitmap_destroy(bitmap);
-    if (options.verbose)
+    return clean_split_image(image, in);
+}
+
+// Loads PBM, BMP and TIFF pages straight into a splitter,
+// so that the whole page bitmap is never held in memory.
+static mdjvu_image_t load_and_split(struct InputFile* in)
+{
+    mdjvu_error_t error = NULL;
+    mdjvu_splitter_t splitter;
+
+    const struct ImageOptions* img_opts = in->image_options ? in->image_options : options.default_image_options;
+
+    // these need the bitmap
+    if (img_opts->is_virtual || img_opts->smooth || decide_if_djvu(in->name))
+        return split_and_destroy(load_bitmap(in), in);
+
+    int detect_dpi = init_output_dpi(in);
+    mdjvu_split_options_t opt = create_split_options(img_opts);
+
+    if (decide_if_bmp(in->name))
     {
-        printf(_("the split image has %d pieces\n"),
-               mdjvu_image_get_blit_count(image));
+        if (options.verbose) printf(_("loading from Windows BMP file `%s'\n"), in->name);
+        splitter = mdjvu_load_bmp_split(in->name, opt, &error);
+    }
+    else if (decide_if_tiff(in->name))
+    {
+        if (options.verbose) printf(_("loading from TIFF file `%s'\n"), in->name);
+        if (!options.warnings)
+            mdjvu_disable_tiff_warnings();
+        int dpi_from_file = -1;
+        splitter = mdjvu_load_tiff_split(in->name, detect_dpi ? &dpi_from_file : NULL, opt, &error, in->page);
+        set_output_dpi_from_file(in, dpi_from_file);
     }
+    else
+    {
+        if (options.verbose) printf(_("loading from PBM file `%s'\n"), in->name);
+        splitter = mdjvu_load_pbm_split(in->name, opt, &error);
+    }
+    mdjvu_split_options_destroy(opt);
 
-    if (img_opts->clean)
+    if (!splitter)
     {
-        if (options.verbose) printf(_("cleaning\n"));
-        mdjvu_clean(image);
-        if (options.verbose)
-        {
-            printf(_("the cleaned image has %d pieces\n"),
-                   mdjvu_image_get_blit_count(image));
-        }
+        fprintf(stderr, "%s: %s\n", in->name, mdjvu_get_error_message(error));
+        exit(1);
     }
-    return image;
+
+    if (options.verbose) printf(_("splitting the bitmap into pieces\n"));
+    return clean_split_image(mdjvu_splitter_finish(splitter, in->output_dpi), in);
 }
 
 static void encode()
 {
-    mdjvu_bitmap_t bitmap;
     mdjvu_image_t image;
 
     if (options.verbose) {
@@ -382,8 +565,8 @@ static void encode()
 
     struct InputFile* in = options.file_list.files[0];
 
-    bitmap = load_bitmap(in);
-    image = split_and_destroy(bitmap, in);
+    image = load_and_split(in);
+    report_memory(_("loading and splitting"));
     if (options.save_as_chunk) {
         replace_suffix(options.output_file, "jb2");
     }
@@ -405,8 +588,15 @@ static void filter()
     struct InputFile* in = options.file_list.files[0];
 
     bitmap = load_bitmap(in);
+    report_memory(_("loading"));
+    if (decide_if_pgm(options.output_file))
+    {
+        save_bitmap_gray(bitmap);
+        return;
+    }
     save_bitmap(bitmap, options.output_file, in);
     mdjvu_bitmap_destroy(bitmap);
+    report_memory(_("saving"));
 }
 
 static void print_progress(double progress)
@@ -448,11 +638,21 @@ static void multipage_encode()
     int djbz_idx;
     double processed_pages = 0;
     // no need to check _OPENMP as unsupported pragmas are ignored
-#pragma omp parallel for schedule(static, 1) shared(processed_pages)
+    // with a single Djbz, threads are left to the per-page stages inside it
+#pragma omp parallel for schedule(static, 1) shared(processed_pages) if (options.djbz_list.size > 1)
     for (djbz_idx = 0; djbz_idx < options.djbz_list.size; djbz_idx++)
     {
         struct DjbzOptions* const djbz = options.djbz_list.djbzs[djbz_idx];
 
+        // bitmaps made while compressing the group come from a slab
+        // of this thread; it goes away with the last of them.
+        // A slab never reuses memory, so the small temporaries made here
+        // (uncropped averages, erosion masks while saving) stay allocated
+        // until the group's images go.
+        mdjvu_bitmap_slab_t slab = mdjvu_bitmap_slab_create();
+        mdjvu_bitmap_slab_set_current(slab);
+        mdjvu_bitmap_slab_release(slab);
+
         mdjvu_compression_options_t compr_opts = mdjvu_compression_options_create();
         mdjvu_matcher_options_t m_opt = get_matcher_options(djbz);
         mdjvu_set_matcher_options(compr_opts, m_opt);
@@ -474,12 +674,10 @@ static void multipage_encode()
         mdjvu_set_report_start_page(compr_opts, pages_compressed + 1);
 
 
-        mdjvu_bitmap_t bitmap;
         for (int i = 0; i < djbz->file_list_ref.size; i++)
         {
             struct InputFile* in = djbz->file_list_ref.files[i];
-            bitmap = load_bitmap(in);
-            images[i] = split_and_destroy(bitmap, in);
+            images[i] = load_and_split(in);
             if (options.report) {
                 printf(_("Loading: %d of %d completed\n"), pages_compressed + i + 1, options.file_list.size);
                 processed_pages += 0.3;
@@ -487,7 +685,10 @@ static void multipage_encode()
             }
         }
 
+        report_group_memory(_("loading and splitting"), djbz);
+
         mdjvu_image_t dict = mdjvu_compress_multipage(djbz->file_list_ref.size, images, compr_opts);
+        report_group_memory(_("compression"), djbz);
 
         if (mdjvu_image_get_bitmap_count(dict) == 0) {
             // do not save empty Djbz (Djbz might be empty for ex., if page list contains only 1 page)
@@ -567,8 +768,13 @@ static void multipage_encode()
         mdjvu_image_destroy(dict);
         MDJVU_FREEV(images);
         mdjvu_compression_options_destroy(compr_opts);
+        mdjvu_bitmap_slab_set_current(NULL);
+        report_group_memory(_("saving"), djbz);
     } //  #pragma omp parallel
 
+    if (options.djbz_list.size > 1)
+        report_memory(_("all Djbz groups"));
+
     // Saving document directory
     // Let's construct page chunks in a right order.
     int el_size = options.file_list.size + options.djbz_list.size; // max
@@ -792,6 +998,8 @@ static void process_options(int argc, char **argv)
             options.warnings = 1;
         else if (same_option(option, "report"))
             options.report = 1;
+        else if (same_option(option, "footprint"))
+            options.footprint = 1;
         else if (same_option(option, "Averaging"))
             options.default_djbz_options->averaging = 1;
         else if (same_option(option, "lossy"))
@@ -821,6 +1029,17 @@ static void process_options(int argc, char **argv)
                 exit(2);
             }
         }
+        else if (same_option(option, "Reduce"))
+        {
+            i++;
+            if (i == argc) show_usage_and_exit();
+            options.Reduce = atoi(argv[i]);
+            if (options.Reduce < 1)
+            {
+                fprintf(stderr, _("bad --Reduce value\n"));
+                exit(2);
+            }
+        }
         else if (same_option(option, "dpi"))
         {
             i++;
@@ -912,6 +1131,7 @@ int main(int argc, char **argv)
     app_options_init(&options);
 
     process_options(argc, argv);
+    mdjvu_memory_set_accounting(options.footprint);
 
 
     if (options.file_list.size > 1)
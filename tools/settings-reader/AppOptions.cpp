@@ -615,6 +615,8 @@ void app_options_init(struct AppOptions* opts)
     opts->match = 0;
     opts->Match = 0;
     opts->report = 0;
+    opts->footprint = 0;
+    opts->Reduce = 1;
     opts->warnings = 0;
     opts->indirect = 0;
     opts->save_as_chunk = 0;
@@ -93,6 +93,8 @@ struct AppOptions
     int match;
     int Match;
     int report;
+    int footprint; /* print memory taken by each stage */
+    int Reduce;    /* how many times smaller to decode into a graymap */
     int warnings;
     int indirect;
 